@@ -24,7 +24,7 @@
 
 #define SECTORSIZE          512
 #define ELFHDR              ((elf_header*) 0x3000) // scratch space
-#define KERNEL_START_SECTOR 128
+#define KERNEL_START_SECTOR 8320        // = block 1040 (after swap space)
 
 extern "C" {
 [[noreturn]] void boot();
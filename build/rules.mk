@@ -55,6 +55,10 @@ SANITIZEFLAGS := -fsanitize=undefined -fsanitize=kernel-address
 $(OBJDIR)/k-alloc.ko $(OBJDIR)/k-sanitizers.ko: SANITIZEFLAGS :=
 endif
 
+ifeq ($(TRACE),1)
+KERNELCXXFLAGS += -DCHICKADEE_TRACE=1
+endif
+
 QUIETOBJCOPY = sh build/quietobjcopy.sh $(OBJCOPY)
 
 
@@ -165,7 +169,7 @@ always:
 	@:
 
 # These targets don't correspond to files
-.PHONY: all always clean realclean distclean cleanfs fsck \
+.PHONY: all always clean realclean distclean cleanfs fsck trace profile kbench bench \
 	run run-graphic run-console run-monitor \
 	run-gdb run-gdb-graphic run-gdb-console run-gdb-report \
 	check-qemu-console check-qemu stop kill \
@@ -0,0 +1,238 @@
+#include <getopt.h>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "trace.hh"
+
+// tracedecode: decode kernel trace events from `log.txt`
+//    Reads the `!`-prefixed lines that a `make TRACE=1` kernel writes to
+//    its log (see trace.hh), prints a merged timeline, and optionally
+//    writes a Chrome trace file (load it at chrome://tracing or
+//    https://ui.perfetto.dev).
+
+struct event {
+    unsigned cpu;
+    uint64_t tsc;
+    unsigned type;
+    unsigned tid;
+    uint64_t arg0;
+    uint64_t arg1;
+};
+
+struct clock_sample {
+    unsigned long ticks;
+    uint64_t tsc;
+};
+
+static std::vector<event> events;
+static std::vector<clock_sample> clock_samples;
+static std::map<unsigned, unsigned long> ndropped;
+static unsigned hz = 0;
+
+
+static const char* type_name(unsigned type) {
+    return type < tr_ntypes ? trace_type_names[type] : "unknown";
+}
+
+static void read_log(FILE* f) {
+    char buf[BUFSIZ];
+    while (fgets(buf, sizeof(buf), f)) {
+        event e;
+        clock_sample cs;
+        unsigned cpu;
+        unsigned long n;
+        if (sscanf(buf, "!T %x %" SCNx64 " %x %x %" SCNx64 " %" SCNx64,
+                   &e.cpu, &e.tsc, &e.type, &e.tid, &e.arg0, &e.arg1) == 6) {
+            events.push_back(e);
+        } else if (sscanf(buf, "!C %u %lu %" SCNx64,
+                          &hz, &cs.ticks, &cs.tsc) == 3) {
+            clock_samples.push_back(cs);
+        } else if (sscanf(buf, "!D %x %lu", &cpu, &n) == 2) {
+            ndropped[cpu] += n;
+        }
+    }
+}
+
+// tsc_per_us()
+//    Estimate the TSC rate from the clock samples. Ticks are coarse, so
+//    use the two samples farthest apart.
+static double tsc_per_us() {
+    if (clock_samples.size() >= 2 && hz != 0) {
+        auto& a = clock_samples.front();
+        auto& b = clock_samples.back();
+        if (b.ticks > a.ticks && b.tsc > a.tsc) {
+            double us = (b.ticks - a.ticks) * 1e6 / hz;
+            return (b.tsc - a.tsc) / us;
+        }
+    }
+    fprintf(stderr, "tracedecode: too few clock samples, assuming 1 GHz\n");
+    return 1000.0;
+}
+
+static void print_args(FILE* f, const event& e) {
+    switch (e.type) {
+    case tr_syscall_enter:
+        fprintf(f, "syscall %" PRIu64, e.arg0);
+        break;
+    case tr_syscall_exit:
+        fprintf(f, "syscall %" PRIu64 " -> %" PRId64, e.arg0, int64_t(e.arg1));
+        break;
+    case tr_schedule:
+        fprintf(f, "from %" PRIu64, e.arg0);
+        break;
+    case tr_unblock:
+        fprintf(f, "task %" PRIu64, e.arg0);
+        break;
+    case tr_disk_submit:
+        fprintf(f, "off %" PRIu64 " size %" PRIu64, e.arg0, e.arg1);
+        break;
+    case tr_disk_complete:
+        fprintf(f, "slots 0x%" PRIx64, e.arg0);
+        break;
+    case tr_bufcache_hit:
+    case tr_bufcache_miss:
+        fprintf(f, "block %" PRIu64, e.arg0);
+        break;
+    default:
+        fprintf(f, "0x%" PRIx64 " 0x%" PRIx64, e.arg0, e.arg1);
+        break;
+    }
+}
+
+static void print_timeline(FILE* f, double rate, uint64_t tsc0) {
+    for (auto& e : events) {
+        fprintf(f, "%14.3f  cpu %u  tid %5u  %-14s ",
+                (e.tsc - tsc0) / rate, e.cpu, e.tid, type_name(e.type));
+        print_args(f, e);
+        fputc('\n', f);
+    }
+    for (auto& d : ndropped) {
+        fprintf(f, "cpu %u: %lu events dropped\n", d.first, d.second);
+    }
+}
+
+// write_chrome_trace(f, rate, tsc0)
+//    Write the Chrome trace event format. Process 0 shows what each CPU
+//    was running; process 1 shows system calls per task, plus the other
+//    events as instants.
+static void write_chrome_trace(FILE* f, double rate, uint64_t tsc0) {
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"ph\":\"M\",\"pid\":0,\"name\":\"process_name\","
+            "\"args\":{\"name\":\"CPUs\"}},\n");
+    fprintf(f, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\","
+            "\"args\":{\"name\":\"tasks\"}}");
+
+    std::map<unsigned, const event*> running;   // cpu -> last schedule
+    for (auto& e : events) {
+        double ts = (e.tsc - tsc0) / rate;
+        if (e.type == tr_schedule) {
+            auto it = running.find(e.cpu);
+            if (it != running.end()) {
+                double start = (it->second->tsc - tsc0) / rate;
+                fprintf(f, ",\n{\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+                        "\"name\":\"task %u\",\"ts\":%.3f,\"dur\":%.3f}",
+                        e.cpu, it->second->tid, start, ts - start);
+            }
+            running[e.cpu] = &e;
+        } else if (e.type == tr_syscall_enter || e.type == tr_syscall_exit) {
+            fprintf(f, ",\n{\"ph\":\"%s\",\"pid\":1,\"tid\":%u,"
+                    "\"name\":\"syscall %" PRIu64 "\",\"ts\":%.3f,"
+                    "\"args\":{\"cpu\":%u}}",
+                    e.type == tr_syscall_enter ? "B" : "E",
+                    e.tid, e.arg0, ts, e.cpu);
+        } else {
+            fprintf(f, ",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,"
+                    "\"name\":\"%s\",\"ts\":%.3f,\"args\":{\"cpu\":%u,"
+                    "\"arg0\":%" PRIu64 ",\"arg1\":%" PRIu64 "}}",
+                    e.tid, type_name(e.type), ts, e.cpu, e.arg0, e.arg1);
+        }
+    }
+    fprintf(f, "\n]}\n");
+}
+
+
+static void __attribute__((noreturn)) usage() {
+    fprintf(stderr, "Usage: tracedecode [-q] [-c JSONFILE] [LOGFILE]\n");
+    exit(2);
+}
+
+static void __attribute__((noreturn)) help() {
+    printf("Usage: tracedecode [-q] [-c JSONFILE] [LOGFILE]\n\
+Decode Chickadee kernel trace events from LOGFILE (default log.txt)\n\
+and print a timeline, in microseconds since the first event.\n\
+\n\
+  --chrome, -c JSONFILE  Also write a Chrome trace to JSONFILE\n\
+  --quiet, -q            Don’t print the timeline\n\
+  --help                 Display this help and exit\n");
+    exit(0);
+}
+
+static struct option options[] = {
+    { "chrome", required_argument, nullptr, 'c' },
+    { "quiet", no_argument, nullptr, 'q' },
+    { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 }
+};
+
+int main(int argc, char** argv) {
+    const char* chrome = nullptr;
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:q", options, nullptr)) != -1) {
+        switch (opt) {
+        case 'c':
+            chrome = optarg;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 'h':
+            help();
+        default:
+            usage();
+        }
+    }
+    if (optind != argc && optind + 1 != argc) {
+        usage();
+    }
+
+    const char* filename = optind + 1 == argc ? argv[optind] : "log.txt";
+    FILE* f = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    read_log(f);
+    if (events.empty()) {
+        fprintf(stderr, "%s: no trace events (was the kernel built "
+                "with `make TRACE=1`?)\n", filename);
+        exit(1);
+    }
+
+    // each CPU's events arrive in order, but CPUs are drained in turn
+    std::stable_sort(events.begin(), events.end(),
+                     [] (const event& a, const event& b) {
+                         return a.tsc < b.tsc;
+                     });
+    double rate = tsc_per_us();
+    uint64_t tsc0 = events.front().tsc;
+
+    if (!quiet) {
+        print_timeline(stdout, rate, tsc0);
+    }
+    if (chrome) {
+        FILE* cf = fopen(chrome, "w");
+        if (!cf) {
+            fprintf(stderr, "%s: %s\n", chrome, strerror(errno));
+            exit(1);
+        }
+        write_chrome_trace(cf, rate, tsc0);
+        fclose(cf);
+    }
+}
@@ -44,7 +44,7 @@ static constexpr uint32_t type_directory = 2;
 struct superblock {
     uint64_t magic;               // must equal `chkfs::magic`
     blocknum_t nblocks;           // # blocks in file system
-    blocknum_t nswap;             // # blocks in swap space (unused)
+    blocknum_t nswap;             // # blocks in swap space
     inum_t ninodes;               // # inodes in file system
     blocknum_t njournal;          // # blocks in journal
     blocknum_t swap_bn;           // first swap space block
@@ -0,0 +1,332 @@
+#ifndef CHICKADEE_FORMAT_HH
+#define CHICKADEE_FORMAT_HH
+
+// format.hh
+//
+//    Type-safe formatting with printf-style format strings parsed at
+//    compile time. `snformat(buf, size, "%s: %5lu\n", name, n)` behaves
+//    like `snprintf`, but the format string is parsed by a `consteval`
+//    constructor, so no `%` scanning happens at run time, and a
+//    conversion that doesn't suit its argument's type (or a wrong number
+//    of arguments) is a compile error. Argument types, not length
+//    modifiers, choose the emitter: `%d` prints a `long` as a `long`.
+//    Decimal conversion emits two digits at a time.
+//
+//    Supported: flags `-0#+ `, decimal width and precision, length
+//    modifiers (ignored), and conversions `d i u x X p s c %`. Use the
+//    `printer` functions for `*` widths and `%C` colors.
+//
+//    Included by lib.hh. See also `log_format` (kernel) and `dformat`
+//    and `fformat` (user).
+
+struct format_conv {
+    uint16_t litpos_ = 0;   // offset of literal text before this conversion
+    uint16_t litlen_ = 0;
+    char conv_ = 0;         // conversion character, or 0 for trailing text
+    uint8_t flags_ = 0;
+    uint8_t width_ = 0;
+    int8_t precision_ = -1; // -1 if none
+
+    enum {
+        f_left = 1, f_zero = 2, f_alt = 4, f_plus = 8, f_space = 16,
+        f_litpct = 32       // literal text contains `%%`
+    };
+};
+
+enum format_kind : uint8_t {
+    fk_signed, fk_unsigned, fk_string, fk_pointer
+};
+
+template <typename T>
+consteval format_kind format_kind_of() {
+    if constexpr (std::is_same_v<T, char*>
+                  || std::is_same_v<T, const char*>) {
+        return fk_string;
+    } else if constexpr (std::is_pointer_v<T>
+                         || std::is_null_pointer_v<T>) {
+        return fk_pointer;
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        return fk_signed;
+    } else {
+        static_assert(std::is_integral_v<T>, "cannot format this type");
+        return fk_unsigned;
+    }
+}
+
+// Calling this non-`constexpr` function from the `consteval` parser
+// makes a bad format string a compile error that mentions it.
+void format_string_error(const char* message);
+
+
+// format_string<Args...>
+//    A format string checked against argument types `Args`.
+
+template <typename... Args>
+struct format_string {
+    const char* str_;
+    format_conv convs_[sizeof...(Args) + 1];
+
+    consteval format_string(const char* str)
+        : str_(str), convs_() {
+        constexpr unsigned nargs = sizeof...(Args);
+        constexpr format_kind kinds[] = {
+            format_kind_of<Args>()..., fk_signed
+        };
+        unsigned pos = 0, nconv = 0;
+        while (true) {
+            format_conv& c = convs_[min(nconv, nargs)];
+            c.litpos_ = pos;
+            // literal text
+            while (str[pos] && (str[pos] != '%' || str[pos + 1] == '%')) {
+                if (str[pos] == '%') {
+                    c.flags_ |= format_conv::f_litpct;
+                    ++pos;
+                }
+                ++pos;
+            }
+            c.litlen_ = pos - c.litpos_;
+            if (!str[pos]) {
+                if (nconv != nargs) {
+                    format_string_error("too many arguments");
+                }
+                return;
+            }
+            if (nconv == nargs) {
+                format_string_error("too few arguments");
+            }
+
+            // flags
+            for (++pos; true; ++pos) {
+                if (str[pos] == '-') {
+                    c.flags_ |= format_conv::f_left;
+                } else if (str[pos] == '0') {
+                    c.flags_ |= format_conv::f_zero;
+                } else if (str[pos] == '#') {
+                    c.flags_ |= format_conv::f_alt;
+                } else if (str[pos] == '+') {
+                    c.flags_ |= format_conv::f_plus;
+                } else if (str[pos] == ' ') {
+                    c.flags_ |= format_conv::f_space;
+                } else {
+                    break;
+                }
+            }
+            // width and precision
+            unsigned width = 0;
+            for (; str[pos] >= '0' && str[pos] <= '9'; ++pos) {
+                width = width * 10 + str[pos] - '0';
+            }
+            if (str[pos] == '.') {
+                unsigned precision = 0;
+                for (++pos; str[pos] >= '0' && str[pos] <= '9'; ++pos) {
+                    precision = precision * 10 + str[pos] - '0';
+                }
+                if (precision > 127) {
+                    format_string_error("precision too large");
+                }
+                c.precision_ = precision;
+            }
+            if (width > 255) {
+                format_string_error("width too large");
+            } else if (str[pos] == '*') {
+                format_string_error("`*` is not supported");
+            }
+            c.width_ = width;
+            // length modifiers
+            while (str[pos] == 'h' || str[pos] == 'l' || str[pos] == 'z'
+                   || str[pos] == 't' || str[pos] == 'j') {
+                ++pos;
+            }
+
+            // conversion
+            c.conv_ = str[pos];
+            format_kind k = kinds[nconv];
+            switch (c.conv_) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'c':
+                if (k != fk_signed && k != fk_unsigned) {
+                    format_string_error("conversion needs an integer");
+                }
+                break;
+            case 's':
+                if (k != fk_string) {
+                    format_string_error("%s needs a string");
+                }
+                break;
+            case 'p':
+                if (k != fk_pointer && k != fk_string) {
+                    format_string_error("%p needs a pointer");
+                }
+                break;
+            default:
+                format_string_error("unknown conversion");
+            }
+            ++pos;
+            ++nconv;
+        }
+    }
+};
+
+
+// format_buffer
+//    Output for the formatting functions. Text goes into `[s_, end_)`;
+//    when that fills, `flush_` (if set) is called and the buffer reused,
+//    otherwise further text is counted but dropped.
+
+extern const char format_digit_pairs[201];
+
+struct format_buffer {
+    char* s_;
+    char* end_;
+    char* start_;
+    size_t n_ = 0;                        // total characters formatted
+    void (*flush_)(void* arg, const char* s, size_t n) = nullptr;
+    void* flush_arg_ = nullptr;
+
+    inline format_buffer(char* s, char* end)
+        : s_(s), end_(end), start_(s) {
+    }
+
+    inline void put(const char* p, size_t n) {
+        if (size_t(end_ - s_) >= n) {
+            memcpy(s_, p, n);
+            s_ += n;
+            n_ += n;
+        } else {
+            put_slow(p, n);
+        }
+    }
+    inline void putc(char c) {
+        put(&c, 1);
+    }
+    void put_slow(const char* p, size_t n);
+    void put_literal_pct(const char* p, size_t n);
+    void put_literal(const char* str, const format_conv& c);
+    void put_number(const format_conv& c, unsigned long v, bool negative);
+    void put_string(const format_conv& c, const char* s);
+    void flush();
+
+    template <typename T> inline void put_arg(const char* str,
+                                              const format_conv& c, T x);
+};
+
+// format_decimal(end, v)
+//    Write `v` in decimal ending at `end`; return a pointer to the first
+//    digit. Needs at most 20 bytes.
+inline char* format_decimal(char* end, unsigned long v) {
+    while (v >= 100) {
+        unsigned r = v % 100;
+        v /= 100;
+        end -= 2;
+        memcpy(end, &format_digit_pairs[2 * r], 2);
+    }
+    if (v >= 10) {
+        end -= 2;
+        memcpy(end, &format_digit_pairs[2 * v], 2);
+    } else {
+        *--end = '0' + v;
+    }
+    return end;
+}
+
+inline void format_buffer::put_literal(const char* str, const format_conv& c) {
+    if (c.litlen_ == 0) {
+        return;
+    } else if (c.flags_ & format_conv::f_litpct) {
+        put_literal_pct(str + c.litpos_, c.litlen_);
+    } else {
+        put(str + c.litpos_, c.litlen_);
+    }
+}
+
+template <typename T>
+inline void format_buffer::put_arg(const char* str, const format_conv& c,
+                                   T x) {
+    put_literal(str, c);
+    constexpr format_kind k = format_kind_of<T>();
+    if constexpr (k == fk_string) {
+        if (c.conv_ == 's') {
+            put_string(c, x);
+        } else {
+            put_number(c, reinterpret_cast<uintptr_t>(x), false);
+        }
+    } else if constexpr (k == fk_pointer) {
+        put_number(c, reinterpret_cast<uintptr_t>(x), false);
+    } else if (c.conv_ == 'c') {
+        putc(char(x));
+    } else if (c.width_ == 0 && c.flags_ == 0 && c.precision_ < 0
+               && (c.conv_ == 'd' || c.conv_ == 'i' || c.conv_ == 'u')) {
+        // fast path: plain decimal
+        char buf[24];
+        char* end = buf + sizeof(buf);
+        char* p;
+        if constexpr (k == fk_signed) {
+            if (c.conv_ == 'u') {
+                p = format_decimal(end, std::make_unsigned_t<T>(x));
+            } else {
+                p = format_decimal(end, x < 0 ? -(unsigned long) x : x);
+                if (x < 0) {
+                    *--p = '-';
+                }
+            }
+        } else {
+            p = format_decimal(end, x);
+        }
+        put(p, end - p);
+    } else if constexpr (k == fk_signed) {
+        bool negative = x < 0 && c.conv_ != 'x' && c.conv_ != 'X'
+            && c.conv_ != 'u';
+        unsigned long v = negative
+            ? -(unsigned long) x
+            : (unsigned long) std::make_unsigned_t<T>(x);
+        put_number(c, v, negative);
+    } else {
+        put_number(c, x, false);
+    }
+}
+
+
+// snformat(s, size, format, args...)
+//    Like `snprintf(s, size, format, args...)` with a checked format.
+//    Returns the length of the full output; writes at most `size` bytes,
+//    including a terminating null character if `size > 0`.
+
+template <typename... Args>
+__always_inline size_t snformat(char* s, size_t size,
+                                format_string<std::decay_t<Args>...> fmt,
+                                const Args&... args) {
+    format_buffer b(s, s + (size ? size - 1 : 0));
+    unsigned i = 0;
+    (b.put_arg(fmt.str_, fmt.convs_[i++], args), ...);
+    b.put_literal(fmt.str_, fmt.convs_[i]);
+    if (size) {
+        *b.s_ = '\0';
+    }
+    return b.n_;
+}
+
+// format_stream(buf, size, flush, arg, format, args...)
+//    Format into `buf`, calling `flush(arg, buf, n)` for each full buffer
+//    and for the remaining output. Returns the output length.
+
+template <typename... Args>
+__always_inline size_t format_stream(char* buf, size_t size,
+                                     void (*flush)(void*, const char*, size_t),
+                                     void* arg,
+                                     format_string<std::decay_t<Args>...> fmt,
+                                     const Args&... args) {
+    format_buffer b(buf, buf + size);
+    b.flush_ = flush;
+    b.flush_arg_ = arg;
+    unsigned i = 0;
+    (b.put_arg(fmt.str_, fmt.convs_[i++], args), ...);
+    b.put_literal(fmt.str_, fmt.convs_[i]);
+    b.flush();
+    return b.n_;
+}
+
+#endif
@@ -88,6 +88,7 @@ inline void ahcistate::acknowledge(int slot, int result) {
         *slot_status_[slot] = result;
         slot_status_[slot] = nullptr;
     }
+    slot_done_[slot] = nullptr;
 }
 
 
@@ -99,36 +100,75 @@ inline void ahcistate::acknowledge(int slot, int result) {
 //    `off`. `sz` and `off` are measured in bytes, but must be
 //    sector-aligned (i.e., multiples of `ahcistate::sectorsize`).
 //    Can block. Returns 0 on success and an error code on failure.
+//
+// ahcistate::read_or_write(command, bufs, nbufs, bufsz, off)
+//    Same, but transfer `nbufs` buffers of `bufsz` bytes each, which
+//    correspond to consecutive disk locations starting at `off`, with a
+//    single command. At most 16 buffers of at most 64KiB each.
 
-int ahcistate::read_or_write(idecommand command, void* buf, size_t sz,
-                             size_t off) {
-    // `sz` and `off` must be sector-aligned
-    assert(sz % sectorsize == 0 && off % sectorsize == 0);
-
-    // acquire lock
+int ahcistate::read_or_write(idecommand command, void* const* bufs,
+                             size_t nbufs, size_t bufsz, size_t off) {
     auto irqs = lock_.lock();
+    int slot = claim_slot(irqs);
 
-    // block until ready for command
-    waiter().wait_until(wq_, [&] () {
-            return !slots_outstanding_mask_;
-        }, lock_, irqs);
-
-    // send command, record buffer and status storage
+    // send command, record status storage
     std::atomic<int> r = E_AGAIN;
-    clear(0);
-    push_buffer(0, buf, sz);
-    issue_ncq(0, command, off / sectorsize);
-    slot_status_[0] = &r;
+    issue_read_or_write(slot, command, bufs, nbufs, bufsz, off);
+    slot_status_[slot] = &r;
 
     lock_.unlock(irqs);
 
-    // wait for response
-    waiter().wait_until(wq_, [&] () {
+    // wait for response, keyed by status address
+    waiter(reinterpret_cast<uintptr_t>(&r)).wait_until(wq_, [&] () {
             return r != E_AGAIN;
         });
     return r;
 }
 
+// ahcistate::start_read_or_write(command, bufs, nbufs, bufsz, off,
+//                                done, arg)
+//    Like `read_or_write`, but return once the command is issued. The
+//    interrupt handler calls `done(arg, status)` when it completes.
+void ahcistate::start_read_or_write(idecommand command, void* const* bufs,
+                                    size_t nbufs, size_t bufsz, size_t off,
+                                    done_function done, void* arg) {
+    assert(done);
+    auto irqs = lock_.lock();
+    int slot = claim_slot(irqs);
+    issue_read_or_write(slot, command, bufs, nbufs, bufsz, off);
+    slot_done_[slot] = done;
+    slot_done_arg_[slot] = arg;
+    lock_.unlock(irqs);
+}
+
+// ahcistate::claim_slot(irqs)
+//    Block until an NCQ slot is free, then return its number. `lock_`
+//    must be locked. Any waiter can take any slot, so each completion
+//    wakes one waiter per freed slot (see `handle_interrupt`).
+int ahcistate::claim_slot(irqstate& irqs) {
+    waiter(0, true).wait_until(wq_, [&] () {
+            return slots_outstanding_mask_ != slots_full_mask_;
+        }, lock_, irqs);
+    return lsb(~slots_outstanding_mask_ & slots_full_mask_) - 1;
+}
+
+// ahcistate::issue_read_or_write(slot, command, bufs, nbufs, bufsz, off)
+//    Issue a read or write in `slot`. `lock_` must be locked.
+void ahcistate::issue_read_or_write(int slot, idecommand command,
+                                    void* const* bufs, size_t nbufs,
+                                    size_t bufsz, size_t off) {
+    // `bufsz` and `off` must be sector-aligned
+    assert(bufsz % sectorsize == 0 && off % sectorsize == 0);
+    assert(nbufs > 0 && nbufs <= arraysize(dma_.ct[0].buf));
+    clear(slot);
+    for (size_t i = 0; i != nbufs; ++i) {
+        push_buffer(slot, bufs[i], bufsz);
+    }
+    issue_ncq(slot, command, off / sectorsize);
+    trace(tr_disk_submit, off, nbufs * bufsz);
+    usage_add(&usage_counters::ndiskio);
+}
+
 
 // FUNCTIONS FOR HANDLING INTERRUPTS
 
@@ -142,6 +182,18 @@ void ahcistate::handle_interrupt() {
     pr_->interrupt_status = ~0U;
     dr_->interrupt_status = ~0U;
 
+    // remember status addresses, which key the waiters, and completion
+    // callbacks, which run once the lock is released
+    uint32_t outstanding = slots_outstanding_mask_;
+    std::atomic<int>* status[32];
+    done_function done[32];
+    void* done_arg[32];
+    for (int slot = 0; slot != 32; ++slot) {
+        status[slot] = slot_status_[slot];
+        done[slot] = slot_done_[slot];
+        done_arg[slot] = slot_done_arg_[slot];
+    }
+
     // acknowledge completed commands
     uint32_t acks = slots_outstanding_mask_ & ~pr_->ncq_active_mask;
     for (int slot = 0; acks != 0; ++slot, acks >>= 1) {
@@ -155,11 +207,27 @@ void ahcistate::handle_interrupt() {
         handle_error_interrupt();
     }
 
+    uint32_t completed = outstanding & ~slots_outstanding_mask_;
     lock_.unlock(irqs);
+    trace(tr_disk_complete, completed);
 
-    // wake waiters
+    // wake each completed command's waiter or run its callback, then
+    // one task waiting to issue a command per freed slot. (A key may be
+    // stale if its waiter has already returned; that can only cause a
+    // spurious wakeup.) Errors don't get here: they panic.
     lapicstate::get().ack();
-    wq_.notify_all();
+    unsigned nfreed = 0;
+    for (int slot = 0; completed != 0; ++slot, completed >>= 1) {
+        nfreed += completed & 1;
+        if ((completed & 1) && status[slot]) {
+            wq_.notify_key(reinterpret_cast<uintptr_t>(status[slot]));
+        } else if ((completed & 1) && done[slot]) {
+            done[slot](done_arg[slot], 0);
+        }
+    }
+    if (nfreed) {
+        wq_.notify_key(0, nfreed);
+    }
 }
 
 void ahcistate::handle_error_interrupt() {
@@ -225,6 +293,7 @@ ahcistate::ahcistate(int pci_addr, int sata_port, volatile regs* dr)
       nslots_available_(1), slots_outstanding_mask_(0) {
     for (int i = 0; i < 32; ++i) {
         slot_status_[i] = nullptr;
+        slot_done_[i] = nullptr;
     }
 
     auto& pci = pcistate::get();
@@ -110,6 +110,10 @@ struct ahcistate {
     static constexpr size_t sectorsize = 512;
 
 
+    // completion callback for asynchronous commands
+    using done_function = void (*)(void* arg, int status);
+
+
     // DMA and memory-mapped I/O state
     dmastate dma_;
     int pci_addr_;
@@ -129,6 +133,8 @@ struct ahcistate {
     unsigned nslots_available_;         // # slots available for commands
     uint32_t slots_outstanding_mask_;   // 1 == that slot is used
     std::atomic<int>* slot_status_[32]; // ptrs to status storage, one per slot
+    done_function slot_done_[32];       // completion callbacks, one per slot
+    void* slot_done_arg_[32];
 
 
     ahcistate(int pci_addr, int sata_port, volatile regs* mr);
@@ -138,13 +144,27 @@ struct ahcistate {
     // high-level functions (they block)
     inline int read(void* buf, size_t sz, size_t off);
     inline int write(const void* buf, size_t sz, size_t off);
-    int read_or_write(idecommand cmd, void* buf, size_t sz, size_t off);
+    inline int read_or_write(idecommand cmd, void* buf, size_t sz, size_t off);
+    int read_or_write(idecommand cmd, void* const* bufs, size_t nbufs,
+                      size_t bufsz, size_t off);
+
+    // asynchronous reads: block only until a command slot is free, then
+    // return; `done(arg, status)` is called from the interrupt handler
+    // when the read completes. Several commands may be in flight at once.
+    inline void start_read(void* buf, size_t sz, size_t off,
+                           done_function done, void* arg);
+    void start_read_or_write(idecommand cmd, void* const* bufs,
+                             size_t nbufs, size_t bufsz, size_t off,
+                             done_function done, void* arg);
 
     // interrupt handlers
     void handle_interrupt();
     void handle_error_interrupt();
 
     // internal functions
+    int claim_slot(irqstate& irqs);
+    void issue_read_or_write(int slot, idecommand cmd, void* const* bufs,
+                             size_t nbufs, size_t bufsz, size_t off);
     void clear(int slot);
     void push_buffer(int slot, void* data, size_t sz);
     void issue_meta(int slot, idecommand cmd, int features, int count = -1);
@@ -161,5 +181,13 @@ inline int ahcistate::write(const void* buf, size_t sz, size_t off) {
     return read_or_write(cmd_write_fpdma_queued, const_cast<void*>(buf),
                          sz, off);
 }
+inline int ahcistate::read_or_write(idecommand cmd, void* buf, size_t sz,
+                                    size_t off) {
+    return read_or_write(cmd, &buf, 1, sz, off);
+}
+inline void ahcistate::start_read(void* buf, size_t sz, size_t off,
+                                  done_function done, void* arg) {
+    start_read_or_write(cmd_read_fpdma_queued, &buf, 1, sz, off, done, arg);
+}
 
 #endif
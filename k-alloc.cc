@@ -4,72 +4,217 @@
 static spinlock page_lock;
 static uintptr_t next_free_pa;
 
+// freed single pages are kept on a list threaded through the pages
+// themselves; `alloc_order` remembers each allocation's size so `kfree`
+// can return every page of a larger allocation
+struct freepage {
+    freepage* next_;
+};
+static freepage* free_pages;
+static size_t nfree_pages;
+static uint8_t* alloc_order;       // one entry per physical page
+
+// idle CPUs keep a pool of pre-zeroed pages for `KALLOC_ZERO` requests
+// (only the `next_` link of a pooled page is nonzero)
+static constexpr size_t zero_pool_target = 64;
+static freepage* zero_pages;
+static size_t nzero_pages;
+
+
+// pop_page(list)
+//    Remove and return the first page on `list`. `page_lock` must be held.
+static void* pop_page(freepage*& list) {
+    freepage* fp = list;
+    if (fp) {
+        list = fp->next_;
+        fp->next_ = nullptr;
+    }
+    return fp;
+}
+
+// bump_allocate(allocsz)
+//    Return `allocsz` bytes of never-allocated memory aligned to `allocsz`
+//    (or to `HUGEPAGESIZE`, if that is smaller), or `nullptr`. `page_lock`
+//    must be held, unless called from `init_kalloc`. Skips over reserved
+//    and kernel memory; a failed large allocation leaves `next_free_pa`
+//    alone, so smaller requests can still succeed.
+static void* bump_allocate(size_t allocsz) {
+    uintptr_t pa = next_free_pa;
+    auto range = physical_ranges.find(pa);
+    while (range != physical_ranges.end()) {
+        pa = round_up(pa, min(allocsz, HUGEPAGESIZE));
+        if (range->type() == mem_available && pa + allocsz <= range->last()) {
+            next_free_pa = pa + allocsz;
+            if (alloc_order) {
+                alloc_order[pa / PAGESIZE] = msb(allocsz / PAGESIZE) - 1;
+            }
+            return pa2kptr<void*>(pa);
+        }
+        // move to next range
+        pa = range->last();
+        ++range;
+    }
+    return nullptr;
+}
+
 
 // init_kalloc
 //    Initialize stuff needed by `kalloc`. Called from `init_hardware`,
 //    after `physical_ranges` is initialized.
 void init_kalloc() {
-    // do nothing for now
+    // allocate `alloc_order`, which is sized by installed memory
+    size_t npages = memsize_physical / PAGESIZE;
+    alloc_order = static_cast<uint8_t*>(
+        bump_allocate(max(round_up_pow2(npages), PAGESIZE))
+    );
+    assert(alloc_order);
+    memset(alloc_order, 0, npages);
 }
 
 
-// kalloc(sz)
+// kalloc(sz, flags)
 //    Allocate and return a pointer to at least `sz` contiguous bytes of
 //    memory. Returns `nullptr` if `sz == 0` or on failure.
 //
-//    The caller should initialize the returned memory before using it.
-//    The handout allocator sets returned memory to 0xCC (this corresponds
+//    If `flags & KALLOC_ZERO`, the returned memory is zero-filled, and
+//    single pages come from the pre-zeroed pool when possible. Otherwise
+//    the caller should initialize the returned memory before using it.
+//    The handout allocator sets such memory to 0xCC (this corresponds
 //    to the x86 `int3` instruction and may help you debug).
 //
 //    If `sz` is a multiple of `PAGESIZE`, the returned pointer is guaranteed
-//    to be page-aligned.
+//    to be page-aligned. Requests larger than a page are rounded up to a
+//    power of two and aligned to that size (or to `HUGEPAGESIZE`, if that
+//    is smaller), so `kalloc(HUGEPAGESIZE)` returns memory that can back a
+//    2MiB mapping.
 //
-//    The handout code does not free memory and allocates memory in units
-//    of pages.
-void* kalloc(size_t sz) {
-    if (sz == 0 || sz > PAGESIZE) {
+//    Memory is allocated in units of pages. Single pages freed by `kfree`
+//    are reused before fresh memory; larger allocations always come from
+//    fresh memory. `kalloc` never blocks; see `kalloc_reclaim` for an
+//    allocator that can evict pages to make room.
+void* kalloc(size_t sz, int flags) {
+    if (sz == 0 || sz > memsize_physical) {
         return nullptr;
     }
+    size_t allocsz = max(round_up_pow2(sz), PAGESIZE);
+    bool want_zero = flags & KALLOC_ZERO;
 
     auto irqs = page_lock.lock();
     void* ptr = nullptr;
+    bool zeroed = false;
 
-    // skip over reserved and kernel memory
-    auto range = physical_ranges.find(next_free_pa);
-    while (range != physical_ranges.end()) {
-        if (range->type() == mem_available) {
-            // use this page
-            ptr = pa2kptr<void*>(next_free_pa);
-            next_free_pa += PAGESIZE;
-            break;
-        } else {
-            // move to next range
-            next_free_pa = range->last();
-            ++range;
-        }
+    if (allocsz == PAGESIZE && want_zero && zero_pages) {
+        ptr = pop_page(zero_pages);
+        --nzero_pages;
+        zeroed = true;
+    }
+    if (!ptr && allocsz == PAGESIZE) {
+        // prefer a previously-freed page
+        ptr = pop_page(free_pages);
+        nfree_pages -= ptr != nullptr;
+    }
+    if (!ptr) {
+        ptr = bump_allocate(allocsz);
+    }
+    if (!ptr && allocsz == PAGESIZE && zero_pages) {
+        // last resort: a pre-zeroed page
+        ptr = pop_page(zero_pages);
+        --nzero_pages;
+        zeroed = true;
     }
 
     page_lock.unlock(irqs);
 
     if (ptr) {
         // tell sanitizers the allocated page is accessible
-        asan_mark_memory(ka2pa(ptr), PAGESIZE, false);
-        // initialize to `int3`
-        memset(ptr, 0xCC, PAGESIZE);
+        asan_mark_memory(ka2pa(ptr), allocsz, false);
+        if (want_zero) {
+            if (!zeroed) {
+                memset(ptr, 0, allocsz);
+            }
+        } else {
+            // initialize to `int3`
+            memset(ptr, 0xCC, allocsz);
+        }
     }
     return ptr;
 }
 
 
+// kalloc_refill_zero_pool()
+//    Zero one free page and add it to the pre-zeroed pool. Returns false
+//    if the pool is full or no memory is free. Called by idle CPUs.
+bool kalloc_refill_zero_pool() {
+    auto irqs = page_lock.lock();
+    void* ptr = nullptr;
+    if (nzero_pages < zero_pool_target) {
+        ptr = pop_page(free_pages);
+        nfree_pages -= ptr != nullptr;
+        if (!ptr) {
+            ptr = bump_allocate(PAGESIZE);
+        }
+    }
+    page_lock.unlock(irqs);
+
+    if (!ptr) {
+        return false;
+    }
+    memset(ptr, 0, PAGESIZE);
+
+    irqs = page_lock.lock();
+    auto fp = static_cast<freepage*>(ptr);
+    fp->next_ = zero_pages;
+    zero_pages = fp;
+    ++nzero_pages;
+    page_lock.unlock(irqs);
+    return true;
+}
+
+
 // kfree(ptr)
 //    Free a pointer previously returned by `kalloc`. Does nothing if
 //    `ptr == nullptr`.
 void kfree(void* ptr) {
-    if (ptr) {
-        // tell sanitizers the freed page is inaccessible
-        asan_mark_memory(ka2pa(ptr), PAGESIZE, true);
+    if (!ptr) {
+        return;
+    }
+    uintptr_t pa = ka2pa(ptr);
+    assert((pa & PAGEOFFMASK) == 0 && pa < memsize_physical);
+    size_t npages = size_t(1) << alloc_order[pa / PAGESIZE];
+    alloc_order[pa / PAGESIZE] = 0;
+
+    // tell sanitizers the freed pages are inaccessible
+    asan_mark_memory(pa, npages * PAGESIZE, true);
+
+    auto irqs = page_lock.lock();
+    for (size_t i = npages; i != 0; --i) {
+        auto fp = pa2kptr<freepage*>(pa + (i - 1) * PAGESIZE);
+        fp->next_ = free_pages;
+        free_pages = fp;
     }
-    log_printf("kfree not implemented yet\n");
+    nfree_pages += npages;
+    page_lock.unlock(irqs);
+}
+
+
+// kalloc_page_counts(nfree, nallocated)
+//    Free pages are freed single pages, pre-zeroed pages, and never-
+//    allocated memory; pages skipped to align large allocations count as
+//    allocated.
+void kalloc_page_counts(size_t* nfree, size_t* nallocated) {
+    auto irqs = page_lock.lock();
+    size_t total = 0, fresh = 0;
+    for (auto& range : physical_ranges) {
+        if (range.type() == mem_available) {
+            total += range.last() - range.first();
+            if (range.last() > next_free_pa) {
+                fresh += range.last() - max(range.first(), next_free_pa);
+            }
+        }
+    }
+    *nfree = nfree_pages + nzero_pages + fresh / PAGESIZE;
+    page_lock.unlock(irqs);
+    *nallocated = total / PAGESIZE - *nfree;
 }
 
 
@@ -28,6 +28,7 @@ struct lapicstate {
     };
 
     enum ipi_type_t {
+        ipi_fixed = 0,
         ipi_init = 0x500,
         ipi_startup = 0x600
     };
@@ -75,6 +76,8 @@ struct lapicstate {
 
     // send an IPI to all other processes
     inline void ipi_others(ipi_type_t ipi_type, int vector = 0);
+    // send interrupt `vector` to the processor with APIC ID `apic_id`
+    inline void ipi(uint32_t apic_id, int vector);
     // return if the previous IPI has not completed
     inline bool ipi_pending() const;
 
@@ -157,6 +160,13 @@ inline void lapicstate::ack() {
 inline void lapicstate::ipi_others(ipi_type_t t, int vector) {
     write(reg_icr_low, ipi_all_excluding_self | ipi_level_assert | t | vector);
 }
+inline void lapicstate::ipi(uint32_t apic_id, int vector) {
+    while (ipi_pending()) {
+        pause();
+    }
+    write(reg_icr_high, apic_id << 24);
+    write(reg_icr_low, ipi_given | ipi_level_assert | ipi_fixed | vector);
+}
 inline bool lapicstate::ipi_pending() const {
     return (read(reg_icr_low) & ipi_delivery_status) != 0;
 }
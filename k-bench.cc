@@ -0,0 +1,335 @@
+#include "kernel.hh"
+#include "k-chkfs.hh"
+#include "k-vmiter.hh"
+
+// k-bench.cc
+//
+//    In-kernel microbenchmarks, run by `sys_ktest(KTEST_BENCH, index,
+//    nbcpu)` (see p-kbench.cc). Each benchmark runs on dedicated kernel
+//    worker tasks spread over the first `nbcpu` CPUs. A worker times
+//    batches of operations with `rdtsc()`; the report gives percentiles
+//    of TSC cycles per operation over all batches of all workers.
+//
+//    Workers keep interrupts enabled, so high percentiles include timer
+//    interrupts and other noise; compare medians across kernels.
+
+
+namespace {
+
+struct kbench {
+    const char* name;
+    unsigned batch;                   // operations per timed sample
+    unsigned nworkers;                // 0 means one per CPU
+    int (*setup)(unsigned nworkers);  // optional; returns 0 or error
+    void (*run)(unsigned worker, unsigned n);   // do `n` operations
+    void (*teardown)();               // optional
+};
+
+constexpr unsigned bench_nsamples = 256;      // samples per worker
+constexpr unsigned bench_maxslots = 2;        // workers per CPU
+
+proc* bench_pool[MAXCPU][bench_maxslots];
+uint64_t* bench_samples;                      // [MAXCPU * maxslots][nsamples]
+std::atomic_flag bench_busy;
+
+// state of the current run
+const kbench* bench_current;
+unsigned bench_nbcpu;
+unsigned bench_nworkers;
+std::atomic<unsigned> bench_gen;
+std::atomic<unsigned> bench_nready;
+std::atomic<unsigned> bench_ndone;
+wait_queue bench_wq;
+
+
+// spinlock: uncontended with one CPU, contended with more
+
+spinlock bench_lock;
+
+void spinlock_run(unsigned, unsigned n) {
+    for (unsigned i = 0; i != n; ++i) {
+        auto irqs = bench_lock.lock();
+        bench_lock.unlock(irqs);
+    }
+}
+
+
+// kalloc: allocate and free a page
+
+void kalloc_run(unsigned, unsigned n) {
+    for (unsigned i = 0; i != n; ++i) {
+        kfree(kalloc(PAGESIZE));
+    }
+}
+
+
+// bufcache_hit: look up a resident block (the superblock)
+
+bcref bench_bcref;
+
+int bufcache_setup(unsigned) {
+    if (!sata_disk) {
+        return E_IO;
+    }
+    bench_bcref = bufcache::get().load(0);
+    return bench_bcref ? 0 : E_NOMEM;
+}
+
+void bufcache_run(unsigned, unsigned n) {
+    for (unsigned i = 0; i != n; ++i) {
+        bcref r = bufcache::get().load(0);
+        assert(r);
+    }
+}
+
+void bufcache_teardown() {
+    bench_bcref.reset();
+}
+
+
+// vmiter_map: install mappings in a private page table
+
+x86_64_pagetable* bench_pagetables[MAXCPU * bench_maxslots];
+void* bench_page;
+
+int vmiter_setup(unsigned nworkers) {
+    if (!bench_page && !(bench_page = kalloc(PAGESIZE))) {
+        return E_NOMEM;
+    }
+    for (unsigned w = 0; w != nworkers; ++w) {
+        if (!bench_pagetables[w]
+            && !(bench_pagetables[w] = knew_pagetable())) {
+            return E_NOMEM;
+        }
+    }
+    return 0;
+}
+
+void vmiter_run(unsigned worker, unsigned n) {
+    for (unsigned i = 0; i != n; ++i) {
+        uintptr_t va = 0x100000 + (i % 64) * PAGESIZE;
+        vmiter(bench_pagetables[worker], va).map(bench_page, PTE_PWU);
+    }
+}
+
+
+// wait_queue_wake: two workers ping-pong through a wait queue; one
+// operation is a round trip, or two wakeups
+
+wait_queue bench_pingpong_wq;
+std::atomic<unsigned> bench_ping;
+std::atomic<unsigned> bench_pong;
+
+int wake_setup(unsigned) {
+    bench_ping = bench_pong = 0;
+    return 0;
+}
+
+void wake_run(unsigned worker, unsigned n) {
+    for (unsigned i = 0; i != n; ++i) {
+        if (worker == 0) {
+            unsigned v = ++bench_ping;
+            bench_pingpong_wq.notify_all();
+            waiter().wait_until(bench_pingpong_wq, [&] () {
+                return bench_pong == v;
+            });
+        } else {
+            unsigned v = bench_pong + 1;
+            waiter().wait_until(bench_pingpong_wq, [&] () {
+                return bench_ping == v;
+            });
+            bench_pong = v;
+            bench_pingpong_wq.notify_all();
+        }
+    }
+}
+
+
+// crc32c: checksum a page
+
+unsigned char* bench_data;
+volatile uint32_t bench_crc;
+
+int crc32c_setup(unsigned) {
+    if (!bench_data) {
+        bench_data = reinterpret_cast<unsigned char*>(kalloc(PAGESIZE));
+        if (!bench_data) {
+            return E_NOMEM;
+        }
+        for (size_t i = 0; i != PAGESIZE; ++i) {
+            bench_data[i] = i * 131 + 7;
+        }
+    }
+    return 0;
+}
+
+void crc32c_run(unsigned, unsigned n) {
+    for (unsigned i = 0; i != n; ++i) {
+        bench_crc = crc32c(bench_data, PAGESIZE);
+    }
+}
+
+
+const kbench kbenches[] = {
+    { "spinlock", 64, 0, nullptr, spinlock_run, nullptr },
+    { "kalloc", 16, 0, nullptr, kalloc_run, nullptr },
+    { "bufcache_hit", 16, 0, bufcache_setup, bufcache_run,
+      bufcache_teardown },
+    { "vmiter_map", 64, 0, vmiter_setup, vmiter_run, nullptr },
+    { "wait_queue_wake", 4, 2, wake_setup, wake_run, nullptr },
+    { "crc32c_4k", 1, 0, crc32c_setup, crc32c_run, nullptr }
+};
+
+
+// bench_worker()
+//    Body of the worker tasks. Between runs, workers block on `bench_wq`.
+
+void bench_worker() {
+    sti();
+    proc* p = current();
+    unsigned cpu = 0, slot = 0;
+    while (bench_pool[cpu][slot] != p) {
+        if (++slot == bench_maxslots) {
+            slot = 0;
+            ++cpu;
+        }
+    }
+
+    unsigned seen = 0;
+    while (true) {
+        waiter().wait_until(bench_wq, [&] () {
+            return bench_gen != seen;
+        });
+        seen = bench_gen;
+        unsigned w = slot * bench_nbcpu + cpu;
+        if (cpu >= bench_nbcpu || w >= bench_nworkers) {
+            continue;
+        }
+
+        // start together
+        ++bench_nready;
+        while (bench_nready != bench_nworkers) {
+            p->yield();
+        }
+
+        const kbench* b = bench_current;
+        uint64_t* samples = bench_samples + w * bench_nsamples;
+        b->run(w, b->batch);    // warm up
+        for (unsigned i = 0; i != bench_nsamples; ++i) {
+            uint64_t t0 = rdtsc();
+            b->run(w, b->batch);
+            samples[i] = (rdtsc() - t0) / b->batch;
+        }
+
+        if (++bench_ndone == bench_nworkers) {
+            bench_wq.notify_all();
+        }
+    }
+}
+
+// start_workers()
+//    Create any missing worker tasks for the current run.
+
+int start_workers() {
+    for (unsigned w = 0; w != bench_nworkers; ++w) {
+        unsigned cpu = w % bench_nbcpu, slot = w / bench_nbcpu;
+        if (!bench_pool[cpu][slot]) {
+            proc* p = knew<proc>();
+            if (!p) {
+                return E_NOMEM;
+            }
+            p->init_kernel(bench_worker);
+            bench_pool[cpu][slot] = p;
+            cpus[cpu].enqueue(p);
+        }
+    }
+    return 0;
+}
+
+// sort_samples(x, n)
+//    Shell sort; `n` is at most a few thousand.
+
+void sort_samples(uint64_t* x, size_t n) {
+    for (size_t gap = n / 2; gap > 0; gap /= 2) {
+        for (size_t i = gap; i < n; ++i) {
+            uint64_t v = x[i];
+            size_t j = i;
+            for (; j >= gap && x[j - gap] > v; j -= gap) {
+                x[j] = x[j - gap];
+            }
+            x[j] = v;
+        }
+    }
+}
+
+int run_bench(const kbench& b, unsigned nbcpu) {
+    unsigned nworkers = b.nworkers ? b.nworkers : nbcpu;
+    assert(nworkers <= nbcpu * bench_maxslots);
+    if (!bench_samples) {
+        bench_samples = reinterpret_cast<uint64_t*>(
+            kalloc(MAXCPU * bench_maxslots * bench_nsamples * sizeof(uint64_t))
+        );
+        if (!bench_samples) {
+            return E_NOMEM;
+        }
+    }
+
+    bench_current = &b;
+    bench_nbcpu = nbcpu;
+    bench_nworkers = nworkers;
+    if (int r = start_workers()) {
+        return r;
+    }
+    if (b.setup) {
+        if (int r = b.setup(nworkers)) {
+            return r;
+        }
+    }
+
+    bench_nready = 0;
+    bench_ndone = 0;
+    ++bench_gen;
+    bench_wq.notify_all();
+    waiter().wait_until(bench_wq, [&] () {
+        return bench_ndone == nworkers;
+    });
+
+    if (b.teardown) {
+        b.teardown();
+    }
+
+    size_t n = nworkers * bench_nsamples;
+    sort_samples(bench_samples, n);
+    auto pct = [&] (unsigned p) {
+        return bench_samples[min(n * p / 100, n - 1)];
+    };
+    console_printf("%-16s %4u %8lu %8lu %8lu %8lu %8lu\n", b.name, nbcpu,
+                   pct(0), pct(50), pct(90), pct(99), pct(100));
+    log_format("!B %s %u %lu %lu %lu %lu %lu\n", b.name, nbcpu,
+               pct(0), pct(50), pct(90), pct(99), pct(100));
+    return 0;
+}
+
+}
+
+
+// ktest_bench(index, nbcpu)
+//    Run benchmark number `index` on `nbcpu` CPUs (0 means all) and print
+//    cycles per operation: minimum, median, 90th and 99th percentiles,
+//    and maximum. Returns 0, `E_NOENT` if there is no such benchmark,
+//    `E_INVAL` for a bad CPU count, or `E_AGAIN` if a benchmark is
+//    already running.
+
+int ktest_bench(unsigned index, unsigned nbcpu) {
+    if (index >= arraysize(kbenches)) {
+        return E_NOENT;
+    } else if (nbcpu > unsigned(ncpu)) {
+        return E_INVAL;
+    } else if (bench_busy.test_and_set()) {
+        return E_AGAIN;
+    }
+    sti();
+    int r = run_bench(kbenches[index], nbcpu ? nbcpu : ncpu);
+    bench_busy.clear();
+    return r;
+}
@@ -19,11 +19,83 @@ bufcache::bufcache() {
 //    Returns a null reference if there's no room for the block.
 
 bcref bufcache::load(chkfs::blocknum_t bn, block_clean_function cleaner) {
+    irqstate irqs;
+    bcslot* slot = reference(bn, irqs);
+    if (!slot) {
+        log_printf("bufcache: no room for block %u\n", bn);
+        return nullptr;
+    }
+
+    // load block
+    bool ok = slot->load(irqs, cleaner);
+
+    // unlock
+    if (!ok) {
+        // remove reference since load was unsuccessful
+        if (--slot->ref_ == 0) {
+            slot->clear();
+        }
+    }
+    slot->lock_.unlock(irqs);
+
+    // return reference to slot
+    if (ok) {
+        return bcref(slot);
+    } else {
+        return bcref();
+    }
+}
+
+
+// bufcache::load_async(bn)
+//    Like `load(bn)`, but doesn't wait for the disk: if the block must
+//    be read, starts the read and returns a reference to the slot in
+//    state `s_loading`. `bcslot::load` on that slot waits for the read.
+//    Returns a null reference, without logging, if there's no room.
+
+bcref bufcache::load_async(chkfs::blocknum_t bn) {
+    irqstate irqs;
+    bcslot* slot = reference(bn, irqs);
+    if (!slot) {
+        return nullptr;
+    }
+
+    if (slot->state_ == bcslot::s_allocated && !slot->buf_) {
+        slot->buf_ = reinterpret_cast<unsigned char*>
+            (kalloc(chkfs::blocksize));
+    }
+    if (slot->state_ == bcslot::s_allocated && slot->buf_) {
+        slot->state_ = bcslot::s_loading;
+        slot->lock_.unlock(irqs);
+        sata_disk->start_read(slot->buf_, chkfs::blocksize,
+                              slot->bn_ * chkfs::blocksize,
+                              bcslot::finish_load, slot);
+        return bcref(slot);
+    } else if (slot->state_ == bcslot::s_allocated) {
+        // out of memory
+        if (--slot->ref_ == 0) {
+            slot->clear();
+        }
+        slot->lock_.unlock(irqs);
+        return bcref();
+    } else {
+        slot->lock_.unlock(irqs);
+        return bcref(slot);
+    }
+}
+
+
+// bufcache::reference(bn, irqs)
+//    Find or allocate the slot for block `bn` and add a reference to it.
+//    Returns the slot with its `lock_` locked (and `irqs` set to unlock
+//    it), or nullptr if there's no room.
+
+bcslot* bufcache::reference(chkfs::blocknum_t bn, irqstate& irqs) {
     assert(chkfs::blocksize == PAGESIZE);
-    auto irqs = lock_.lock();
+    irqs = lock_.lock();
 
     // look for slot containing `bn`
-    size_t i, empty_slot = -1;
+    size_t i, empty_slot = -1, evict_slot = -1;
     for (i = 0; i != nslots; ++i) {
         if (slots_[i].empty()) {
             if (empty_slot == size_t(-1)) {
@@ -31,15 +103,31 @@ bcref bufcache::load(chkfs::blocknum_t bn, block_clean_function cleaner) {
             }
         } else if (slots_[i].bn_ == bn) {
             break;
+        } else if (evict_slot == size_t(-1)
+                   && slots_[i].ref_ == 0
+                   && slots_[i].state_ == bcslot::s_clean) {
+            evict_slot = i;
         }
     }
 
+    trace(i == nslots ? tr_bufcache_miss : tr_bufcache_hit, bn);
+    usage_add(i == nslots ? &usage_counters::nbufcache_misses
+              : &usage_counters::nbufcache_hits);
+
     // if not found, use free slot
     if (i == nslots) {
+        if (empty_slot == size_t(-1) && evict_slot != size_t(-1)) {
+            // evict an unreferenced clean block; recheck under its lock
+            auto& victim = slots_[evict_slot];
+            spinlock_guard vguard(victim.lock_);
+            if (victim.ref_ == 0 && victim.state_ == bcslot::s_clean) {
+                victim.clear();
+                empty_slot = evict_slot;
+            }
+        }
         if (empty_slot == size_t(-1)) {
             // cache full!
             lock_.unlock(irqs);
-            log_printf("bufcache: no room for block %u\n", bn);
             return nullptr;
         }
         i = empty_slot;
@@ -60,23 +148,7 @@ bcref bufcache::load(chkfs::blocknum_t bn, block_clean_function cleaner) {
 
     // add reference
     ++slot.ref_;
-
-    // load block
-    bool ok = slot.load(irqs, cleaner);
-
-    // unlock
-    if (!ok) {
-        // remove reference since load was unsuccessful
-        --slot.ref_;
-    }
-    slot.lock_.unlock(irqs);
-
-    // return reference to slot
-    if (ok) {
-        return bcref(&slot);
-    } else {
-        return bcref();
-    }
+    return &slot;
 }
 
 
@@ -110,9 +182,11 @@ bool bcslot::load(irqstate& irqs, block_clean_function cleaner) {
             if (cleaner) {
                 cleaner(this);
             }
-            bc.read_wq_.notify_all();
+            bc.read_wq_.notify_key(reinterpret_cast<uintptr_t>(this));
         } else if (state_ == s_loading) {
-            waiter().wait_until(bc.read_wq_, [&] () {
+            // keyed by slot, so loads of other blocks don't wake us
+            waiter(reinterpret_cast<uintptr_t>(this)).wait_until(
+                bc.read_wq_, [&] () {
                     return state_ != s_loading;
                 }, lock_, irqs);
         } else {
@@ -122,17 +196,34 @@ bool bcslot::load(irqstate& irqs, block_clean_function cleaner) {
 }
 
 
+// bcslot::finish_load(arg, status)
+//    Completion callback for `bufcache::load_async`'s disk read; runs
+//    in the disk interrupt handler. On error, the slot reverts to
+//    `s_allocated`, so the next `bcslot::load` retries the read.
+
+void bcslot::finish_load(void* arg, int status) {
+    auto slot = static_cast<bcslot*>(arg);
+    {
+        spinlock_guard guard(slot->lock_);
+        assert(slot->state_ == s_loading);
+        slot->state_ = status < 0 ? s_allocated : s_clean;
+    }
+    bufcache::get().read_wq_.notify_key(reinterpret_cast<uintptr_t>(slot));
+}
+
+
 // bcslot::decrement_reference_count()
 //    Decrements this buffer cache slot’s reference count.
 //
-//    The handout code *erases* the slot (freeing its buffer) once the
-//    reference count reaches zero. This is bad for performance, and you
-//    will change this behavior in pset 4 part A.
+//    An unreferenced clean block stays cached until `bufcache::load`
+//    evicts it for another block, `sync` drops it, or `reclaim` frees it.
+//    Other unreferenced slots are erased, since nothing writes dirty
+//    blocks back yet.
 
 void bcslot::decrement_reference_count() {
     spinlock_guard guard(lock_);    // needed in case we `clear()`
     assert(ref_ != 0);
-    if (--ref_ == 0) {
+    if (--ref_ == 0 && state_ != s_clean) {
         clear();
     }
 }
@@ -201,6 +292,26 @@ int bufcache::sync(int drop) {
 }
 
 
+// bufcache::reclaim(npages)
+//    Frees the memory of up to `npages` unreferenced clean slots, for use
+//    when memory is scarce. Returns the number of pages freed.
+
+size_t bufcache::reclaim(size_t npages) {
+    size_t nfreed = 0;
+    spinlock_guard guard(lock_);
+    for (size_t i = 0; i != nslots && nfreed < npages; ++i) {
+        spinlock_guard eguard(slots_[i].lock_);
+        if (slots_[i].ref_ == 0
+            && slots_[i].state_ == bcslot::s_clean
+            && slots_[i].buf_) {
+            slots_[i].clear();
+            ++nfreed;
+        }
+    }
+    return nfreed;
+}
+
+
 // inode lock functions
 //    The inode lock protects the inode's size and data references.
 //    It is a read/write lock; multiple readers can hold the lock
@@ -46,6 +46,7 @@ struct bcslot {
     // internal functions
     void clear();
     bool load(irqstate& irqs, block_clean_function cleaner);
+    static void finish_load(void* arg, int status);
 };
 
 using bcref = ref_ptr<bcslot>;
@@ -63,12 +64,16 @@ struct bufcache {
     static inline bufcache& get();
 
     bcref load(blocknum_t bn, block_clean_function cleaner = nullptr);
+    bcref load_async(blocknum_t bn);
 
     int sync(int drop);
+    size_t reclaim(size_t npages);
 
  private:
     static bufcache bc;
 
+    bcslot* reference(blocknum_t bn, irqstate& irqs);
+
     bufcache();
     NO_COPY_OR_ASSIGN(bufcache);
 };
@@ -0,0 +1,182 @@
+#include "kernel.hh"
+
+// k-clock.cc
+//
+//    High-resolution monotonic clock. At boot, CPU 0 measures the TSC
+//    frequency against PIT channel 2; every other CPU then measures the
+//    difference between its TSC and CPU 0's (`cpustate::tsc_offset_`).
+//    `clock_ns()` converts the offset-corrected TSC to nanoseconds since
+//    calibration with a 32.32 fixed-point multiply.
+//
+//    Without an invariant TSC (CPUID 0x80000007 EDX bit 8), the TSC rate
+//    can change with power states, so the clock may drift; we log a
+//    warning but still use it. Offsets are accurate to about half a cache
+//    line round trip, so two CPUs' readings taken very close together can
+//    appear out of order.
+
+uint64_t tsc_hz;
+bool tsc_invariant;
+
+static uint64_t tsc_base;          // CPU 0's TSC at calibration
+static uint64_t tsc_ns_mult;       // nanoseconds per cycle, << 32
+
+
+// calibrate_pit(ms)
+//    Return the number of TSC cycles in `ms` milliseconds of PIT channel 2
+//    countdown, or 0 if the PIT doesn't respond. Interrupts must be off.
+
+static uint64_t calibrate_pit(unsigned ms) {
+    constexpr unsigned pit_hz = 1193182;
+    unsigned count = pit_hz * ms / 1000;
+    assert(count > 0 && count <= 0xFFFF);
+
+    // gate channel 2 on, speaker off; mode 0 (interrupt on terminal
+    // count) raises OUT2 (port 0x61 bit 5) when the count reaches 0
+    uint8_t gate = inb(0x61);
+    outb(0x61, (gate & ~0x02) | 0x01);
+    outb(0x43, 0xB0);               // channel 2, low then high byte, mode 0
+    outb(0x42, count & 0xFF);
+    outb(0x42, count >> 8);
+
+    uint64_t t0 = rdtsc();
+    for (unsigned long spins = 0; !(inb(0x61) & 0x20); ++spins) {
+        if (spins == 100000000) {
+            outb(0x61, gate);
+            return 0;
+        }
+    }
+    uint64_t t1 = rdtsc();
+    outb(0x61, gate);
+    return t1 - t0;
+}
+
+
+// init_clock()
+//    Calibrate the TSC. Called by CPU 0 from `init_hardware`, before other
+//    CPUs start.
+
+void init_clock() {
+    tsc_invariant = cpuid(0x80000000).eax >= 0x80000007
+        && (cpuid(0x80000007).edx & (1U << 8));
+
+    // take the median of three 10ms measurements
+    constexpr unsigned ms = 10;
+    uint64_t a = calibrate_pit(ms), b = calibrate_pit(ms),
+        c = calibrate_pit(ms);
+    tsc_hz = max(min(a, b), min(max(a, b), c)) * (1000 / ms);
+
+    if (tsc_hz == 0 && cpuid(0).eax >= 0x16) {
+        // no PIT; fall back on the processor base frequency
+        tsc_hz = uint64_t(cpuid(0x16).eax & 0xFFFF) * 1000000;
+    }
+    if (tsc_hz == 0) {
+        log_printf("clock: cannot calibrate TSC, assuming 1 GHz\n");
+        tsc_hz = 1000000000;
+    }
+
+    tsc_ns_mult = (uint64_t(1000000000) << 32) / tsc_hz;
+    tsc_base = rdtsc();
+    log_printf("clock: TSC %lu Hz%s\n", tsc_hz,
+               tsc_invariant ? "" : " (not invariant; may drift)");
+}
+
+
+// CPU 0 and the CPU being synchronized exchange these; CPU 0 bumps
+// `sync_req` to ask for a TSC reading, the other CPU answers in
+// `sync_tsc` and `sync_ack`
+static constexpr unsigned sync_rounds = 64;
+static constexpr unsigned sync_done = -1U;
+static std::atomic<int> sync_cpu = -1;
+static std::atomic<unsigned> sync_req;
+static std::atomic<unsigned> sync_ack;
+static std::atomic<uint64_t> sync_tsc;
+
+// clock_sync_others()
+//    Measure the TSC offset of every other CPU. Called by CPU 0 once all
+//    CPUs have started; each other CPU must call `clock_sync_ap()`.
+
+void clock_sync_others() {
+    for (int i = 1; i < ncpu; ++i) {
+        sync_req = sync_ack = 0;
+        sync_cpu.store(i, std::memory_order_release);
+
+        // keep the measurement with the shortest round trip; assume the
+        // other CPU read its TSC halfway through
+        uint64_t best_rtt = -1;
+        int64_t best_offset = 0;
+        for (unsigned r = 1; r <= sync_rounds; ++r) {
+            uint64_t t0 = rdtsc();
+            sync_req.store(r, std::memory_order_release);
+            while (sync_ack.load(std::memory_order_acquire) != r) {
+                pause();
+            }
+            uint64_t t1 = rdtsc();
+            if (t1 - t0 < best_rtt) {
+                best_rtt = t1 - t0;
+                best_offset = t0 + (t1 - t0) / 2 - sync_tsc.load();
+            }
+        }
+
+        cpus[i].tsc_offset_ = best_offset;
+        sync_req.store(sync_done, std::memory_order_release);
+        while (sync_ack.load(std::memory_order_acquire) != sync_done) {
+            pause();
+        }
+        log_printf("CPU %d: TSC offset %ld (round trip %lu)\n",
+                   i, best_offset, best_rtt);
+    }
+    sync_cpu = -1;
+}
+
+// clock_sync_ap()
+//    Answer CPU 0's TSC readings until this CPU's offset is known. Called
+//    by each other CPU, with interrupts disabled, before it schedules.
+
+void clock_sync_ap() {
+    int me = this_cpu()->cpuindex_;
+    while (sync_cpu.load(std::memory_order_acquire) != me) {
+        pause();
+    }
+    unsigned seen = 0, r;
+    while (true) {
+        while ((r = sync_req.load(std::memory_order_acquire)) == seen) {
+            pause();
+        }
+        if (r != sync_done) {
+            sync_tsc.store(rdtsc(), std::memory_order_relaxed);
+        }
+        sync_ack.store(r, std::memory_order_release);
+        if (r == sync_done) {
+            return;
+        }
+        seen = r;
+    }
+}
+
+
+// clock_ns()
+//    Return nanoseconds since TSC calibration on CPU 0's time base. Kernel
+//    tasks don't migrate between CPUs, so the TSC and offset are read on
+//    the same CPU.
+
+uint64_t clock_ns() {
+    uint64_t cycles = rdtsc() + this_cpu()->tsc_offset_ - tsc_base;
+    return (static_cast<unsigned __int128>(cycles) * tsc_ns_mult) >> 32;
+}
+
+
+// proc::syscall_clock_gettime(regs)
+//    Handle `sys_clock_gettime(clockid, ts)`.
+
+uintptr_t proc::syscall_clock_gettime(regstate* regs) {
+    int clockid = regs->reg_rdi;
+    uintptr_t addr = regs->reg_rsi;
+    if (clockid != CLOCK_MONOTONIC) {
+        return E_INVAL;
+    }
+    uint64_t ns = clock_ns();
+    timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return copy_to_user(addr, &ts, sizeof(ts));
+}
@@ -30,6 +30,11 @@ void cpustate::init() {
     cpuindex_ = this - cpus;
     runq_lock_.clear();
     idle_task_ = nullptr;
+    resched_pending_ = false;
+    timer_mult_ = 1;
+    timer_subtick_ = 0;
+    usage_ = usage_counters();
+    tsc_offset_ = 0;
     nschedule_ = 0;
     spinlock_depth_ = 0;
 
@@ -73,6 +78,10 @@ void cpustate::schedule() {
 
     // increment schedule counter
     ++nschedule_;
+    pid_t prev_id = current_ ? current_->id_ : 0;
+    // an exited thread may be freed below
+    proc* prev_live = current_ && current_->pstate_ != proc::ps_exited
+        ? current_ : nullptr;
 
     // find a runnable process (preferring one different from `current_`)
     bool first_try = true;
@@ -95,16 +104,73 @@ void cpustate::schedule() {
 
         // run idle task as last resort
         current_ = runq_.empty() ? idle_task_ : runq_.pop_front();
+        // any pending reschedule request is satisfied now
+        resched_pending_.store(false, std::memory_order_relaxed);
 
         runq_lock_.unlock_noirq();
+
+        // free an exited thread now that we're off its stack
+        if (prev
+            && prev->pstate_ == proc::ps_exited
+            && prev->leader_ != prev) {
+            kfree(prev);
+        }
     }
 
     // run `current_`
-    set_pagetable(current_->pagetable_);
+    account_switch(prev_live, current_);
+    trace(tr_schedule, prev_id);
+    if (!pagetable_active(current_->pagetable_)) {
+        set_pagetable(current_->pagetable_);
+    }
+    current_->refresh_procdata(cpuindex_);
     current_->resume(); // does not return
 }
 
 
+// cpustate::switch_to(prev, next)
+//    Directed context switch, called by `proc::yield_to` on `prev`'s
+//    stack after `prev`'s yieldstate is saved. If `next` is waiting on
+//    this CPU's run queue, run it now, ahead of other tasks, without
+//    passing through the CPU stack or reloading `%cr3` when `next` shares
+//    `prev`'s page table. Otherwise fall back to `schedule`.
+//
+//    Running on `prev`'s stack is safe because only this CPU resumes
+//    `prev`, and interrupts stay disabled until `next` resumes.
+
+void cpustate::switch_to(proc* prev, proc* next) {
+    assert(current_ == prev && prev->yields_);
+    assert(is_cli());
+    assert(spinlock_depth_ == 0);
+    assert(prev->pstate_ != proc::ps_exited);
+
+    runq_lock_.lock_noirq();
+    if (next->runq_cpu_ != cpuindex_
+        || !next->runq_links_.is_linked()
+        || next->pstate_ != proc::ps_runnable) {
+        runq_lock_.unlock_noirq();
+        prev->yield_noreturn();
+    }
+    ++nschedule_;
+    runq_.erase(next);
+    if (prev->pstate_ == proc::ps_runnable
+        && !prev->runq_links_.is_linked()) {
+        runq_.push_back(prev);
+    }
+    current_ = next;
+    resched_pending_.store(false, std::memory_order_relaxed);
+    runq_lock_.unlock_noirq();
+
+    account_switch(prev, next);
+    trace(tr_schedule, prev->id_);
+    if (!pagetable_active(next->pagetable_)) {
+        set_pagetable(next->pagetable_);
+    }
+    next->refresh_procdata(cpuindex_);
+    next->resume(); // does not return
+}
+
+
 // cpustate::enqueue(p)
 //    Claim new task `p` for this CPU and enqueue it on this CPU's run queue.
 //    Acquires `runq_lock_`. `p` must belong to any CPU, and must be resumable
@@ -117,6 +183,7 @@ void cpustate::enqueue(proc* p) {
     spinlock_guard guard(runq_lock_);
     p->runq_cpu_ = cpuindex_;
     runq_.push_back(p);
+    kick();
 }
 
 
@@ -132,19 +199,48 @@ void cpustate::reenqueue(proc* p) {
     if (current_ != p && !p->runq_links_.is_linked()) {
         assert(p->resumable() || p->pstate_ != proc::ps_runnable);
         runq_.push_back(p);
+        kick();
     }
 }
 
 
+// cpustate::kick()
+//    Called with `runq_lock_` held after adding a task to this CPU's run
+//    queue. If this CPU is idle, make it run the task now rather than at
+//    its next timer interrupt, up to 1/HZ sec later: another CPU sends an
+//    `IRQ_RESCHEDULE` interrupt, and an interrupt handler on this CPU
+//    (e.g., a disk completion) leaves a flag that `proc::exception` checks
+//    on the way out. `current_` changes only under `runq_lock_`, so the
+//    idle check is reliable. There is no priority scheduling, so busy CPUs
+//    aren't interrupted.
+
+void cpustate::kick() {
+    assert(runq_lock_.is_locked());
+    if (!current_ || current_ != idle_task_) {
+        return;
+    }
+    bool was_pending = resched_pending_.exchange(true);
+    if (this != this_cpu() && !was_pending) {
+        lapicstate::get().ipi(lapic_id_, INT_IRQ + IRQ_RESCHEDULE);
+    }
+}
+
+
+
 // cpustate::idle_task
 //    Every CPU has an *idle task*, which is a kernel task (i.e., a
 //    `proc` that runs in kernel mode) that just stops the processor
 //    until an interrupt is received. The idle task runs when a CPU
-//    has nothing better to do.
+//    has nothing better to do. Before stopping, it refills the pool of
+//    pre-zeroed pages, so allocations don't pay for zeroing, and drains
+//    the trace buffers.
 
 void idle() {
     sti();
     while (true) {
+        while (kalloc_refill_zero_pool()) {
+        }
+        trace_drain();
         asm volatile("hlt");
     }
 }
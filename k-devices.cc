@@ -202,6 +202,20 @@ void keyboardstate::consume(size_t n) {
     eol_ -= n;
 }
 
+size_t keyboardstate::inject(const char* s, size_t n) {
+    auto irqs = lock_.lock();
+    size_t i = 0;
+    for (; i != n && len_ < sizeof(buf_); ++i) {
+        buf_[(pos_ + len_) % sizeof(buf_)] = s[i];
+        ++len_;
+        if (s[i] == '\n' || s[i] == 0x04) {
+            eol_ = len_;
+        }
+    }
+    lock_.unlock(irqs);
+    return i;
+}
+
 
 consolestate consolestate::console;
 
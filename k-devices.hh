@@ -40,6 +40,10 @@ struct keyboardstate {
     // consume `n` characters from buffer (0 <= n <= len_)
     void consume(size_t n);
 
+    // append `n` characters to buffer as if typed, without echo; returns
+    // the number appended (used by `KTEST_KEYBOARD`)
+    size_t inject(const char* s, size_t n);
+
  private:
     static keyboardstate kbd;
     keyboardstate() = default;
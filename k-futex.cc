@@ -0,0 +1,192 @@
+#include "kernel.hh"
+#include "k-vmiter.hh"
+#include "k-wait.hh"
+
+// k-futex.cc
+//
+//    Futexes: user-level wait and wake on a 32-bit word. Waiters are keyed
+//    by the word's physical address and hashed into a fixed set of wait
+//    queues. A bucket may hold waiters for several words, so wakeups
+//    check each waiter's key.
+
+
+namespace {
+
+constexpr unsigned futex_nbuckets = 64;
+wait_queue futex_buckets[futex_nbuckets];
+
+inline wait_queue& futex_bucket(uintptr_t pa) {
+    return futex_buckets[(pa * 0x9E3779B97F4A7C15UL)
+                         >> (64 - msb(futex_nbuckets - 1))];
+}
+
+}
+
+
+// futex_has_waiters(pa)
+//    See kernel.hh.
+
+bool futex_has_waiters(uintptr_t pa) {
+    pa = round_down(pa, PAGESIZE);
+    for (auto& wq : futex_buckets) {
+        spinlock_guard guard(wq.lock_);
+        for (waiter* w = wq.q_.front(); w; w = wq.q_.next(w)) {
+            if (round_down(w->key_, PAGESIZE) == pa) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+// futex_wait(p, uaddr, pa, val, next)
+//    Block `p` until a wakeup on `pa`, unless the word there no longer
+//    equals `val`. Returns 0 after a wakeup, `E_AGAIN` if the value
+//    differed, or 1 if `uaddr` no longer maps to `pa` (the caller should
+//    retry). If `next` is nonnull, block by switching directly to `next`.
+
+static int futex_wait(proc* p, uintptr_t uaddr, uintptr_t pa, uint32_t val,
+                      proc* next = nullptr) {
+    auto& wq = futex_bucket(pa);
+    waiter w(pa);
+    w.prepare(wq);
+    // The waiter is visible to wakers, so a change to the word after this
+    // load will wake us. Swap-out checks for waiters after unmapping, so
+    // if the page is still mapped at `pa`, it will stay resident.
+    int r = 0;
+    if (vmiter(p, uaddr).pa() != pa) {
+        r = 1;
+    } else if (pa2kptr<std::atomic<uint32_t>*>(pa)->load() != val) {
+        r = E_AGAIN;
+    }
+    if (r == 0) {
+        if (next && p->pstate_ == proc::ps_blocked) {
+            p->yield_to(next);
+        }
+        w.maybe_block();
+    } else {
+        w.clear();
+    }
+    return r;
+}
+
+
+// futex_wake(pa, n, first)
+//    Wake up to `n` waiters on `pa`, oldest first. Returns the number
+//    woken. If `first` is nonnull, sets `*first` to the first task woken,
+//    or nullptr if there was none.
+
+static unsigned futex_wake(uintptr_t pa, unsigned n, proc** first = nullptr) {
+    auto& wq = futex_bucket(pa);
+    unsigned nwoken = 0;
+    if (first) {
+        *first = nullptr;
+    }
+    spinlock_guard guard(wq.lock_);
+    waiter* w = wq.q_.front();
+    while (w && nwoken != n) {
+        waiter* next = wq.q_.next(w);
+        if (w->key_ == pa) {
+            wq.q_.erase(w);
+            if (first && nwoken == 0) {
+                *first = w->p_;
+            }
+            w->notify();
+            ++nwoken;
+        }
+        w = next;
+    }
+    return nwoken;
+}
+
+
+// futex_swap(p, uaddr, val, wake_uaddr)
+//    Handle `FUTEX_SWAP`: wake one waiter on `wake_uaddr`, then wait on
+//    `uaddr`. If the woken task runs on this CPU, hand it the CPU
+//    directly. Interrupts stay disabled from the wakeup to the switch, so
+//    the woken task cannot run (and perhaps exit) in between; nothing in
+//    that window may block. So both words are faulted in first, and
+//    rechecked without blocking once interrupts are off.
+
+static int futex_swap(proc* p, uintptr_t uaddr, uint32_t val,
+                      uintptr_t wake_uaddr) {
+    uintptr_t pa, wake_pa;
+    while (true) {
+        if (!user_range_ok(wake_uaddr, sizeof(uint32_t), PTE_P | PTE_U)
+            || !user_range_ok(uaddr, sizeof(uint32_t), PTE_P | PTE_U)) {
+            return E_FAULT;
+        }
+        cli();
+        // `cli` doesn't stop other CPUs' swap-out, so look up each
+        // address once and use only what was looked up
+        wake_pa = vmiter(p, wake_uaddr).pa();
+        pa = vmiter(p, uaddr).pa();
+        if (wake_pa != uintptr_t(-1) && pa != uintptr_t(-1)) {
+            break;
+        }
+        // swapped out again since the check
+        sti();
+    }
+
+    proc* next;
+    futex_wake(wake_pa, 1, &next);
+    if (next && next->runq_cpu_ != this_cpu()->cpuindex_) {
+        next = nullptr;
+    }
+    int r = futex_wait(p, uaddr, pa, val, next);
+    sti();
+
+    // `uaddr` was remapped or swapped out under us (rare); `next` is
+    // running on its own by now, so wait the ordinary way
+    while (r > 0) {
+        if (!user_range_ok(uaddr, sizeof(uint32_t), PTE_P | PTE_U)) {
+            return E_FAULT;
+        }
+        pa = vmiter(p, uaddr).pa();
+        if (pa != uintptr_t(-1)) {
+            r = futex_wait(p, uaddr, pa, val);
+        }
+    }
+    return r;
+}
+
+
+// proc::syscall_futex(regs)
+//    Handle `sys_futex(uaddr, op, val[, wake_uaddr])`.
+
+uintptr_t proc::syscall_futex(regstate* regs) {
+    uintptr_t uaddr = regs->reg_rdi;
+    int op = regs->reg_rsi;
+    uint32_t val = regs->reg_rdx;
+    if (uaddr & 3) {
+        return E_INVAL;
+    } else if (op == FUTEX_SWAP) {
+        if (regs->reg_r10 & 3) {
+            return E_INVAL;
+        }
+        return futex_swap(this, uaddr, val, regs->reg_r10);
+    } else if (op != FUTEX_WAIT && op != FUTEX_WAKE) {
+        return E_NOSYS;
+    }
+
+    // This is a slow system call, so allow interrupts by default
+    sti();
+
+    while (true) {
+        if (!user_range_ok(uaddr, sizeof(uint32_t), PTE_P | PTE_U)) {
+            return E_FAULT;
+        }
+        uintptr_t pa = vmiter(this, uaddr).pa();
+        if (pa == uintptr_t(-1)) {
+            // swapped out again since the check; read it back in
+            continue;
+        } else if (op == FUTEX_WAKE) {
+            return futex_wake(pa, val);
+        }
+        int r = futex_wait(this, uaddr, pa, val);
+        if (r <= 0) {
+            return r;
+        }
+    }
+}
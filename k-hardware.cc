@@ -2,6 +2,7 @@
 #include "k-apic.hh"
 #include "k-devices.hh"
 #include "k-pci.hh"
+#include "k-swap.hh"
 #include "k-vmiter.hh"
 #include "elf.h"
 
@@ -15,13 +16,13 @@ pcistate pcistate::state;
 
 // knew_pagetable
 //    Allocate, initialize, and return a new, empty page table. Memory is
-//    allocated using `knew`. The page table's high memory is copied
-//    from `early_pagetable`.
+//    allocated zeroed using `kalloc`. The page table's high memory is
+//    copied from `early_pagetable`.
 
 x86_64_pagetable* knew_pagetable() {
-    x86_64_pagetable* pt = knew<x86_64_pagetable>();
+    auto pt = reinterpret_cast<x86_64_pagetable*>
+        (kalloc(sizeof(x86_64_pagetable), KALLOC_ZERO));
     if (pt) {
-        memset(&pt->entry[0], 0, sizeof(x86_64_pageentry_t) * 256);
         memcpy(&pt->entry[256], &early_pagetable->entry[256],
                sizeof(x86_64_pageentry_t) * 256);
     }
@@ -32,7 +33,8 @@ x86_64_pagetable* knew_pagetable() {
 // set_pagetable(pagetable)
 //    Change page table using wrcr3(), a hardware instruction. set_pagetable()
 //    additionally checks that important kernel procedures are mapped in the
-//    new page table, and calls panic() if they aren't.
+//    new page table, and calls panic() if they aren't. With PCIDs, switching
+//    to a recently-used page table keeps its TLB entries (see k-tlb.cc).
 
 void set_pagetable(x86_64_pagetable* pagetable) {
     assert(pagetable != nullptr);          // must not be nullptr
@@ -43,7 +45,10 @@ void set_pagetable(x86_64_pagetable* pagetable) {
     assert(vmiter(pagetable, KTEXT_BASE).writable());
     assert(!vmiter(pagetable, KTEXT_BASE).user());
     auto pa = is_ktext(pagetable) ? ktext2pa(pagetable) : ka2pa(pagetable);
-    wrcr3(pa);
+    auto irqs = irqstate::get();
+    cli();
+    this_cpu()->load_pagetable(pagetable, pa);
+    irqs.restore();
 }
 
 
@@ -80,6 +85,7 @@ void pcistate::enable(int addr) {
 //    that speaks ACPI.
 
 void poweroff() {
+    log_flush();
     auto& pci = pcistate::get();
     int addr = pci.find([&] (int a) {
             uint32_t vd = pci.readl(a + pci.config_vendor);
@@ -103,6 +109,7 @@ void poweroff() {
 //    Reboot the virtual machine.
 
 void reboot() {
+    log_flush();
     outb(0x92, 3); // does not return
     while (true) {
     }
@@ -143,78 +150,7 @@ void process_halt() {
 }
 
 
-// log_printf, log_vprintf
-//    Print debugging messages to the host's `log.txt` file. We run QEMU
-//    so that messages written to the QEMU "parallel port" end up in `log.txt`.
-
-#define IO_PARALLEL1_DATA       0x378
-#define IO_PARALLEL1_STATUS     0x379
-# define IO_PARALLEL_STATUS_BUSY        0x80
-#define IO_PARALLEL1_CONTROL    0x37A
-# define IO_PARALLEL_CONTROL_SELECT     0x08
-# define IO_PARALLEL_CONTROL_INIT       0x04
-# define IO_PARALLEL_CONTROL_STROBE     0x01
-
-static void delay() {
-    (void) inb(0x84);
-    (void) inb(0x84);
-    (void) inb(0x84);
-    (void) inb(0x84);
-}
-
-static void parallel_port_putc(unsigned char c) {
-    static int initialized;
-    if (!initialized) {
-        outb(IO_PARALLEL1_CONTROL, 0);
-        initialized = 1;
-    }
-
-    for (int i = 0;
-         i < 12800 && (inb(IO_PARALLEL1_STATUS) & IO_PARALLEL_STATUS_BUSY) == 0;
-         ++i) {
-        delay();
-    }
-    outb(IO_PARALLEL1_DATA, c);
-    outb(IO_PARALLEL1_CONTROL, IO_PARALLEL_CONTROL_SELECT
-         | IO_PARALLEL_CONTROL_INIT | IO_PARALLEL_CONTROL_STROBE);
-    outb(IO_PARALLEL1_CONTROL, IO_PARALLEL_CONTROL_SELECT
-         | IO_PARALLEL_CONTROL_INIT);
-}
-
 namespace {
-static std::atomic_flag log_printer_lock;
-static std::atomic<cpustate*> log_printer_lock_owner;
-
-struct log_printer : public printer {
-    bool has_lock_ = false;
-    ansi_escape_buffer ebuf_;
-    log_printer() {
-        if (log_printer_lock_owner.load() == this_cpu()) {
-            return;
-        }
-        size_t tries = 0;
-        while (log_printer_lock.test_and_set()) {
-            pause();
-            if (++tries == (1UL << 20)) {
-                return;
-            }
-        }
-        has_lock_ = true;
-        log_printer_lock_owner = this_cpu();
-    }
-    ~log_printer() {
-        if (has_lock_) {
-            log_printer_lock_owner = nullptr;
-            log_printer_lock.clear();
-        }
-    }
-    void putc(unsigned char c) override {
-        if (!ebuf_.putc(c, *this)) {
-            parallel_port_putc(c);
-        }
-    }
-};
-
 struct error_printer : public console_printer {
     log_printer logpr_;
     error_printer(int cpos, bool scroll)
@@ -228,18 +164,6 @@ struct error_printer : public console_printer {
 };
 }
 
-void log_vprintf(const char* format, va_list val) {
-    log_printer pr;
-    pr.vprintf(format, val);
-}
-
-void log_printf(const char* format, ...) {
-    va_list val;
-    va_start(val, format);
-    log_vprintf(format, val);
-    va_end(val);
-}
-
 
 // symtab: reference to kernel symbol table; useful for debugging.
 // The `mkchickadeesymtab` program fills this structure in.
@@ -417,6 +341,26 @@ bool backtracer::check() {
 }
 }
 
+unsigned backtrace_pcs(const regstate& regs, x86_64_pagetable* pt,
+                       uintptr_t* pcs, unsigned max) {
+    if (max == 0) {
+        return 0;
+    }
+    bool user = regs.reg_rip <= VA_LOWMAX;
+    unsigned n = 0;
+    pcs[n++] = regs.reg_rip;
+    // user stacks can span many pages
+    uintptr_t stack_top = user ? VA_LOWEND : round_up(regs.reg_rsp, PAGESIZE);
+    for (backtracer bt(regs, stack_top, pt); bt.ok() && n != max; bt.step()) {
+        uintptr_t ret_rip = bt.ret_rip();
+        if (ret_rip == 0 || (ret_rip <= VA_LOWMAX) != user) {
+            break;
+        }
+        pcs[n++] = ret_rip;
+    }
+    return n;
+}
+
 __always_inline const regstate& backtrace_current_regs() {
     // static so we don't use stack space; stack might be full
     static regstate backtrace_kernel_regs;
@@ -447,6 +391,7 @@ void error_vprintf(int cpos, const char* format, va_list val) {
 //    Loop until user presses Control-C, then poweroff.
 
 [[noreturn]] void fail() {
+    log_flush();
     auto& kbd = keyboardstate::get();
     kbd.state_ = kbd.fail;
     while (true) {
@@ -455,20 +400,100 @@ void error_vprintf(int cpos, const char* format, va_list val) {
 }
 
 
-// strlcpy_from_user(buf, it, maxlen)
-//    Copy a C string from `it` into `buf`. Copies at most `maxlen-1`
-//    characters, then null-terminates the string. Stops at first
-//    absent or non-user-accessible byte.
+// user_page_ok(p, va, perm)
+//    Return true iff the page containing `va` in `p` has permissions
+//    `perm`, reading it back in from swap if necessary.
+
+static bool user_page_ok(proc* p, uintptr_t va, uint64_t perm) {
+    if (va > VA_LOWMAX) {
+        return false;
+    }
+    while (!vmiter(p, va).perm(perm)) {
+        if (vmiter(p, va).present()
+            || swapstate::get().swap_in(p, va) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool user_range_ok(uintptr_t uva, size_t sz, uint64_t perm) {
+    if (sz == 0) {
+        return true;
+    } else if (uva + sz < uva || uva + sz - 1 > VA_LOWMAX) {
+        return false;
+    }
+    proc* p = current();
+    for (uintptr_t va = round_down(uva, PAGESIZE); va < uva + sz;
+         va += PAGESIZE) {
+        if (!user_page_ok(p, va, perm)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// copy_from_user(dst, uva, sz), copy_to_user(uva, src, sz)
+//    Once a page is checked, the copy runs through the user mapping at
+//    full speed. If the page is swapped out again mid-copy, the kernel
+//    page fault handler reads it back in.
 
-void strlcpy_from_user(char* buf, vmiter it, size_t maxlen) {
-    size_t i = 0;
-    while (i + 1 < maxlen && it.user()) {
-        buf[i] = *it.kptr<const char*>();
-        ++i, ++it;
+int copy_from_user(void* dst, uintptr_t uva, size_t sz) {
+    proc* p = current();
+    auto d = reinterpret_cast<unsigned char*>(dst);
+    while (sz != 0) {
+        size_t n = min(sz, PAGESIZE - (uva & PAGEOFFMASK));
+        if (!user_page_ok(p, uva, PTE_P | PTE_U)) {
+            return E_FAULT;
+        }
+        memcpy(d, reinterpret_cast<const void*>(uva), n);
+        d += n, uva += n, sz -= n;
     }
-    if (i < maxlen) {
-        buf[i] = '\0';
+    return 0;
+}
+
+int copy_to_user(uintptr_t uva, const void* src, size_t sz) {
+    proc* p = current();
+    auto s = reinterpret_cast<const unsigned char*>(src);
+    while (sz != 0) {
+        size_t n = min(sz, PAGESIZE - (uva & PAGEOFFMASK));
+        if (!user_page_ok(p, uva, PTE_PWU)) {
+            return E_FAULT;
+        }
+        memcpy(reinterpret_cast<void*>(uva), s, n);
+        s += n, uva += n, sz -= n;
     }
+    return 0;
+}
+
+
+// strncpy_from_user(dst, uva, maxlen)
+//    Scans and copies a page at a time.
+
+ssize_t strncpy_from_user(char* dst, uintptr_t uva, size_t maxlen) {
+    proc* p = current();
+    size_t len = 0;
+    while (len != maxlen) {
+        if (!user_page_ok(p, uva, PTE_P | PTE_U)) {
+            return E_FAULT;
+        }
+        size_t n = min(maxlen - len, PAGESIZE - (uva & PAGEOFFMASK));
+        auto s = reinterpret_cast<const char*>(uva);
+        size_t slen = strnlen(s, n);
+        memcpy(dst + len, s, slen);
+        len += slen;
+        if (slen < n) {
+            dst[len] = '\0';
+            return len;
+        }
+        uva += n;
+    }
+    if (maxlen != 0) {
+        dst[maxlen - 1] = '\0';
+    }
+    return E_NAMETOOLONG;
 }
 
 
@@ -567,14 +592,17 @@ void assert_fail(const char* file, int line, const char* msg,
     if (consoletype != CONSOLE_NORMAL) {
         cursorpos = CPOS(23, 0);
     }
-    error_printer pr(-1, true);
-    if (description) {
-        pr.printf("%s:%d: %s\n", file, line, description);
+    {
+        // destroy `pr` to publish the log message
+        error_printer pr(-1, true);
+        if (description) {
+            pr.printf("%s:%d: %s\n", file, line, description);
+        }
+        pr.printf("%s:%d: kernel assertion '%s' failed\n", file, line, msg);
+        print_backtrace(pr, backtrace_current_regs(),
+                        backtrace_current_pagetable(), true);
+        pr.move_cursor();
     }
-    pr.printf("%s:%d: kernel assertion '%s' failed\n", file, line, msg);
-    print_backtrace(pr, backtrace_current_regs(),
-                    backtrace_current_pagetable(), true);
-    pr.move_cursor();
     fail();
 }
 
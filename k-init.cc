@@ -36,6 +36,9 @@ void init_hardware() {
     ncpu = 1;
     cpus[0].init();
 
+    // calibrate the TSC clock
+    init_clock();
+
     // initialize the `physical_ranges` object that tracks
     // kernel and reserved physical memory
     init_physical_ranges();
@@ -43,6 +46,9 @@ void init_hardware() {
     // initialize kernel allocator
     init_kalloc();
 
+    // start the task that writes the kernel log
+    init_log();
+
     // initialize other CPUs
     init_other_processors();
 
@@ -198,11 +204,84 @@ void init_constructors() {
 }
 
 
-memrangeset<16> physical_ranges(0x100000000UL);
+memrangeset<64> physical_ranges(MEMSIZE_PHYSICAL_MAX);
+uintptr_t memsize_physical;
+
+// physical address of the multiboot information structure, set by
+// `kernel_entry` if a multiboot loader (such as QEMU `-kernel`) booted us
+extern "C" { uint32_t multiboot_info_pa; }
+
+struct __attribute__((packed)) multiboot_mmap_entry {
+    uint32_t size;                    // size of rest of entry
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;                    // 1 means available RAM
+};
+
+// add_available_memory(first, last)
+//    Mark the RAM in [`first`, `last`) as available. Memory the direct map
+//    cannot reach is ignored.
+static void add_available_memory(uintptr_t first, uintptr_t last) {
+    first = round_up(first, PAGESIZE);
+    last = round_down(min(last, MEMSIZE_PHYSICAL_MAX), PAGESIZE);
+    if (first < last) {
+        bool ok = physical_ranges.set(first, last, mem_available);
+        assert(ok);
+        memsize_physical = max(memsize_physical, last);
+    }
+}
+
+static unsigned cmos_read(int reg) {
+    outb(0x70, reg);
+    return inb(0x71);
+}
+
+// init_available_memory
+//    Discover installed RAM. A multiboot loader passes along the firmware's
+//    (E820) memory map; otherwise we use the memory sizes the BIOS records
+//    in CMOS. Falls back to 2MiB if neither source is available.
+static void init_available_memory() {
+    auto mbi = multiboot_info_pa
+        ? pa2kptr<const uint32_t*>(multiboot_info_pa) : nullptr;
+    if (mbi && (mbi[0] & (1U << 6))) {
+        // `mmap_length` and `mmap_addr` are at byte offsets 44 and 48
+        uintptr_t pa = mbi[12], end_pa = pa + mbi[11];
+        while (pa + sizeof(multiboot_mmap_entry) <= end_pa) {
+            auto e = pa2kptr<const multiboot_mmap_entry*>(pa);
+            if (e->type == 1) {
+                add_available_memory(e->addr, e->addr + e->len);
+            }
+            pa += e->size + sizeof(e->size);
+        }
+    } else if (mbi && (mbi[0] & 1)) {
+        // `mem_lower` and `mem_upper` are in KiB
+        add_available_memory(0, mbi[1] * 1024UL);
+        add_available_memory(0x100000, 0x100000 + mbi[2] * 1024UL);
+    } else {
+        // CMOS: base memory in KiB; memory between 1MiB and 16MiB in KiB;
+        // memory above 16MiB and above 4GiB in 64KiB units
+        uintptr_t base = (cmos_read(0x15) | (cmos_read(0x16) << 8)) * 1024UL;
+        uintptr_t ext = (cmos_read(0x30) | (cmos_read(0x31) << 8)) * 1024UL;
+        uintptr_t above16m = (cmos_read(0x34) | (cmos_read(0x35) << 8))
+            * 0x10000UL;
+        uintptr_t above4g = (cmos_read(0x5B) | (cmos_read(0x5C) << 8)
+                             | (cmos_read(0x5D) << 16)) * 0x10000UL;
+        add_available_memory(0, min(base, PA_IOLOWMIN));
+        if (above16m) {
+            add_available_memory(0x100000, 0x1000000 + above16m);
+        } else {
+            add_available_memory(0x100000, 0x100000 + ext);
+        }
+        add_available_memory(0x100000000UL, 0x100000000UL + above4g);
+    }
+    if (memsize_physical < 0x200000) {
+        add_available_memory(0, 0x200000);
+    }
+}
 
 void init_physical_ranges() {
-    // [0, MEMSIZE_PHYSICAL) starts out available
-    physical_ranges.set(0, MEMSIZE_PHYSICAL, mem_available);
+    // installed RAM starts out available
+    init_available_memory();
     // 0 page is reserved (because nullptr)
     physical_ranges.set(0, PAGESIZE, mem_reserved);
     // I/O memory is reserved (except the console is `mem_console`)
@@ -283,6 +362,9 @@ void cpustate::init_cpu_hardware() {
     cr0 |= CR0_PE | CR0_PG | CR0_WP | CR0_AM | CR0_MP | CR0_NE;
     wrcr0(cr0);
 
+    // enable PCIDs, if available
+    init_tlb();
+
 
     // set up syscall/sysret
     wrmsr(MSR_IA32_KERNEL_GS_BASE, 0);
@@ -335,6 +417,7 @@ extern bool ap_init_allowed;
 void cpustate::init_ap() {
     init();
     ap_entry_lock.unlock_noirq();
+    clock_sync_ap();
     schedule();
 }
 
@@ -376,4 +459,7 @@ void init_other_processors() {
     for (int i = 0; i < ncpu; ++i) {
         log_printf("CPU %d: LAPIC ID %d\n", i, cpus[i].lapic_id_);
     }
+
+    // measure the other CPUs' TSC offsets; they wait in `init_ap`
+    clock_sync_others();
 }
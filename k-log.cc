@@ -0,0 +1,366 @@
+#include "kernel.hh"
+#include "k-wait.hh"
+
+// k-log.cc
+//
+//    Kernel log. `log_printf` formats each message into the calling CPU's
+//    ring buffer, with interrupts disabled, and returns; it never waits
+//    for the parallel port, which takes several port reads per
+//    character. A kernel task on CPU 0 writes buffered messages to the
+//    port, oldest first across all CPUs (messages carry a global
+//    sequence number). The timer wakes it each tick while messages are
+//    waiting. Messages that don't fit in their CPU's buffer are dropped
+//    and counted; the log task reports the counts.
+//
+//    After a panic, and before the machine halts or fails, the log is
+//    flushed synchronously, and output after a panic goes straight to
+//    the port.
+
+
+// parallel port output
+
+#define IO_PARALLEL1_DATA       0x378
+#define IO_PARALLEL1_STATUS     0x379
+# define IO_PARALLEL_STATUS_BUSY        0x80
+#define IO_PARALLEL1_CONTROL    0x37A
+# define IO_PARALLEL_CONTROL_SELECT     0x08
+# define IO_PARALLEL_CONTROL_INIT       0x04
+# define IO_PARALLEL_CONTROL_STROBE     0x01
+
+static void delay() {
+    (void) inb(0x84);
+    (void) inb(0x84);
+    (void) inb(0x84);
+    (void) inb(0x84);
+}
+
+static void parallel_port_putc(unsigned char c) {
+    static int initialized;
+    if (!initialized) {
+        outb(IO_PARALLEL1_CONTROL, 0);
+        initialized = 1;
+    }
+
+    for (int i = 0;
+         i < 12800 && (inb(IO_PARALLEL1_STATUS) & IO_PARALLEL_STATUS_BUSY) == 0;
+         ++i) {
+        delay();
+    }
+    outb(IO_PARALLEL1_DATA, c);
+    outb(IO_PARALLEL1_CONTROL, IO_PARALLEL_CONTROL_SELECT
+         | IO_PARALLEL_CONTROL_INIT | IO_PARALLEL_CONTROL_STROBE);
+    outb(IO_PARALLEL1_CONTROL, IO_PARALLEL_CONTROL_SELECT
+         | IO_PARALLEL_CONTROL_INIT);
+}
+
+
+// logbuf
+//    A CPU's log ring. Each message is a `log_header` followed by its
+//    text, possibly wrapping around the end of `buf_`. The CPU is the only
+//    producer and writes with interrupts disabled; the drainer is the
+//    only consumer.
+
+struct log_header {
+    uint32_t len;
+    uint32_t seq;
+};
+
+struct logbuf {
+    static constexpr unsigned capacity = 8192;   // must be a power of 2
+
+    std::atomic<unsigned> head_ = 0;             // next byte to drain
+    std::atomic<unsigned> tail_ = 0;             // end of published messages
+    std::atomic<unsigned long> ndropped_ = 0;
+    bool busy_ = false;                          // a message is in progress
+    char buf_[capacity];
+
+    void copy_in(unsigned pos, const void* data, size_t n) {
+        auto p = reinterpret_cast<const char*>(data);
+        for (size_t i = 0; i != n; ++i) {
+            buf_[(pos + i) % capacity] = p[i];
+        }
+    }
+    void copy_out(unsigned pos, void* data, size_t n) const {
+        auto p = reinterpret_cast<char*>(data);
+        for (size_t i = 0; i != n; ++i) {
+            p[i] = buf_[(pos + i) % capacity];
+        }
+    }
+};
+
+namespace {
+logbuf logbufs[MAXCPU];
+std::atomic<unsigned> log_seq;
+std::atomic_flag log_drain_lock;
+std::atomic<bool> log_drain_stop;
+wait_queue log_wq;
+proc* log_task;
+}
+
+
+// log_printer
+
+log_printer::log_printer()
+    : irqs_(irqstate::get()) {
+    cli();
+    if (panicking) {
+        log_flush();
+        return;
+    }
+    logbuf* lb = &logbufs[this_cpu()->cpuindex_];
+    if (lb->busy_) {
+        // nested message (say, from a fault while formatting)
+        drop_ = true;
+        lb->ndropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    lb->busy_ = true;
+    lb_ = lb;
+    start_ = lb->tail_.load(std::memory_order_relaxed);
+    pos_ = start_ + sizeof(log_header);
+    overflow_ = pos_ - lb->head_.load(std::memory_order_acquire)
+        > logbuf::capacity;
+}
+
+log_printer::~log_printer() {
+    if (lb_) {
+        if (overflow_) {
+            lb_->ndropped_.fetch_add(1, std::memory_order_relaxed);
+        } else if (pos_ != start_ + sizeof(log_header)) {
+            log_header h = {
+                pos_ - start_ - unsigned(sizeof(log_header)),
+                log_seq.fetch_add(1, std::memory_order_relaxed)
+            };
+            lb_->copy_in(start_, &h, sizeof(h));
+            // publish the message to the drainer
+            lb_->tail_.store(pos_, std::memory_order_release);
+        }
+        lb_->busy_ = false;
+    }
+    irqs_.restore();
+}
+
+void log_printer::putc(unsigned char c) {
+    if (ebuf_.putc(c, *this) || drop_) {
+        return;
+    } else if (!lb_) {
+        parallel_port_putc(c);
+    } else if (!overflow_) {
+        if (pos_ - lb_->head_.load(std::memory_order_acquire)
+            == logbuf::capacity) {
+            overflow_ = true;
+        } else {
+            lb_->buf_[pos_ % logbuf::capacity] = c;
+            ++pos_;
+        }
+    }
+}
+
+
+void log_printer::write(const char* s, size_t n) {
+    for (size_t i = 0; i != n; ++i) {
+        putc(s[i]);
+    }
+}
+
+
+void log_vprintf(const char* format, va_list val) {
+    log_printer pr;
+    pr.vprintf(format, val);
+}
+
+void log_printf(const char* format, ...) {
+    va_list val;
+    va_start(val, format);
+    log_vprintf(format, val);
+    va_end(val);
+}
+
+void log_write(const char* s, size_t n) {
+    log_printer pr;
+    pr.write(s, n);
+}
+
+
+// log_pending()
+//    Return true iff some CPU has a published message.
+
+static bool log_pending() {
+    for (auto& lb : logbufs) {
+        if (lb.head_.load(std::memory_order_relaxed)
+            != lb.tail_.load(std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// log_drain_one()
+//    Write the oldest published message to the port and free its space.
+//    Returns false if there was none. `log_drain_lock` must be held.
+
+static bool log_drain_one() {
+    logbuf* best = nullptr;
+    log_header bh;
+    for (auto& lb : logbufs) {
+        unsigned head = lb.head_.load(std::memory_order_relaxed);
+        if (head != lb.tail_.load(std::memory_order_acquire)) {
+            log_header h;
+            lb.copy_out(head, &h, sizeof(h));
+            if (!best || int(h.seq - bh.seq) < 0) {
+                best = &lb;
+                bh = h;
+            }
+        }
+    }
+    if (!best) {
+        return false;
+    }
+    unsigned head = best->head_.load(std::memory_order_relaxed)
+        + sizeof(log_header);
+    for (unsigned i = 0; i != bh.len; ++i) {
+        parallel_port_putc(best->buf_[(head + i) % logbuf::capacity]);
+    }
+    best->head_.store(head + bh.len, std::memory_order_release);
+    return true;
+}
+
+// log_report_drops()
+//    Write dropped-message counts to the port. `log_drain_lock` must be
+//    held.
+
+static void log_report_drops() {
+    struct port_printer : public printer {
+        void putc(unsigned char c) override {
+            parallel_port_putc(c);
+        }
+    } pr;
+    for (int cpu = 0; cpu != MAXCPU; ++cpu) {
+        if (unsigned long n = logbufs[cpu].ndropped_.exchange(0)) {
+            pr.printf("log: CPU %d dropped %lu messages\n", cpu, n);
+        }
+    }
+}
+
+
+// log_drain(force)
+//    Write published messages and drop counts to the port. Unless `force`
+//    is true, stop early once `log_drain_stop` is set. `log_drain_lock`
+//    must be held, or `force` true.
+
+static void log_drain(bool force) {
+    while ((force || !log_drain_stop.load(std::memory_order_relaxed))
+           && log_drain_one()) {
+    }
+    if (force || !log_drain_stop.load(std::memory_order_relaxed)) {
+        log_report_drops();
+    }
+}
+
+// log_try_lock(tries)
+//    Acquire `log_drain_lock`, giving up after `tries` failed attempts.
+//    Returns true if the lock was acquired.
+
+static bool log_try_lock(size_t tries) {
+    while (log_drain_lock.test_and_set()) {
+        if (tries == 0) {
+            return false;
+        }
+        --tries;
+        pause();
+    }
+    return true;
+}
+
+// log_flush()
+//    Write all published messages to the port now, from this CPU. If
+//    another drainer holds the lock for a long time, set `log_drain_stop`
+//    so it gives up the lock at its next message boundary, and wait
+//    again. If even that fails (the drainer may have been preempted on
+//    this CPU, or its CPU may have crashed), drain without the lock; only
+//    the halt and failure paths call this, so racing one message is
+//    better than hanging. Once set, `log_drain_stop` stays set.
+
+void log_flush() {
+    bool locked = log_try_lock(1UL << 20);
+    if (!locked && !log_drain_stop.exchange(true)) {
+        locked = log_try_lock(1UL << 20);
+    }
+    log_drain(true);
+    if (locked) {
+        log_drain_lock.clear();
+    }
+}
+
+
+// log_reserve(n)
+//    Make sure this CPU's log buffer has room for `n` more bytes of
+//    messages, draining synchronously if it doesn't. For tasks that log
+//    in bulk and can afford to wait, so their messages aren't dropped.
+//    If the log task is draining and interrupts are disabled, the log
+//    task might be preempted on this CPU, so give up rather than wait.
+
+void log_reserve(size_t n) {
+    while (true) {
+        auto irqs = irqstate::get();
+        cli();
+        const logbuf& lb = logbufs[this_cpu()->cpuindex_];
+        unsigned used = lb.tail_.load(std::memory_order_relaxed)
+            - lb.head_.load(std::memory_order_acquire);
+        irqs.restore();
+        if (used + n <= logbuf::capacity) {
+            return;
+        } else if (!log_drain_lock.test_and_set()) {
+            log_drain(false);
+            log_drain_lock.clear();
+            return;
+        } else if (is_cli()) {
+            return;
+        }
+        pause();
+    }
+}
+
+
+// log_task_main()
+//    Body of the log task. It runs with interrupts enabled, so it
+//    yields to other tasks at each tick like any other task. Once
+//    `log_flush` sets `log_drain_stop`, it stops draining for good.
+
+static void log_task_main() {
+    sti();
+    while (true) {
+        waiter().wait_until(log_wq, [] () {
+            return log_pending()
+                && !log_drain_stop.load(std::memory_order_relaxed);
+        });
+        if (log_drain_lock.test_and_set()) {
+            // a flush is in progress
+            current()->yield();
+            continue;
+        }
+        log_drain(false);
+        log_drain_lock.clear();
+    }
+}
+
+// init_log()
+//    Start the log task on CPU 0. Messages logged earlier wait in their
+//    buffers until it runs.
+
+void init_log() {
+    log_task = knew<proc>();
+    assert(log_task);
+    log_task->init_kernel(log_task_main);
+    cpus[0].enqueue(log_task);
+}
+
+// log_notify()
+//    Wake the log task if messages are waiting. Called by CPU 0's timer
+//    interrupt.
+
+void log_notify() {
+    if (log_task && log_pending()) {
+        log_wq.notify_all();
+    }
+}
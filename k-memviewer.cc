@@ -9,12 +9,16 @@
 
 class memusage {
   public:
-    // tracks physical addresses in the range [0, maxpa)
-    static constexpr uintptr_t maxpa = 1024 * PAGESIZE;
-    // shows physical addresses in the range [0, max_view_pa)
-    static constexpr uintptr_t max_view_pa = 512 * PAGESIZE;
-    // shows virtual addresses in the range [0, max_view_va)
-    static constexpr uintptr_t max_view_va = 768 * PAGESIZE;
+    // shows physical memory in this many console cells
+    static constexpr unsigned view_cells = 512;
+    // shows virtual addresses in [0, MEMSIZE_VIRTUAL) in this many rows
+    // of 64 pages, skipping rows with nothing mapped
+    static constexpr unsigned view_rows = 12;
+
+    // tracks physical addresses in the range [0, maxpa_)
+    uintptr_t maxpa_ = 0;
+    // each physical memory cell shows `view_cellsize_` bytes
+    uintptr_t view_cellsize_ = PAGESIZE;
 
     memusage()
         : v_(nullptr) {
@@ -42,14 +46,16 @@ class memusage {
 
     // Return the symbol (character & color) associated with `pa`
     uint16_t symbol_at(uintptr_t pa) const;
+    // Return the symbol for the physical memory cell starting at `pa`
+    uint16_t cell_symbol_at(uintptr_t pa) const;
 
   private:
     unsigned* v_;
 
     // add `flags` to the page containing `pa`
-    // This is safe to call even if `pa >= maxpa`.
+    // This is safe to call even if `pa >= maxpa_`.
     void mark(uintptr_t pa, unsigned flags) {
-        if (pa < maxpa) {
+        if (pa < maxpa_) {
             v_[pa / PAGESIZE] |= flags;
         }
     }
@@ -68,11 +74,16 @@ class memusage {
 
 void memusage::refresh() {
     if (!v_) {
-        v_ = knew_array<unsigned>(maxpa / PAGESIZE);
+        // track all installed memory; show it in `view_cells` cells
+        maxpa_ = round_up(memsize_physical, PAGESIZE);
+        while (view_cellsize_ * view_cells < maxpa_) {
+            view_cellsize_ *= 2;
+        }
+        v_ = knew_array<unsigned>(maxpa_ / PAGESIZE);
         assert(v_ != nullptr);
     }
 
-    memset(v_, 0, (maxpa / PAGESIZE) * sizeof(*v_));
+    memset(v_, 0, (maxpa_ / PAGESIZE) * sizeof(*v_));
 
     // mark kernel ranges of physical memory
     // We handle reserved ranges of physical memory separately.
@@ -90,9 +101,10 @@ void memusage::refresh() {
 
     // mark pages accessible from each process's page table
     assert(ptable_lock.is_locked());
-    for (int pid = 1; pid < NPROC; ++pid) {
-        proc* p = ptable[pid];
-        if (p) {
+    for (pid_t pid = ptable.next(1);
+         pid != NPROC;
+         pid = ptable.next(pid + 1)) {
+        if (proc* p = ptable[pid]) {
             mark(ka2pa(p), f_kernel | f_process(pid));
 
             auto irqs = p->lock_pagetable_read();
@@ -127,11 +139,11 @@ void memusage::page_error(uintptr_t pa, const char* desc, int pid) const {
 uint16_t memusage::symbol_at(uintptr_t pa) const {
     auto range = physical_ranges.find(pa);
     if (range == physical_ranges.end()
-        || (pa >= maxpa && range->type() == mem_available)) {
+        || (pa >= maxpa_ && range->type() == mem_available)) {
         return '?' | 0xF000;
     }
 
-    if (pa >= maxpa) {
+    if (pa >= maxpa_) {
         if (range->type() == mem_kernel) {
             return 'K' | 0x4000;
         } else {
@@ -182,34 +194,60 @@ uint16_t memusage::symbol_at(uintptr_t pa) const {
 }
 
 
+uint16_t memusage::cell_symbol_at(uintptr_t pa) const {
+    // A cell covering several pages shows its first in-use page, so
+    // process memory stays visible on machines with lots of RAM.
+    for (uintptr_t xpa = pa; xpa != pa + view_cellsize_; xpa += PAGESIZE) {
+        if (xpa < maxpa_ && v_[xpa / PAGESIZE] != 0
+            && physical_ranges.type(xpa) == mem_available) {
+            return symbol_at(xpa);
+        }
+    }
+    return symbol_at(pa);
+}
+
+
 static void console_memviewer_virtual(memusage& mu, proc* vmp) {
     const char* statemsg = vmp->pstate_ == proc::ps_faulted ? " (faulted)" : "";
     console_printf(CPOS(10, 26),
                    CS_WHITE "VIRTUAL ADDRESS SPACE FOR %d%C%s\n", vmp->id_,
                    0x0700, statemsg);
 
-    for (vmiter it(vmp, 0);
-         it.va() < memusage::max_view_va;
-         it += PAGESIZE) {
-        unsigned long pn = it.va() / PAGESIZE;
-        if (pn % 64 == 0) {
-            console_printf(CPOS(11 + pn / 64, 3), CS_WHITE "0x%06X ", it.va());
+    // The stack sits just below `MEMSIZE_VIRTUAL`, far above code and
+    // heap, so show only the rows that have mappings.
+    constexpr uintptr_t rowsize = 64 * PAGESIZE;
+    unsigned row = 0;
+    vmiter it(vmp, 0);
+    while (row != memusage::view_rows) {
+        while (it.va() < MEMSIZE_VIRTUAL && !it.present()) {
+            it.next();
         }
-        uint16_t ch;
-        if (!it.present()) {
-            ch = ' ';
-        } else {
-            ch = mu.symbol_at(it.pa());
-            if (it.user()) { // switch foreground & background colors
-                if (ch == (0x0F00 | 'S')) {
-                    ch ^= 0xFE00;
-                } else {
-                    uint16_t z = (ch & 0x0F00) ^ ((ch & 0xF000) >> 4);
-                    ch ^= z | (z << 4);
+        if (it.va() >= MEMSIZE_VIRTUAL) {
+            break;
+        }
+        uintptr_t rowva = round_down(it.va(), rowsize);
+        console_printf(CPOS(11 + row, 0), CS_WHITE " 0x%08lX ", rowva);
+        for (it.find(rowva); it.va() != rowva + rowsize; it += PAGESIZE) {
+            uint16_t ch;
+            if (!it.present()) {
+                ch = ' ';
+            } else {
+                ch = mu.symbol_at(it.pa());
+                if (it.user()) { // switch foreground & background colors
+                    if (ch == (0x0F00 | 'S')) {
+                        ch ^= 0xFE00;
+                    } else {
+                        uint16_t z = (ch & 0x0F00) ^ ((ch & 0xF000) >> 4);
+                        ch ^= z | (z << 4);
+                    }
                 }
             }
+            console[CPOS(11 + row, 12 + (it.va() - rowva) / PAGESIZE)] = ch;
         }
-        console[CPOS(11 + pn/64, 12 + pn%64)] = ch;
+        ++row;
+    }
+    for (; row != memusage::view_rows; ++row) {
+        console_printf(CPOS(11 + row, 0), "\n");
     }
 }
 
@@ -225,11 +263,17 @@ void console_memviewer(proc* vmp) {
                    CS_WHITE "PHYSICAL MEMORY                  @%lu\n",
                    ticks.load());
 
-    for (int pn = 0; pn * PAGESIZE < memusage::max_view_pa; ++pn) {
-        if (pn % 64 == 0) {
-            console_printf(CPOS(1 + pn/64, 3), CS_WHITE "0x%06X ", pn << 12);
+    for (unsigned cn = 0; cn < memusage::view_cells; ++cn) {
+        uintptr_t pa = cn * mu.view_cellsize_;
+        if (cn % 64 == 0) {
+            if (mu.view_cellsize_ == PAGESIZE) {
+                console_printf(CPOS(1 + cn/64, 3), CS_WHITE "0x%06X ", pa);
+            } else {
+                console_printf(CPOS(1 + cn/64, 3), CS_WHITE "%7luM ",
+                               pa >> 20);
+            }
         }
-        console[CPOS(1 + pn/64, 12 + pn%64)] = mu.symbol_at(pn * PAGESIZE);
+        console[CPOS(1 + cn/64, 12 + cn%64)] = mu.cell_symbol_at(pa);
     }
 
     // print virtual memory
@@ -3,8 +3,8 @@
 #include "k-vmiter.hh"
 #include "k-devices.hh"
 
-proc* ptable[NPROC];            // array of process descriptor pointers
-spinlock ptable_lock;           // protects `ptable`
+proctable ptable;               // map of thread IDs to `proc`s
+spinlock ptable_lock;           // protects `ptable` modifications
 
 // proc::proc()
 //    The constructor initializes the `proc` to empty.
@@ -13,6 +13,98 @@ proc::proc() {
 }
 
 
+// proctable::proctable()
+//    ID 0 is never allocated.
+
+proctable::proctable() {
+    for (auto& l : leaves_) {
+        l.store(nullptr, std::memory_order_relaxed);
+    }
+    memset(used_, 0, sizeof(used_));
+    memset(full_, 0, sizeof(full_));
+    used_[0] = 1;
+}
+
+
+// proctable::insert(p)
+//    The first level of the bitmap narrows the search to one word of
+//    `used_`.
+
+pid_t proctable::insert(proc* p) {
+    assert(ptable_lock.is_locked());
+    for (unsigned i = 0; i != arraysize(full_); ++i) {
+        if (~full_[i]) {
+            unsigned w = i * 64 + lsb(~full_[i]) - 1;
+            pid_t id = w * 64 + lsb(~used_[w]) - 1;
+            int r = insert_at(id, p);
+            return r < 0 ? r : id;
+        }
+    }
+    return E_AGAIN;
+}
+
+
+// proctable::insert_at(id, p)
+
+int proctable::insert_at(pid_t id, proc* p) {
+    assert(ptable_lock.is_locked());
+    assert(id > 0 && id < NPROC);
+    assert(!(used_[id / 64] & (1UL << (id % 64))));
+    auto& lslot = leaves_[id >> leaf_bits];
+    leaf* l = lslot.load(std::memory_order_relaxed);
+    if (!l) {
+        l = reinterpret_cast<leaf*>(kalloc(sizeof(leaf), KALLOC_ZERO));
+        if (!l) {
+            return E_NOMEM;
+        }
+        lslot.store(l, std::memory_order_release);
+    }
+
+    uint64_t& word = used_[id / 64];
+    word |= 1UL << (id % 64);
+    if (word == ~0UL) {
+        full_[id / 4096] |= 1UL << ((id / 64) % 64);
+    }
+    ++size_;
+    p->id_ = id;
+    l->p_[id & (leaf_size - 1)].store(p, std::memory_order_release);
+    return 0;
+}
+
+
+// proctable::erase(id)
+
+void proctable::erase(pid_t id) {
+    assert(ptable_lock.is_locked());
+    assert(id > 0 && id < NPROC);
+    assert(used_[id / 64] & (1UL << (id % 64)));
+    leaf* l = leaves_[id >> leaf_bits].load(std::memory_order_relaxed);
+    l->p_[id & (leaf_size - 1)].store(nullptr, std::memory_order_release);
+    used_[id / 64] &= ~(1UL << (id % 64));
+    full_[id / 4096] &= ~(1UL << ((id / 64) % 64));
+    --size_;
+}
+
+
+// proctable::next(id)
+//    Scans `used_`, so it costs one step per 64 IDs. Call with
+//    `ptable_lock` held.
+
+pid_t proctable::next(pid_t id) const {
+    if (id <= 0) {
+        id = 1;
+    }
+    while (id < NPROC) {
+        uint64_t bits = used_[id / 64] & (~0UL << (id % 64));
+        if (bits) {
+            return (id & ~63) + lsb(bits) - 1;
+        }
+        id = (id & ~63) + 64;
+    }
+    return NPROC;
+}
+
+
 // proc::init_user(pt)
 //    Initialize this `proc` as a runnable user context -- that is,
 //    a process -- with initial page table `pt`.
@@ -73,6 +165,31 @@ void proc::init_kernel(void (*f)()) {
 }
 
 
+// proc::init_procdata()
+//    Allocate this process's data page and map it read-only at
+//    `VA_PROCDATA`. Call after `init_user` and after setting `pid_` and
+//    `ppid_`. Returns 0 or `E_NOMEM`.
+
+int proc::init_procdata() {
+    assert(!data_);
+    void* pg = kalloc(PAGESIZE, KALLOC_ZERO);
+    if (!pg) {
+        return E_NOMEM;
+    }
+    if (vmiter(this, VA_PROCDATA).try_map(pg, PTE_P | PTE_U) < 0) {
+        kfree(pg);
+        return E_NOMEM;
+    }
+    data_ = new (pg) procdata;
+    data_->pid = pid_;
+    data_->ppid = ppid_;
+    data_->ncpu = ncpu;
+    data_->hz = HZ;
+    data_->tsc_hz = tsc_hz;
+    return 0;
+}
+
+
 // proc::panic_nonrunnable()
 //    Called when `k-exception.S` tries to run a non-runnable proc.
 
@@ -188,11 +305,11 @@ int proc::load_segment(const elf_program& ph, proc_loader& ld) {
         return E_NOMEM;
     }
 
-    // allocate memory
+    // allocate memory (zeroed, which initializes the BSS)
     for (vmiter it(ld.pagetable_, round_down(va, PAGESIZE));
          it.va() < end_mem;
          it += PAGESIZE) {
-        void* pg = kalloc(PAGESIZE);
+        void* pg = kalloc(PAGESIZE, KALLOC_ZERO);
         if (!pg || it.try_map(ka2pa(pg), PTE_PWU) < 0) {
             kfree(pg);
             return E_NOMEM;
@@ -229,13 +346,6 @@ int proc::load_segment(const elf_program& ph, proc_loader& ld) {
         ld.put_page(*buf);
     }
 
-    // set initialized, but not copied, memory to zero
-    for (vmiter it(ld.pagetable_, end_file); it.va() < end_mem; ) {
-        size_t sz = min(it.last_va(), end_mem) - it.va();
-        memset(it.kptr<uint8_t*>(), 0, sz);
-        it += sz;
-    }
-
     return 0;
 }
 
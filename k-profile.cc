@@ -0,0 +1,383 @@
+#include "kernel.hh"
+#include "k-apic.hh"
+#include "k-devices.hh"
+#include "elf.h"
+
+// k-profile.cc
+//
+//    Sampling profiler. While profiling, each CPU's LAPIC timer runs
+//    `timer_mult_` times faster than `HZ`. Every timer interrupt records
+//    the interrupted task's call stack, kernel and user frames both, in
+//    the CPU's sample buffer; only every `timer_mult_`th interrupt is a
+//    scheduler tick.
+//
+//    `PROFILE_DUMP` folds the samples into one line per distinct stack,
+//    `PROGRAM;OUTER;...;INNER COUNT`, the input format of flamegraph
+//    tools. Kernel frames are named with the kernel symbol table, user
+//    frames with the symbol table of the process's initfs ELF image.
+
+
+namespace {
+
+constexpr unsigned profile_maxdepth = 14;
+
+struct profile_sample {
+    pid_t tid;
+    uint16_t nkernel;                  // # kernel frames
+    uint16_t nuser;                    // # user frames
+    const char* program;
+    uintptr_t pc[profile_maxdepth];    // kernel, then user; innermost first
+};
+static_assert(sizeof(profile_sample) == 128);
+
+struct profbuf {
+    static constexpr size_t size = 32 * PAGESIZE;
+    static constexpr unsigned capacity = size / sizeof(profile_sample);
+
+    profile_sample* samples_ = nullptr;
+    unsigned n_ = 0;
+    unsigned long ndropped_ = 0;
+    std::atomic<bool> busy_ = false;   // true while recording a sample
+};
+
+profbuf profbufs[MAXCPU];
+std::atomic<bool> profiling;
+std::atomic<unsigned> profile_mult = 1;
+std::atomic_flag profile_busy;         // serializes `sys_profile` calls
+
+
+// elf_symbols
+//    The function symbols of an initfs program, for naming user frames.
+
+struct elf_symbols {
+    const elf_symbol* sym_ = nullptr;
+    size_t nsym_ = 0;
+    const char* strtab_ = nullptr;
+    size_t strtab_size_ = 0;
+
+    void init(const char* program);
+    const elf_symbol* find(uintptr_t addr) const;
+    const char* name(const elf_symbol* s) const {
+        return s->st_name < strtab_size_ ? strtab_ + s->st_name : "?";
+    }
+};
+
+void elf_symbols::init(const char* program) {
+    sym_ = nullptr;
+    nsym_ = 0;
+    int mindex = memfile::initfs_lookup(program);
+    if (mindex < 0) {
+        return;
+    }
+    const memfile& mf = memfile::initfs[mindex];
+    auto eh = reinterpret_cast<const elf_header*>(mf.data_);
+    if (mf.len_ < sizeof(elf_header)
+        || eh->e_magic != ELF_MAGIC
+        || eh->e_shentsize != sizeof(elf_section)
+        || eh->e_shoff > mf.len_
+        || eh->e_shnum > (mf.len_ - eh->e_shoff) / sizeof(elf_section)) {
+        return;
+    }
+    auto sh = reinterpret_cast<const elf_section*>(mf.data_ + eh->e_shoff);
+    for (unsigned i = 0; i != eh->e_shnum; ++i) {
+        if (sh[i].sh_type == ELF_SHT_SYMTAB
+            && sh[i].sh_link < eh->e_shnum
+            && sh[i].sh_offset <= mf.len_
+            && sh[i].sh_size <= mf.len_ - sh[i].sh_offset) {
+            auto& strsh = sh[sh[i].sh_link];
+            if (strsh.sh_offset > mf.len_
+                || strsh.sh_size > mf.len_ - strsh.sh_offset) {
+                return;
+            }
+            sym_ = reinterpret_cast<const elf_symbol*>
+                (mf.data_ + sh[i].sh_offset);
+            nsym_ = sh[i].sh_size / sizeof(elf_symbol);
+            strtab_ = reinterpret_cast<const char*>(mf.data_ + strsh.sh_offset);
+            strtab_size_ = strsh.sh_size;
+            return;
+        }
+    }
+}
+
+const elf_symbol* elf_symbols::find(uintptr_t addr) const {
+    const elf_symbol* best = nullptr;
+    for (size_t i = 0; i != nsym_; ++i) {
+        auto& s = sym_[i];
+        if ((s.st_info & ELF_STT_MASK) == ELF_STT_FUNC
+            && s.st_value <= addr
+            && addr < s.st_value + max(s.st_size, uint64_t(1))
+            && (!best || s.st_value > best->st_value)) {
+            best = &s;
+        }
+    }
+    return best;
+}
+
+
+// record_sample(c, p, regs)
+//    Record the stack of `p`, interrupted at `regs`, on CPU `c`.
+
+void record_sample(cpustate* c, proc* p, const regstate* regs) {
+    profbuf& pb = profbufs[c->cpuindex_];
+    pb.busy_.store(true);
+    if (!profiling.load()) {
+        // raced with `profile_stop`
+    } else if (pb.n_ == pb.capacity) {
+        ++pb.ndropped_;
+    } else {
+        profile_sample& s = pb.samples_[pb.n_];
+        s.tid = p->id_;
+        if (p == c->idle_task_) {
+            s.program = "[idle]";
+        } else {
+            s.program = p->program_ ? p->program_ : "[kernel]";
+        }
+        s.nkernel = 0;
+        const regstate* uregs = regs;
+        if ((regs->reg_cs & 3) == 0) {
+            s.nkernel = backtrace_pcs(*regs, p->pagetable_, s.pc,
+                                      profile_maxdepth);
+            // a user task entered the kernel by saving its user registers
+            // at the top of its kernel stack
+            uregs = nullptr;
+            if (p->program_) {
+                uregs = reinterpret_cast<const regstate*>
+                    (reinterpret_cast<uintptr_t>(p) + PROCSTACK_SIZE) - 1;
+                if ((uregs->reg_cs & 3) == 0) {
+                    uregs = nullptr;
+                }
+            }
+        }
+        s.nuser = 0;
+        if (uregs) {
+            s.nuser = backtrace_pcs(*uregs, p->pagetable_, s.pc + s.nkernel,
+                                    profile_maxdepth - s.nkernel);
+        }
+        ++pb.n_;
+    }
+    pb.busy_.store(false);
+}
+
+
+// profile_stop()
+//    Stop sampling and wait until no CPU is recording a sample.
+
+void profile_stop() {
+    profiling = false;
+    profile_mult = 1;
+    for (int i = 0; i != ncpu; ++i) {
+        while (profbufs[i].busy_.load()) {
+            pause();
+        }
+    }
+}
+
+
+// profile_start(hz)
+//    Discard old samples and start sampling at about `hz` samples per
+//    second per CPU (at least `HZ`, at most `100 * HZ`).
+
+int profile_start(unsigned long hz) {
+    profile_stop();
+    for (int i = 0; i != ncpu; ++i) {
+        profbuf& pb = profbufs[i];
+        if (!pb.samples_) {
+            pb.samples_ = reinterpret_cast<profile_sample*>
+                (kalloc(profbuf::size));
+            if (!pb.samples_) {
+                return E_NOMEM;
+            }
+        }
+        pb.n_ = 0;
+        pb.ndropped_ = 0;
+    }
+    profile_mult = min(max(hz / HZ, 1UL), 100UL);
+    profiling = true;
+    return 0;
+}
+
+
+// canonicalize(s, usyms)
+//    Replace each address in `s` with the start of its function, so
+//    samples from different points in the same functions fold together.
+//    Return addresses point after a call, so look up the byte before.
+
+void canonicalize(profile_sample& s, const elf_symbols& usyms) {
+    for (unsigned i = 0; i != unsigned(s.nkernel + s.nuser); ++i) {
+        bool first = i == 0 || i == s.nkernel;
+        uintptr_t addr = s.pc[i] - (first ? 0 : 1);
+        if (i < s.nkernel) {
+            uintptr_t start;
+            if (lookup_symbol(addr, nullptr, &start)) {
+                s.pc[i] = start;
+            }
+        } else if (auto sym = usyms.find(addr)) {
+            s.pc[i] = sym->st_value;
+        }
+    }
+}
+
+bool same_stack(const profile_sample& a, const profile_sample& b) {
+    return a.program == b.program
+        && a.nkernel == b.nkernel
+        && a.nuser == b.nuser
+        && memcmp(a.pc, b.pc, (a.nkernel + a.nuser) * sizeof(uintptr_t)) == 0;
+}
+
+size_t hash_stack(const profile_sample& s) {
+    size_t h = reinterpret_cast<uintptr_t>(s.program) + s.nkernel * 31
+        + s.nuser;
+    for (unsigned i = 0; i != unsigned(s.nkernel + s.nuser); ++i) {
+        h = (h ^ s.pc[i]) * 0x100000001B3UL;
+    }
+    return h;
+}
+
+// format_stack(buf, sz, s, usyms)
+//    Write the folded form of `s` to `buf`, outermost frame first.
+
+void format_stack(char* buf, size_t sz, const profile_sample& s,
+                  const elf_symbols& usyms) {
+    size_t len = snprintf(buf, sz, "%s", s.program);
+    for (int i = s.nkernel + s.nuser - 1; i >= 0 && len < sz; --i) {
+        const char* name = nullptr;
+        if (i < s.nkernel) {
+            lookup_symbol(s.pc[i], &name, nullptr);
+        } else if (auto sym = usyms.find(s.pc[i])) {
+            name = usyms.name(sym);
+        }
+        if (name) {
+            len += snprintf(buf + len, sz - len, ";%s", name);
+        } else {
+            len += snprintf(buf + len, sz - len, ";%p", s.pc[i]);
+        }
+    }
+}
+
+
+// profile_dump()
+//    Stop sampling, then write folded stacks to the log. Returns the
+//    number of distinct stacks or an error code.
+
+int profile_dump() {
+    profile_stop();
+    size_t nsamples = 0;
+    unsigned long ndropped = 0;
+    for (int i = 0; i != ncpu; ++i) {
+        nsamples += profbufs[i].n_;
+        ndropped += profbufs[i].ndropped_;
+    }
+    if (nsamples == 0) {
+        return 0;
+    }
+
+    struct bucket {
+        profile_sample* s;
+        unsigned count;
+    };
+    size_t nbuckets = round_up_pow2(2 * nsamples);
+    auto buckets = reinterpret_cast<bucket*>
+        (kalloc(nbuckets * sizeof(bucket), KALLOC_ZERO));
+    auto line = reinterpret_cast<char*>(kalloc(PAGESIZE));
+    if (!buckets || !line) {
+        kfree(buckets);
+        kfree(line);
+        return E_NOMEM;
+    }
+
+    // count distinct stacks
+    elf_symbols usyms;
+    const char* usyms_program = nullptr;
+    int ndistinct = 0;
+    for (int i = 0; i != ncpu; ++i) {
+        for (unsigned j = 0; j != profbufs[i].n_; ++j) {
+            profile_sample& s = profbufs[i].samples_[j];
+            if (s.program != usyms_program) {
+                usyms.init(s.program);
+                usyms_program = s.program;
+            }
+            canonicalize(s, usyms);
+            size_t b = hash_stack(s) & (nbuckets - 1);
+            while (buckets[b].s && !same_stack(*buckets[b].s, s)) {
+                b = (b + 1) & (nbuckets - 1);
+            }
+            if (!buckets[b].s) {
+                buckets[b].s = &s;
+                ++ndistinct;
+            }
+            ++buckets[b].count;
+        }
+    }
+
+    // print them
+    for (size_t b = 0; b != nbuckets; ++b) {
+        if (buckets[b].s) {
+            const profile_sample& s = *buckets[b].s;
+            if (s.program != usyms_program) {
+                usyms.init(s.program);
+                usyms_program = s.program;
+            }
+            format_stack(line, PAGESIZE, s, usyms);
+            log_reserve(strlen(line) + 64);
+            log_format("!P %s %u\n", line, buckets[b].count);
+        }
+    }
+    if (ndropped) {
+        log_format("!P [dropped] %lu\n", ndropped);
+    }
+
+    kfree(buckets);
+    kfree(line);
+    return ndistinct;
+}
+
+}
+
+
+// cpustate::profile_interrupt(p, regs)
+//    Called on every timer interrupt, which interrupted task `p` at
+//    `regs`. Adjusts this CPU's timer rate to the profiler's and records
+//    a sample if profiling. Returns true if the interrupt is a scheduler
+//    tick.
+
+bool cpustate::profile_interrupt(proc* p, const regstate* regs) {
+    unsigned mult = profile_mult.load(std::memory_order_relaxed);
+    if (mult != timer_mult_) {
+        auto& lapic = lapicstate::get();
+        lapic.write(lapic.reg_timer_initial_count, 1000000000 / HZ / mult);
+        timer_mult_ = mult;
+        timer_subtick_ = 0;
+    }
+    if (profiling.load(std::memory_order_relaxed)) {
+        record_sample(this, p, regs);
+    }
+    if (++timer_subtick_ < timer_mult_) {
+        return false;
+    }
+    timer_subtick_ = 0;
+    return true;
+}
+
+
+// proc::syscall_profile(regs)
+//    Handle `sys_profile(op, arg)`.
+
+uintptr_t proc::syscall_profile(regstate* regs) {
+    int op = regs->reg_rdi;
+    if (op != PROFILE_START && op != PROFILE_STOP && op != PROFILE_DUMP) {
+        return E_INVAL;
+    }
+    if (profile_busy.test_and_set()) {
+        return E_AGAIN;
+    }
+    int r = 0;
+    if (op == PROFILE_START) {
+        r = profile_start(regs->reg_rsi);
+    } else if (op == PROFILE_STOP) {
+        profile_stop();
+    } else {
+        r = profile_dump();
+    }
+    profile_busy.clear();
+    return r;
+}
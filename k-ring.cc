@@ -0,0 +1,387 @@
+#include "k-ring.hh"
+#include "k-vmiter.hh"
+#include "k-wait.hh"
+#include "k-chkfsiter.hh"
+
+// k-ring.cc
+//
+//    Submission/completion rings. See k-ring.hh and `ring_header` in
+//    lib.hh.
+
+
+static void ring_poll();
+
+
+// proc::syscall_ring_setup(regs)
+//    Handle `sys_ring_setup(addr, nentries, flags)`. The ring is
+//    allocated contiguously, so the kernel can access it through its own
+//    mapping from any task, and it is never swapped out.
+
+uintptr_t proc::syscall_ring_setup(regstate* regs) {
+    uintptr_t addr = regs->reg_rdi;
+    unsigned nentries = regs->reg_rsi;
+    int flags = regs->reg_rdx;
+    if (ring_
+        || (addr & PAGEOFFMASK) != 0
+        || nentries == 0
+        || nentries > RING_MAXENTRIES
+        || (nentries & (nentries - 1)) != 0
+        || (flags & ~RING_SETUP_POLL) != 0) {
+        return E_INVAL;
+    }
+    size_t sz = round_up(ring_header::size(nentries), PAGESIZE);
+    if (addr >= VA_PROCDATA || VA_PROCDATA - addr < sz) {
+        return E_INVAL;
+    }
+    for (vmiter it(this, addr); it.va() < addr + sz; it.next()) {
+        // reject present and swapped-out pages
+        if (auto pte = it.pte(); pte && *pte) {
+            return E_INVAL;
+        }
+    }
+
+    auto hdr = reinterpret_cast<ring_header*>(kalloc(sz, KALLOC_ZERO));
+    ringstate* rs = knew<ringstate>();
+    proc* poller = flags & RING_SETUP_POLL ? knew<proc>() : nullptr;
+    bool ok = hdr && rs && (poller || !(flags & RING_SETUP_POLL));
+    size_t off = 0;
+    while (ok && off != sz) {
+        ok = vmiter(this, addr + off).try_map(ka2pa(hdr) + off, PTE_PWU) >= 0;
+        off += ok ? PAGESIZE : 0;
+    }
+    if (ok && poller) {
+        // the poller has its own thread ID, but runs with this process's
+        // page table, so user-copy functions work on its behalf
+        poller->init_kernel(ring_poll);
+        poller->pid_ = pid_;
+        poller->leader_ = leader_;
+        poller->pagetable_ = pagetable_;
+        spinlock_guard guard(ptable_lock);
+        poller->id_ = ptable.insert(poller);
+        ok = poller->id_ >= 0;
+    }
+    if (!ok) {
+        // unmapping can't fail: the page table pages exist
+        while (off != 0) {
+            off -= PAGESIZE;
+            vmiter(this, addr + off).map(uintptr_t(0), 0);
+        }
+        kfree(hdr);
+        kfree(rs);
+        kfree(poller);
+        return E_NOMEM;
+    }
+
+    hdr->nentries = nentries;
+    hdr->flags = flags;
+    rs->hdr_ = hdr;
+    rs->sq_ = reinterpret_cast<ring_sqe*>(hdr + 1);
+    rs->cq_ = reinterpret_cast<ring_cqe*>(rs->sq_ + nentries);
+    rs->nentries_ = nentries;
+
+    if (poller) {
+        poller->ring_ = rs;
+        rs->poller_ = poller;
+        cpus[(runq_cpu_ + 1) % ncpu].enqueue(poller);
+    }
+    ring_ = rs;
+    return 0;
+}
+
+
+// proc::syscall_ring_enter(regs)
+//    Handle `sys_ring_enter(to_submit, min_complete)`.
+
+uintptr_t proc::syscall_ring_enter(regstate* regs) {
+    // This is a slow system call, so allow interrupts by default
+    sti();
+
+    unsigned to_submit = regs->reg_rdi;
+    unsigned min_complete = regs->reg_rsi;
+    ringstate* rs = ring_;
+    if (!rs) {
+        return E_INVAL;
+    }
+    unsigned want = min(min_complete, rs->nentries_);
+
+    if (rs->poller_) {
+        rs->poll_wq_.notify_all();
+        // sleep until the poller has posted enough, or has run out of
+        // work that could post more
+        waiter().wait_until(rs->cq_wq_, [&] () {
+            return rs->ncompleted() >= want || rs->idle();
+        });
+        return 0;
+    }
+
+    // consume submissions; if pending reads fill up, wait for some
+    unsigned n = 0;
+    while (true) {
+        n += rs->submit(this, to_submit - n);
+        if (n == to_submit || rs->npending_ != ringstate::max_pending) {
+            break;
+        }
+        rs->reap(this, true);
+    }
+    // post what's ready, then sleep on the disk until enough have posted
+    rs->reap(this, false);
+    while (rs->ncompleted() < want && rs->npending_ != 0) {
+        rs->reap(this, true);
+    }
+    return n;
+}
+
+
+// ring_poll()
+//    Body of a ring's polling kernel task. Consumes submissions and posts
+//    completions as they become ready; with nothing to do but wait for the
+//    disk, sleeps until a read completes. With nothing at all to do (or no
+//    room for completions), sets `RING_NEED_WAKEUP` and sleeps until
+//    `sys_ring_enter` wakes it.
+//    Exits, freeing the `ringstate`, when the ring's thread exits.
+
+static void ring_poll() {
+    sti();
+    proc* p = current();
+    ringstate* rs = p->ring_;
+    while (!rs->stopping_) {
+        unsigned n = rs->submit(p, -1U);
+        n += rs->reap(p, n == 0);
+        if (n != 0 || rs->idle()) {
+            rs->cq_wq_.notify_all();
+        }
+        if (n == 0 && rs->npending_ == 0) {
+            // Nothing to do: the ring is empty, or the completion ring is
+            // full. The flag must be visible before we check `sq_tail`
+            // for the last time; `ring_wake_poller` orders the other side.
+            __atomic_fetch_or(&rs->hdr_->flags, RING_NEED_WAKEUP,
+                              __ATOMIC_SEQ_CST);
+            waiter().wait_until(rs->poll_wq_, [&] () {
+                return rs->stopping_
+                    || (__atomic_load_n(&rs->hdr_->sq_tail, __ATOMIC_SEQ_CST)
+                           != rs->sq_head_
+                        && rs->ncompleted() < rs->nentries_);
+            });
+            __atomic_fetch_and(&rs->hdr_->flags, ~RING_NEED_WAKEUP,
+                               __ATOMIC_RELAXED);
+        }
+    }
+    rs->discard();
+    p->ring_ = nullptr;
+    kfree(rs);
+    {
+        p->usage_charge(&usage_counters::stime);
+        spinlock_guard guard(ptable_lock);
+        ptable.erase(p->id_);
+        p->leader_->exited_usage_ += p->usage_;
+    }
+    p->pstate_ = proc::ps_exited;
+    p->yield_noreturn();
+}
+
+
+// ringstate::stop()
+//    Called by the ring's thread as it exits.
+
+void ringstate::stop() {
+    if (poller_) {
+        stopping_ = true;
+        poll_wq_.notify_all();
+    } else {
+        discard();
+        kfree(this);
+    }
+}
+
+
+// ringstate::discard()
+//    Drop pending reads. Their disk reads finish into the buffer cache,
+//    which doesn't need the ring.
+
+void ringstate::discard() {
+    for (unsigned i = 0; i != npending_; ++i) {
+        for (unsigned j = 0; j != pending_[i].nblocks_; ++j) {
+            pending_[i].blocks_[j].reset();
+        }
+    }
+    npending_ = 0;
+    nheld_ = 0;
+}
+
+
+// ringstate::submit(p, max)
+//    Consume submissions in order. Stops early if the completion ring
+//    could fill, since every submission must have room for its
+//    completion, or if a read can't be parked because too many are
+//    pending.
+
+unsigned ringstate::submit(proc* p, unsigned max) {
+    unsigned mask = nentries_ - 1;
+    unsigned n = 0;
+    while (n != max) {
+        uint32_t tail = __atomic_load_n(&hdr_->sq_tail, __ATOMIC_ACQUIRE);
+        if (tail == sq_head_ || ncompleted() + npending_ >= nentries_) {
+            break;
+        }
+        ring_sqe sqe = sq_[sq_head_ & mask];
+        if (sqe.op == SYSCALL_READDISKFILE && npending_ == max_pending) {
+            break;
+        }
+        __atomic_store_n(&sq_head_, sq_head_ + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&hdr_->sq_head, sq_head_, __ATOMIC_RELEASE);
+        ++n;
+
+        if (sqe.op != SYSCALL_READDISKFILE || !start_read(p, sqe)) {
+            post(sqe, execute(p, sqe));
+        }
+    }
+    return n;
+}
+
+
+// ringstate::start_read(p, sqe)
+//    Start disk reads for the blocks a `SYSCALL_READDISKFILE` submission
+//    will copy, and park it as a pending read. Returns false if no read
+//    was needed (or possible), so the caller should just execute it. The
+//    file lookup can block; the data reads don't.
+
+bool ringstate::start_read(proc* p, const ring_sqe& sqe) {
+    char filename[chkfs::maxnamelen + 1];
+    if (!sata_disk
+        || nheld_ == max_held
+        || strncpy_from_user(filename, sqe.args[0], sizeof(filename)) < 0) {
+        return false;
+    }
+    auto ino = chkfsstate::get().lookup_inode(filename);
+    if (!ino) {
+        return false;
+    }
+
+    auto& pr = pending_[npending_];
+    assert(pr.nblocks_ == 0);
+    ino->lock_read();
+    size_t off = min(sqe.args[3], size_t(ino->size));
+    size_t end = off + min(sqe.args[2], ino->size - off);
+    for (chkfs_fileiter it(ino.get(), off);
+         size_t(it.offset()) < end
+             && pr.nblocks_ != arraysize(pr.blocks_)
+             && nheld_ != max_held;
+         it += chkfs::blocksize - it.block_relative_offset()) {
+        auto bn = it.blocknum();
+        if (!bn) {
+            continue;
+        }
+        auto e = bufcache::get().load_async(bn);
+        if (!e) {
+            break;
+        } else if (e->state_ == bcslot::s_loading) {
+            pr.blocks_[pr.nblocks_] = std::move(e);
+            ++pr.nblocks_;
+            ++nheld_;
+        }
+    }
+    ino->unlock_read();
+
+    if (pr.nblocks_ == 0) {
+        return false;
+    }
+    pr.sqe_ = sqe;
+    ++npending_;
+    return true;
+}
+
+
+// ringstate::reap(p, wait)
+//    See k-ring.hh.
+
+unsigned ringstate::reap(proc* p, bool wait) {
+    unsigned n = 0;
+    for (unsigned i = 0; i != npending_; ) {
+        auto& pr = pending_[i];
+        bool ready = true;
+        for (unsigned j = 0; j != pr.nblocks_ && ready; ++j) {
+            ready = pr.blocks_[j]->state_ != bcslot::s_loading;
+        }
+        if (!ready) {
+            ++i;
+            continue;
+        }
+        // the blocks are cached (and held), so this won't wait for disk
+        post(pr.sqe_, execute(p, pr.sqe_));
+        for (unsigned j = 0; j != pr.nblocks_; ++j) {
+            pr.blocks_[j].reset();
+        }
+        nheld_ -= pr.nblocks_;
+        pr.nblocks_ = 0;
+        // keep pending reads oldest first
+        for (unsigned j = i; j + 1 != npending_; ++j) {
+            pending_[j].sqe_ = pending_[j + 1].sqe_;
+            for (unsigned k = 0; k != pending_[j + 1].nblocks_; ++k) {
+                pending_[j].blocks_[k] = std::move(pending_[j + 1].blocks_[k]);
+            }
+            pending_[j].nblocks_ = pending_[j + 1].nblocks_;
+            pending_[j + 1].nblocks_ = 0;
+        }
+        --npending_;
+        ++n;
+    }
+
+    if (n == 0 && wait && npending_ != 0) {
+        // wait for the oldest pending read's next block; the disk
+        // interrupt's `bcslot::finish_load` wakes us
+        auto& pr = pending_[0];
+        bcslot* slot = nullptr;
+        for (unsigned j = 0; j != pr.nblocks_ && !slot; ++j) {
+            if (pr.blocks_[j]->state_ == bcslot::s_loading) {
+                slot = pr.blocks_[j].get();
+            }
+        }
+        if (slot) {
+            waiter(reinterpret_cast<uintptr_t>(slot)).wait_until(
+                bufcache::get().read_wq_, [&] () {
+                    return slot->state_ != bcslot::s_loading;
+                });
+        }
+        n = reap(p, false);
+    }
+    return n;
+}
+
+
+// ringstate::post(sqe, result)
+//    Post a completion for `sqe`.
+
+void ringstate::post(const ring_sqe& sqe, uintptr_t result) {
+    ring_cqe* cqe = &cq_[cq_tail_ & (nentries_ - 1)];
+    cqe->user_data = sqe.user_data;
+    cqe->result = result;
+    __atomic_store_n(&cq_tail_, cq_tail_ + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr_->cq_tail, cq_tail_, __ATOMIC_RELEASE);
+}
+
+
+// ringstate::execute(p, sqe)
+//    Run one submission as a system call by `p`.
+
+uintptr_t ringstate::execute(proc* p, const ring_sqe& sqe) {
+    regstate regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.reg_rax = sqe.op;
+    regs.reg_rdi = sqe.args[0];
+    regs.reg_rsi = sqe.args[1];
+    regs.reg_rdx = sqe.args[2];
+    regs.reg_r10 = sqe.args[3];
+
+    switch (sqe.op) {
+    case SYSCALL_READ:
+        return p->syscall_read(&regs);
+    case SYSCALL_WRITE:
+        return p->syscall_write(&regs);
+    case SYSCALL_READDISKFILE:
+        return p->syscall_readdiskfile(&regs);
+    case SYSCALL_SYNC:
+        return p->syscall_sync(&regs);
+    default:
+        return E_NOSYS;
+    }
+}
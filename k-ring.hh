@@ -0,0 +1,88 @@
+#ifndef CHICKADEE_K_RING_HH
+#define CHICKADEE_K_RING_HH
+#include "kernel.hh"
+#include "k-chkfs.hh"
+
+// k-ring.hh
+//    Submission/completion rings for batched system calls.
+//
+//    The ring's memory is shared with the process, which may change it at
+//    any time, so the kernel keeps its own copies of the ring geometry and
+//    of the indexes it owns (`sq_head` and `cq_tail`), and copies each
+//    submission before checking it.
+//
+//    `SYSCALL_READDISKFILE` submissions run asynchronously: `submit`
+//    starts disk reads for the blocks they need (`bufcache::load_async`)
+//    and parks them as pending reads; `reap` runs each one, copying from
+//    the now-cached blocks, once its reads complete. So many disk reads
+//    can be in flight, and completions may be posted out of order.
+
+struct ringstate {
+    // a `SYSCALL_READDISKFILE` submission waiting for its disk reads
+    struct pending_read {
+        ring_sqe sqe_;
+        bcref blocks_[2];          // blocks being read for it
+        unsigned nblocks_ = 0;
+    };
+    static constexpr unsigned max_pending = 8;
+    // blocks held by pending reads; leaves room in the buffer cache
+    // for everyone else
+    static constexpr unsigned max_held = bufcache::nslots / 2;
+
+    ring_header* hdr_;             // kernel address of shared ring
+    ring_sqe* sq_;
+    ring_cqe* cq_;
+    unsigned nentries_;
+    uint32_t sq_head_ = 0;         // next submission to consume
+    uint32_t cq_tail_ = 0;         // next completion to post
+    pending_read pending_[max_pending]; // oldest first
+    std::atomic<unsigned> npending_ = 0;
+    unsigned nheld_ = 0;
+    proc* poller_ = nullptr;       // polling kernel task, if any
+    wait_queue poll_wq_;           // poller sleeps here when idle
+    wait_queue cq_wq_;             // `sys_ring_enter` waits here for poller
+    std::atomic<bool> stopping_ = false;
+
+    // Consume up to `max` submissions as proc `p`, starting disk reads
+    // for `SYSCALL_READDISKFILE` and executing other operations. Returns
+    // the number consumed. Only one task at a time may call this.
+    unsigned submit(proc* p, unsigned max);
+
+    // Post completions for pending reads whose blocks have arrived. If
+    // `wait` and none had, first block until the oldest one's next block
+    // arrives. Returns the number posted. Same task as `submit`.
+    unsigned reap(proc* p, bool wait);
+
+    // Return the number of completions the process hasn't consumed.
+    inline unsigned ncompleted() const;
+
+    // Return true if the ring has no submissions left to consume and no
+    // pending reads. Callable from any task.
+    inline bool idle() const;
+
+    // Release the ring when its thread exits. Stops the poller, which
+    // frees the `ringstate` itself; the ring's pages stay mapped.
+    void stop();
+
+    // Drop pending reads without completing them.
+    void discard();
+
+  private:
+    bool start_read(proc* p, const ring_sqe& sqe);
+    void post(const ring_sqe& sqe, uintptr_t result);
+    uintptr_t execute(proc* p, const ring_sqe& sqe);
+};
+
+
+inline unsigned ringstate::ncompleted() const {
+    return __atomic_load_n(&cq_tail_, __ATOMIC_ACQUIRE)
+        - __atomic_load_n(&hdr_->cq_head, __ATOMIC_ACQUIRE);
+}
+
+inline bool ringstate::idle() const {
+    return npending_ == 0
+        && __atomic_load_n(&hdr_->sq_tail, __ATOMIC_ACQUIRE)
+           == __atomic_load_n(&sq_head_, __ATOMIC_ACQUIRE);
+}
+
+#endif
@@ -0,0 +1,374 @@
+#include "k-swap.hh"
+#include "k-ahci.hh"
+#include "k-chkfs.hh"
+#include "k-tlb.hh"
+#include "k-vmiter.hh"
+
+swapstate swapstate::ss;
+
+swapstate::swapstate() {
+}
+
+static uint64_t swap_slotmap[swapstate::max_slots / 64];
+
+static inline std::atomic_ref<x86_64_pageentry_t> pte_ref(x86_64_pageentry_t* pte) {
+    return std::atomic_ref<x86_64_pageentry_t>(*pte);
+}
+
+
+// kalloc_reclaim(sz, flags)
+//    Allocate memory like `kalloc`, reclaiming pages if memory is
+//    exhausted. Reclaim frees a full batch at a time so that swap writes
+//    are amortized. Only single-page requests benefit from reclaim, since
+//    reclaimed pages are not physically contiguous.
+
+void* kalloc_reclaim(size_t sz, int flags) {
+    while (true) {
+        if (void* ptr = kalloc(sz, flags)) {
+            return ptr;
+        }
+        if (sz > PAGESIZE
+            || swapstate::get().reclaim(swapstate::batch_size) == 0) {
+            return nullptr;
+        }
+    }
+}
+
+
+// swapstate::init()
+//    Allocate `pages_`. Its size depends on the amount of installed memory,
+//    so it can't be a fixed-size array.
+
+void swapstate::init() {
+    assert(!pages_);
+    pages_ = knew_array<swappage>(memsize_physical / PAGESIZE);
+    assert(pages_);
+}
+
+
+// swapstate::track(p, va, pa)
+//    Start tracking physical page `pa`, which is mapped at `va` in `p`,
+//    as a reclaim candidate. Callers that unmap and free a tracked page
+//    should call `untrack(pa)` first.
+
+void swapstate::track(proc* p, uintptr_t va, uintptr_t pa) {
+    assert(pa < memsize_physical && (va & PAGEOFFMASK) == 0);
+    spinlock_guard guard(lock_);
+    swappage* sp = &pages_[pa / PAGESIZE];
+    if (sp->link_.is_linked()) {
+        (sp->active_ ? nactive_ : ninactive_) -= 1;
+        sp->link_.erase();
+    }
+    // a thread's `proc` may be freed before its process's, so record the
+    // thread group leader
+    sp->owner_ = p->leader_;
+    sp->va_ = va;
+    sp->active_ = true;
+    active_.push_back(sp);
+    ++nactive_;
+}
+
+
+// swapstate::untrack(pa)
+//    Stop tracking physical page `pa`.
+
+void swapstate::untrack(uintptr_t pa) {
+    assert(pa < memsize_physical);
+    spinlock_guard guard(lock_);
+    swappage* sp = &pages_[pa / PAGESIZE];
+    if (sp->link_.is_linked()) {
+        (sp->active_ ? nactive_ : ninactive_) -= 1;
+        sp->link_.erase();
+    }
+    sp->owner_ = nullptr;
+}
+
+
+// swapstate::reclaim(npages)
+//    Free at least `npages` pages if possible. Clean buffer cache blocks
+//    are cheapest to drop, so they go first.
+
+size_t swapstate::reclaim(size_t npages) {
+    assert(this_cpu()->spinlock_depth_ == 0);
+    sti();
+
+    size_t nfreed = bufcache::get().reclaim(npages);
+    if (nfreed < npages && init_swap_area()) {
+        nfreed += swap_out(npages - nfreed);
+    }
+    if (nfreed == 0) {
+        log_printf("reclaim: no reclaimable memory\n");
+    }
+    return nfreed;
+}
+
+
+// swapstate::init_swap_area()
+//    Read the swap area location from the superblock. Returns true iff
+//    swap space is available. The superblock is read directly into a
+//    static buffer, since this runs when memory is exhausted.
+
+bool swapstate::init_swap_area() {
+    static std::atomic_flag reading;
+    static unsigned char sbbuf[ahcistate::sectorsize];
+    static_assert(chkfs::blocksize == PAGESIZE);
+    static_assert(chkfs::superblock_offset % ahcistate::sectorsize == 0);
+
+    if (initialized_.load(std::memory_order_acquire)) {
+        return nswap_ > 0;
+    }
+    // only one task reads the superblock; others cannot reclaim yet
+    if (!sata_disk || reading.test_and_set()) {
+        return false;
+    }
+
+    int r = sata_disk->read(sbbuf, sizeof(sbbuf), chkfs::superblock_offset);
+    auto& sb = *reinterpret_cast<chkfs::superblock*>(sbbuf);
+
+    spinlock_guard guard(lock_);
+    if (r == 0 && sb.magic == chkfs::magic && sb.nswap > 0) {
+        swap_bn_ = sb.swap_bn;
+        nswap_ = min(size_t(sb.nswap), max_slots);
+        slotmap_ = swap_slotmap;
+        log_printf("swap: %u slots at block %u\n", nswap_, swap_bn_);
+    }
+    initialized_.store(true, std::memory_order_release);
+    return nswap_ > 0;
+}
+
+
+// swapstate::allocate_slots(n, first)
+//    Allocate a run of at most `n` contiguous swap slots. Sets `*first`
+//    to the first slot and returns the number allocated (0 if swap is
+//    full). `lock_` must be held.
+
+size_t swapstate::allocate_slots(size_t n, blocknum_t* first) {
+    bitset_view slots(slotmap_, nswap_);
+    size_t i = slots.find_lsz(0);
+    if (i == nswap_) {
+        return 0;
+    }
+    size_t end = slots.find_lsb(i, n);
+    for (size_t j = i; j != end; ++j) {
+        slots[j] = true;
+    }
+    nslots_used_ += end - i;
+    *first = i;
+    return end - i;
+}
+
+void swapstate::free_slots(blocknum_t first, size_t n) {
+    bitset_view slots(slotmap_, nswap_);
+    for (size_t j = first; j != first + n; ++j) {
+        assert(slots[j]);
+        slots[j] = false;
+    }
+    nslots_used_ -= n;
+}
+
+
+// swapstate::age_active(n)
+//    Move up to `n` pages from the front of the active list to the back
+//    of the inactive list, clearing their accessed bits so that a later
+//    access gives them a second chance. `lock_` must be held.
+
+void swapstate::age_active(size_t n) {
+    while (n > 0 && !active_.empty()) {
+        swappage* sp = active_.pop_front();
+        --nactive_;
+        if (auto pte = vmiter(sp->owner_, sp->va_).pte()) {
+            pte_ref(pte).fetch_and(~PTE_A);
+        }
+        sp->active_ = false;
+        inactive_.push_back(sp);
+        ++ninactive_;
+        --n;
+    }
+}
+
+
+// swapstate::swap_out(npages)
+//    Write up to `npages` inactive user pages to swap, in batches of at
+//    most `batch_size` pages per disk command, and free them. Returns the
+//    number of pages freed.
+
+size_t swapstate::swap_out(size_t npages) {
+    size_t nfreed = 0;
+    while (nfreed < npages) {
+        swappage* victims[batch_size];
+        uintptr_t victim_pa[batch_size];
+        x86_64_pageentry_t old_pe[batch_size];
+        void* bufs[batch_size];
+
+        auto irqs = lock_.lock();
+
+        // one batch at a time; faults on in-flight slots wait for it
+        waiter().wait_until(io_wq_, [&] () {
+                return writing_count_ == 0;
+            }, lock_, irqs);
+
+        // choose victims: unaccessed pages from the inactive list
+        size_t nv = 0;
+        size_t nscan = nactive_ + ninactive_;
+        while (nv < min(batch_size, npages - nfreed) && nscan > 0) {
+            --nscan;
+            if (ninactive_ < batch_size) {
+                age_active(batch_size);
+            }
+            swappage* sp = inactive_.pop_front();
+            if (!sp) {
+                break;
+            }
+            --ninactive_;
+            uintptr_t pa = (sp - pages_) * PAGESIZE;
+            auto pte = vmiter(sp->owner_, sp->va_).pte();
+            if (!pte || (*pte & (PTE_P | PTE_PS | PTE_PAMASK)) != (pa | PTE_P)) {
+                // stale: mapping changed since tracking began
+                sp->owner_ = nullptr;
+            } else if (*pte & PTE_A) {
+                // recently used: second chance
+                pte_ref(pte).fetch_and(~PTE_A);
+                sp->active_ = true;
+                active_.push_back(sp);
+                ++nactive_;
+            } else {
+                victims[nv] = sp;
+                victim_pa[nv] = pa;
+                ++nv;
+            }
+        }
+
+        // allocate contiguous swap slots and return excess victims
+        blocknum_t first = 0;
+        size_t nslots = nv ? allocate_slots(nv, &first) : 0;
+        while (nv > nslots) {
+            --nv;
+            victims[nv]->active_ = false;
+            inactive_.push_front(victims[nv]);
+            ++ninactive_;
+        }
+        if (nv == 0) {
+            lock_.unlock(irqs);
+            break;
+        }
+        writing_slot_ = first;
+        writing_count_ = nv;
+        lock_.unlock(irqs);
+
+        // replace mappings with swap entries, then shoot down cached
+        // translations so no CPU can modify a page after it's written
+        tlb_batch tlbs;
+        for (size_t i = 0; i != nv; ++i) {
+            proc* owner = victims[i]->owner_;
+            uintptr_t va = victims[i]->va_;
+            auto pte = vmiter(owner, va).pte();
+            x86_64_pageentry_t pe = *pte;
+            x86_64_pageentry_t swappe = (uint64_t(first + i) << PAGEOFFBITS)
+                | PTE_SWAP | (pe & (PTE_W | PTE_U));
+            old_pe[i] = 0;
+            if ((pe & (PTE_P | PTE_PS | PTE_PAMASK)) == (victim_pa[i] | PTE_P)
+                && pte_ref(pte).compare_exchange_strong(pe, swappe)) {
+                if (futex_has_waiters(victim_pa[i])) {
+                    // checked after the unmap, so a waiter that
+                    // enqueues later sees the swap entry and retries
+                    pte_ref(pte).store(pe);
+                } else {
+                    old_pe[i] = pe;
+                    tlbs.add(owner->pagetable_, va);
+                }
+            }
+            bufs[i] = pa2kptr<void*>(victim_pa[i]);
+        }
+        tlbs.flush();
+
+        // write the batch with one command
+        int r = sata_disk->read_or_write(ahcistate::cmd_write_fpdma_queued,
+                                         bufs, nv, PAGESIZE,
+                                         (swap_bn_ + first) * chkfs::blocksize);
+
+        irqs = lock_.lock();
+        size_t nbatch = 0;
+        for (size_t i = 0; i != nv; ++i) {
+            swappage* sp = victims[i];
+            if (r == 0 && old_pe[i]) {
+                sp->owner_ = nullptr;
+                victim_pa[nbatch] = victim_pa[i];
+                ++nbatch;
+                ++nswapout_;
+                continue;
+            }
+            if (old_pe[i]) {
+                // write failed: restore the mapping
+                pte_ref(vmiter(sp->owner_, sp->va_).pte()).store(old_pe[i]);
+            }
+            free_slots(first + i, 1);
+            sp->active_ = true;
+            active_.push_back(sp);
+            ++nactive_;
+        }
+        writing_count_ = 0;
+        lock_.unlock(irqs);
+        io_wq_.notify_all();
+
+        for (size_t i = 0; i != nbatch; ++i) {
+            kfree(pa2kptr<void*>(victim_pa[i]));
+        }
+        nfreed += nbatch;
+        if (r != 0) {
+            log_printf("swap: write error %d\n", r);
+            break;
+        }
+    }
+    return nfreed;
+}
+
+
+// swapstate::swap_in(p, va)
+//    Read the swapped-out page at `va` in `p` back into memory.
+
+int swapstate::swap_in(proc* p, uintptr_t va) {
+    va = round_down(va, PAGESIZE);
+    sti();
+
+    // wait until the page's slot is not being written
+    x86_64_pageentry_t pe = 0;
+    auto irqs = lock_.lock();
+    waiter().wait_until(io_wq_, [&] () {
+            auto pte = vmiter(p, va).pte();
+            pe = pte ? *pte : 0;
+            blocknum_t slot = (pe & PTE_PAMASK) >> PAGEOFFBITS;
+            return !pte_is_swap(pe) || slot - writing_slot_ >= writing_count_;
+        }, lock_, irqs);
+    lock_.unlock(irqs);
+
+    if (!pte_is_swap(pe)) {
+        return pe & PTE_P ? 0 : E_FAULT;
+    }
+    blocknum_t slot = (pe & PTE_PAMASK) >> PAGEOFFBITS;
+    assert(slot < nswap_);
+
+    void* pg = kalloc_reclaim(PAGESIZE);
+    if (!pg) {
+        return E_NOMEM;
+    }
+    int r = sata_disk->read(pg, PAGESIZE, (swap_bn_ + slot) * chkfs::blocksize);
+    if (r != 0) {
+        kfree(pg);
+        return r;
+    }
+
+    // install the page unless a concurrent fault already did
+    auto pte = vmiter(p, va).pte();
+    x86_64_pageentry_t newpe = ka2pa(pg) | PTE_P | (pe & (PTE_W | PTE_U));
+    if (!pte_ref(pte).compare_exchange_strong(pe, newpe)) {
+        kfree(pg);
+        return 0;
+    }
+
+    irqs = lock_.lock();
+    free_slots(slot, 1);
+    ++nswapin_;
+    lock_.unlock(irqs);
+    track(p, va, ka2pa(pg));
+    return 0;
+}
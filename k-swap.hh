@@ -0,0 +1,105 @@
+#ifndef CHICKADEE_K_SWAP_HH
+#define CHICKADEE_K_SWAP_HH
+#include "kernel.hh"
+#include "chickadeefs.hh"
+#include "k-lock.hh"
+#include "k-wait.hh"
+
+// k-swap.hh
+//    Page reclaim and swap space.
+//
+//    Anonymous user pages are tracked on two lists. New pages start on the
+//    active list. Reclaim ages the active list into the inactive list,
+//    clearing accessed bits (`PTE_A`) as it goes; inactive pages that are
+//    still unaccessed when they reach the front of the inactive list are
+//    written to the chkfs swap area and freed.
+//
+//    A swapped-out page is represented by a non-present page table entry
+//    that has `PTE_SWAP` set. The swap slot number is stored in the entry's
+//    address bits, and the page's original `PTE_W|PTE_U` permissions are
+//    kept in place. Faults on such entries read the page back in.
+
+#define PTE_SWAP        PTE_OS1  // non-present entry refers to a swap slot
+
+inline bool pte_is_swap(x86_64_pageentry_t pe) {
+    return (pe & (PTE_P | PTE_SWAP)) == PTE_SWAP;
+}
+
+
+// swappage: reclaim state for one physical page
+struct swappage {
+    proc* owner_ = nullptr;          // process mapping this page (if tracked)
+    uintptr_t va_ = 0;               // virtual address in `owner_`
+    bool active_ = false;            // true iff on the active list
+    list_links link_;
+};
+
+struct swapstate {
+    using blocknum_t = chkfs::blocknum_t;
+
+    // maximum number of pages written by one AHCI command
+    static constexpr size_t batch_size = 16;
+    // maximum number of swap slots supported (one page of bitmap)
+    static constexpr size_t max_slots = PAGESIZE * 8;
+
+    spinlock lock_;                  // protects all members
+    list<swappage, &swappage::link_> active_;
+    list<swappage, &swappage::link_> inactive_;
+    size_t nactive_ = 0;
+    size_t ninactive_ = 0;
+    swappage* pages_ = nullptr;      // one per physical page
+
+    std::atomic<bool> initialized_ = false;
+    blocknum_t swap_bn_ = 0;         // first swap block
+    blocknum_t nswap_ = 0;           // # swap slots (0 means no swap)
+    uint64_t* slotmap_ = nullptr;    // 1 bit per slot; 1 means in use
+    size_t nslots_used_ = 0;
+
+    wait_queue io_wq_;               // woken when a swap write completes
+    blocknum_t writing_slot_ = 0;    // slots [writing_slot_,
+    size_t writing_count_ = 0;       //   writing_slot_ + writing_count_)
+                                     //   are being written
+
+    size_t nswapout_ = 0;            // statistics
+    size_t nswapin_ = 0;
+
+
+    static inline swapstate& get();
+
+    // allocate per-page state for installed memory. Called once at boot.
+    void init();
+
+    // start tracking `pa`, newly mapped at `va` in `p`, as reclaimable
+    void track(proc* p, uintptr_t va, uintptr_t pa);
+    // stop tracking `pa` (does nothing if `pa` isn't tracked)
+    void untrack(uintptr_t pa);
+
+    // free at least `npages` pages if possible, first by dropping clean
+    // buffer cache blocks and then by swapping out user pages; returns
+    // the number of pages freed. Blocks; enables interrupts.
+    size_t reclaim(size_t npages);
+
+    // read the swapped-out page at `va` in `p` back into memory.
+    // Returns 0 on success (including if the page is already present)
+    // and `E_FAULT` if `va` is not swapped out. Blocks; enables interrupts.
+    int swap_in(proc* p, uintptr_t va);
+
+  private:
+    static swapstate ss;
+
+    swapstate();
+    NO_COPY_OR_ASSIGN(swapstate);
+
+    bool init_swap_area();
+    size_t allocate_slots(size_t n, blocknum_t* first);
+    void free_slots(blocknum_t first, size_t n);
+    void age_active(size_t n);
+    size_t swap_out(size_t npages);
+};
+
+
+inline swapstate& swapstate::get() {
+    return ss;
+}
+
+#endif
@@ -7,6 +7,7 @@
 #define WQTEST3_NOP 300
 #define WQTEST4_NOP 100
 #define WQTEST5_NOP 1000
+#define WQTEST6_NOP 100
 
 static std::atomic<int> phase;
 static std::atomic<unsigned> n;
@@ -18,6 +19,7 @@ static bool wqdata_flag;
 static proc* wqt_proc[WQTEST_NPROC];
 static std::atomic<unsigned>* wqt_idn[WQTEST_NPROC];
 static unsigned long start_ticks;
+static std::atomic<unsigned> nready, nwoken, round6;
 
 namespace {
 struct wq_reporter {
@@ -277,6 +279,59 @@ static void wq_tester() {
         }
     }
 
+    if (id == 0) {
+        phase = 500;
+    }
+    while (phase < 500) {
+        p->yield();
+    }
+
+    // Sixth test phase: exclusive and keyed wakeups. Tasks 1-3 wait
+    // exclusively with key 1; task 4 waits non-exclusively with key 2.
+    if (id == 0) {
+        start_ticks = ticks;
+        console_printf("ktestwait phase 6 commencing\n");
+        wq_reporter wqr("phase 6", WQTEST6_NOP, 25);
+        auto wait_woken = [&] (unsigned want) {
+            while (nwoken < want) {
+                p->yield();
+                wqr.check(round6);
+            }
+        };
+        for (unsigned i = 0; i != WQTEST6_NOP; ++i) {
+            while (nready < WQTEST_NPROC - 1) {
+                p->yield();
+                wqr.check(round6);
+            }
+            // no waiter has key 3
+            assert_eq(wq.notify_key(3), 0U);
+            // key 1, at most one exclusive waiter: task 4 stays asleep
+            assert_eq(wq.notify_key(1, 1), 1U);
+            wait_woken(1);
+            // any key: the non-exclusive waiter and exactly one exclusive
+            assert_eq(wq.notify_one(), 2U);
+            wait_woken(3);
+            assert_eq(nwoken.load(), 3U);
+            // only one exclusive waiter is left
+            assert_eq(wq.notify_n(5), 1U);
+            wait_woken(4);
+            assert_eq(wq.notify_n(1), 0U);
+            nready = nwoken = 0;
+            ++round6;
+        }
+    } else {
+        for (unsigned i = 0; i != WQTEST6_NOP; ++i) {
+            waiter w(id == 4 ? 2 : 1, id != 4);
+            w.prepare(wq);
+            ++nready;
+            w.maybe_block();
+            ++nwoken;
+            while (round6 == i) {
+                p->yield();
+            }
+        }
+    }
+
     // That completes the test
     if (id == 0) {
         phase = 1000;
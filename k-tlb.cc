@@ -0,0 +1,179 @@
+#include "k-tlb.hh"
+#include "k-apic.hh"
+
+// k-tlb.cc
+//
+//    PCID management and TLB shootdown. See k-tlb.hh.
+
+
+// cpustate::init_tlb()
+//    Initialize this CPU's PCID cache, enabling PCIDs if the processor
+//    supports them. Called while the early page table (PCID 0) is loaded.
+
+void cpustate::init_tlb() {
+    for (auto& pt : pcid_pagetable_) {
+        pt.store(nullptr);
+    }
+    pcid_active_ = -1;
+    pcid_next_ = 0;
+    tlb_request_ = nullptr;
+    tlb_requesters_ = 0;
+
+    npcid_ = 1;
+    if (cpuid(1).ecx & (1U << 17)) {
+        assert((rdcr3() & CR3_PCIDMASK) == 0);
+        wrcr4(rdcr4() | CR4_PCIDE);
+        npcid_ = npcid;
+    }
+}
+
+
+// cpustate::load_pagetable(pt, pa)
+//    Install page table `pt`, whose physical address is `pa`, in `%cr3`.
+//    Called by `set_pagetable` with interrupts disabled.
+//
+//    If `pt` is in the PCID cache, its TLB entries are still valid (any
+//    invalidations were applied or evicted the cache entry), so the load
+//    keeps them. Otherwise `pt` replaces the least recently added entry,
+//    and the load flushes that PCID.
+
+void cpustate::load_pagetable(x86_64_pagetable* pt, uintptr_t pa) {
+    assert(is_cli());
+    unsigned slot = 0;
+    while (slot != npcid_ && pcid_pagetable_[slot].load() != pt) {
+        ++slot;
+    }
+
+    uint64_t cr3 = pa;
+    if (slot != npcid_) {
+        if (int(slot) == pcid_active_) {
+            return;
+        }
+        // only reachable with PCIDs: without them, the only cache entry
+        // is the active one
+        cr3 |= (slot + 1) | CR3_NOFLUSH;
+    } else {
+        slot = pcid_next_;
+        pcid_next_ = (slot + 1) % npcid_;
+        // A shootdown that modifies `pt` after this store will target
+        // this CPU. One that modified it before will be visible to the
+        // page walks after the flushing `%cr3` load.
+        pcid_pagetable_[slot].store(pt);
+        if (npcid_ > 1) {
+            cr3 |= slot + 1;
+        }
+    }
+    pcid_active_ = slot;
+    wrcr3(cr3);
+}
+
+
+// cpustate::invalidate_tlb(pt, n, va)
+//    Invalidate this CPU's entries for `pt`: the `n` addresses in `va`,
+//    or everything if `n > tlb_batch::capacity`. Interrupts are disabled.
+//    Entries for an inactive PCID are dropped from the PCID cache, so
+//    the next load of `pt` flushes them.
+
+void cpustate::invalidate_tlb(x86_64_pagetable* pt, unsigned n,
+                              const uintptr_t* va) {
+    for (unsigned slot = 0; slot != npcid_; ++slot) {
+        if (pcid_pagetable_[slot].load() != pt) {
+            continue;
+        }
+        if (int(slot) != pcid_active_) {
+            pcid_pagetable_[slot].store(nullptr);
+        } else if (n <= tlb_batch::capacity) {
+            for (unsigned i = 0; i != n; ++i) {
+                invlpg(reinterpret_cast<void*>(va[i]));
+            }
+        } else {
+            // reloading `%cr3` without `CR3_NOFLUSH` flushes this PCID
+            wrcr3(rdcr3());
+        }
+    }
+}
+
+
+// cpustate::handle_tlb_requests()
+//    Apply shootdowns that other CPUs have requested of this CPU.
+//    Called with interrupts disabled.
+
+void cpustate::handle_tlb_requests() {
+    unsigned requesters = tlb_requesters_.exchange(0);
+    while (requesters) {
+        int i = lsb(requesters) - 1;
+        requesters &= requesters - 1;
+        tlb_batch* b = cpus[i].tlb_request_;
+        invalidate_tlb(b->pt_, b->n_, b->va_);
+        // after this decrement, `b` may go out of scope
+        b->pending_.fetch_sub(1);
+    }
+}
+
+
+// tlb_batch::add(pt, va)
+//    Add `va` to the batch.
+
+void tlb_batch::add(x86_64_pagetable* pt, uintptr_t va) {
+    if (pt_ != pt) {
+        flush();
+        pt_ = pt;
+    }
+    if (n_ < capacity) {
+        va_[n_] = round_down(va, PAGESIZE);
+    }
+    if (n_ <= capacity) {
+        ++n_;
+    }
+}
+
+// tlb_batch::add_all(pt)
+//    Invalidate all of `pt`.
+
+void tlb_batch::add_all(x86_64_pagetable* pt) {
+    if (pt_ != pt) {
+        flush();
+        pt_ = pt;
+    }
+    n_ = capacity + 1;
+}
+
+
+// tlb_batch::flush()
+//    Apply the batch locally and on every other CPU that caches `pt_`.
+//    Other CPUs receive one `IRQ_TLB_SHOOTDOWN` interrupt each. While
+//    waiting for them, we handle their requests of us, so concurrent
+//    shootdowns can't deadlock.
+
+void tlb_batch::flush() {
+    if (n_ == 0) {
+        return;
+    }
+
+    auto irqs = irqstate::get();
+    cli();
+    cpustate* c = this_cpu();
+    c->invalidate_tlb(pt_, n_, va_);
+
+    // page table changes must be visible before we check other CPUs'
+    // PCID caches
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    c->tlb_request_ = this;
+    auto& lapic = lapicstate::get();
+    for (int i = 0; i != ncpu; ++i) {
+        if (&cpus[i] != c && cpus[i].caches_pagetable(pt_)) {
+            pending_.fetch_add(1);
+            cpus[i].tlb_requesters_.fetch_or(1U << c->cpuindex_);
+            lapic.ipi(cpus[i].lapic_id_, INT_IRQ + IRQ_TLB_SHOOTDOWN);
+        }
+    }
+    while (pending_.load() != 0) {
+        c->handle_tlb_requests();
+        pause();
+    }
+    c->tlb_request_ = nullptr;
+    irqs.restore();
+
+    pt_ = nullptr;
+    n_ = 0;
+}
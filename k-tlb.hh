@@ -0,0 +1,60 @@
+#ifndef CHICKADEE_K_TLB_HH
+#define CHICKADEE_K_TLB_HH
+#include "kernel.hh"
+
+// k-tlb.hh
+//    Address-space identifiers and TLB shootdown.
+//
+//    When the processor supports PCIDs, each CPU caches up to
+//    `cpustate::npcid` recently-used page tables, each tagged with its own
+//    PCID, so switching back to a recently-run address space keeps its TLB
+//    entries. A CPU that has a page table in its PCID cache may hold
+//    translations for it. (Without PCIDs, the cache has one entry: the
+//    loaded page table.)
+//
+//    Code that removes or downgrades a mapping must invalidate those
+//    translations. `tlb_batch` collects invalidations and then sends one
+//    interrupt to each CPU that may cache the address space.
+
+
+struct tlb_batch {
+    // maximum number of addresses invalidated individually; larger
+    // batches flush the whole address space
+    static constexpr unsigned capacity = 16;
+
+    inline tlb_batch();
+    inline ~tlb_batch();
+    NO_COPY_OR_ASSIGN(tlb_batch);
+
+    // add `va` in page table `pt` to the batch. Flushes the batch first
+    // if it has entries for a different page table.
+    void add(x86_64_pagetable* pt, uintptr_t va);
+    // invalidate all of `pt` (e.g., before freeing it)
+    void add_all(x86_64_pagetable* pt);
+
+    // invalidate the batch's addresses on every CPU, waiting for other
+    // CPUs to finish. Enables interrupts only if they were enabled. Should
+    // not be called with spinlocks held, since a target CPU might be
+    // waiting for such a lock with interrupts disabled.
+    void flush();
+
+  private:
+    x86_64_pagetable* pt_;
+    unsigned n_;                     // `capacity + 1` means everything
+    uintptr_t va_[capacity];
+
+    std::atomic<unsigned> pending_;  // # CPUs yet to apply a flush
+
+    friend struct cpustate;
+};
+
+
+inline tlb_batch::tlb_batch()
+    : pt_(nullptr), n_(0), pending_(0) {
+}
+
+inline tlb_batch::~tlb_batch() {
+    flush();
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "kernel.hh"
+
+// k-trace.cc
+//
+//    Kernel tracing. Each CPU records fixed-size binary events, stamped
+//    with `rdtsc()`, in its own ring buffer. The recording CPU is the only
+//    producer and records with interrupts disabled, so recording takes no
+//    locks. Idle tasks drain the buffers to `log.txt` in the text format
+//    described in trace.hh; `build/tracedecode.cc` turns that back into a
+//    timeline. Events that arrive while a buffer is full are counted and
+//    dropped.
+//
+//    Tracing is compiled in only when building with `make TRACE=1`.
+
+#if CHICKADEE_TRACE
+
+namespace {
+
+struct trace_event {
+    uint64_t tsc;
+    uint32_t type;
+    pid_t tid;
+    uint64_t arg0;
+    uint64_t arg1;
+};
+
+struct tracebuf {
+    static constexpr unsigned capacity = 1024;   // must be a power of 2
+
+    std::atomic<unsigned> head_ = 0;             // next event to drain
+    std::atomic<unsigned> tail_ = 0;             // next event to record
+    std::atomic<unsigned long> ndropped_ = 0;
+    trace_event ev_[capacity];
+};
+
+tracebuf tracebufs[MAXCPU];
+std::atomic_flag trace_drain_lock;
+
+}
+
+
+// trace(type, arg0, arg1)
+//    Record an event in this CPU's trace buffer.
+
+void trace(trace_type type, uint64_t arg0, uint64_t arg1) {
+    auto irqs = irqstate::get();
+    cli();
+    cpustate* c = this_cpu();
+    tracebuf& tb = tracebufs[c->cpuindex_];
+    unsigned tail = tb.tail_.load(std::memory_order_relaxed);
+    if (tail - tb.head_.load(std::memory_order_acquire) == tb.capacity) {
+        tb.ndropped_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        trace_event& e = tb.ev_[tail % tb.capacity];
+        e.tsc = rdtsc();
+        e.type = type;
+        e.tid = c->current_ ? c->current_->id_ : 0;
+        e.arg0 = arg0;
+        e.arg1 = arg1;
+        // publish the event to the drainer
+        tb.tail_.store(tail + 1, std::memory_order_release);
+    }
+    irqs.restore();
+}
+
+
+// trace_drain()
+//    Print all recorded events to the log. Called by idle tasks. Only
+//    one CPU drains at a time; others return immediately.
+
+void trace_drain() {
+    if (trace_drain_lock.test_and_set()) {
+        return;
+    }
+    bool clocked = false;
+    for (int cpu = 0; cpu != ncpu; ++cpu) {
+        tracebuf& tb = tracebufs[cpu];
+        unsigned head = tb.head_.load(std::memory_order_relaxed);
+        while (head != tb.tail_.load(std::memory_order_acquire)) {
+            if (!clocked) {
+                log_format(TRACE_CLOCK_FORMAT, HZ, ticks.load(), rdtsc());
+                clocked = true;
+            }
+            // copy the event, then free its slot before the slow print
+            trace_event e = tb.ev_[head % tb.capacity];
+            ++head;
+            tb.head_.store(head, std::memory_order_release);
+            log_reserve(128);
+            log_format(TRACE_EVENT_FORMAT, cpu, e.tsc, e.type, e.tid,
+                       e.arg0, e.arg1);
+        }
+        if (unsigned long n = tb.ndropped_.exchange(0)) {
+            log_format(TRACE_DROP_FORMAT, cpu, n);
+        }
+    }
+    trace_drain_lock.clear();
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "kernel.hh"
+
+// k-usage.cc
+//
+//    Resource accounting. Every task and every CPU has a `usage_counters`.
+//    Event counts are bumped with `usage_add` where the events happen.
+//    CPU time is charged from the TSC at a few points: kernel entry from
+//    user mode charges user time, and the return to user mode and
+//    context switches charge kernel time (or idle time, for idle tasks).
+//
+//    A context switch away from a task that is still runnable (preempted,
+//    or called `sys_yield`) is involuntary; a switch away from a task that
+//    blocked is voluntary.
+
+
+usage_counters& usage_counters::operator+=(const usage_counters& x) {
+    utime += x.utime;
+    stime += x.stime;
+    idletime += x.idletime;
+    nvcsw += x.nvcsw;
+    nivcsw += x.nivcsw;
+    npagefaults += x.npagefaults;
+    nread += x.nread;
+    nwritten += x.nwritten;
+    ndiskio += x.ndiskio;
+    nbufcache_hits += x.nbufcache_hits;
+    nbufcache_misses += x.nbufcache_misses;
+    return *this;
+}
+
+
+// cpustate::account_switch(prev, next)
+//    Called with interrupts disabled when this CPU switches from `prev`
+//    (nullptr if it has exited) to `next`. `prev` isn't running, so its
+//    counters can be updated directly.
+
+void cpustate::account_switch(proc* prev, proc* next) {
+    uint64_t now = rdtsc();
+    if (prev) {
+        uint64_t delta = now - prev->usage_tsc_;
+        if (prev == idle_task_) {
+            prev->usage_.idletime += delta;
+            usage_.idletime += delta;
+        } else {
+            prev->usage_.stime += delta;
+            usage_.stime += delta;
+        }
+        if (prev != next && prev != idle_task_) {
+            auto csw = prev->pstate_ == proc::ps_runnable
+                ? &usage_counters::nivcsw : &usage_counters::nvcsw;
+            ++(prev->usage_.*csw);
+            ++(usage_.*csw);
+        }
+    }
+    next->usage_tsc_ = now;
+}
+
+
+// proc::syscall_getusage(regs)
+//    Handle `sys_getusage(u, who)`. Counters of running tasks on other
+//    CPUs may be slightly stale.
+
+uintptr_t proc::syscall_getusage(regstate* regs) {
+    uintptr_t addr = regs->reg_rdi;
+    pid_t who = regs->reg_rsi;
+
+    // bring our own time up to date
+    usage_charge(&usage_counters::stime);
+
+    usage_counters c = {};
+    if (who == USAGE_THREAD) {
+        c = usage_;
+    } else if (who == USAGE_SYSTEM) {
+        for (int i = 0; i != ncpu; ++i) {
+            c += cpus[i].usage_;
+        }
+    } else if (who <= USAGE_CPU(0)) {
+        if (who < USAGE_CPU(ncpu - 1)) {
+            return E_INVAL;
+        }
+        c = cpus[USAGE_CPU(0) - who].usage_;
+    } else if (who < 0) {
+        return E_INVAL;
+    } else {
+        pid_t pid = who == USAGE_SELF ? pid_ : who;
+        spinlock_guard guard(ptable_lock);
+        proc* leader = ptable[pid];
+        if (!leader || leader->leader_ != leader) {
+            return E_SRCH;
+        } else if (pid != pid_ && leader->ppid_ != pid_) {
+            return E_CHILD;
+        }
+        c = leader->exited_usage_;
+        for (pid_t id = ptable.next(1); id != NPROC;
+             id = ptable.next(id + 1)) {
+            proc* t = ptable[id];
+            if (t->leader_ == leader) {
+                c += t->usage_;
+            }
+        }
+    }
+
+    usage u;
+    u.time = ticks.load(std::memory_order_relaxed);
+    kalloc_page_counts(&u.free_pages, &u.allocated_pages);
+    u.utime_cycles = c.utime;
+    u.stime_cycles = c.stime;
+    u.idle_cycles = c.idletime;
+    u.nvcsw = c.nvcsw;
+    u.nivcsw = c.nivcsw;
+    u.npagefaults = c.npagefaults;
+    u.nread = c.nread;
+    u.nwritten = c.nwritten;
+    u.ndiskio = c.ndiskio;
+    u.nbufcache_hits = c.nbufcache_hits;
+    u.nbufcache_misses = c.nbufcache_misses;
+    return copy_to_user(addr, &u, sizeof(u));
+}
@@ -10,7 +10,9 @@ void vmiter::down() {
         x86_64_pagetable* pt = pa2kptr<x86_64_pagetable*>(pa);
         pep_ = &pt->entry[(va_ >> lbits_) & 0x1FF];
     }
-    if ((*pep_ & PTE_PAMASK) >= 0x100000000UL
+    // entries past the end of RAM (and the 4GiB of MMIO space below it)
+    // are probably garbage
+    if ((*pep_ & PTE_PAMASK) >= max(memsize_physical, 0x100000000UL)
         && lbits_ < PAGEOFFBITS + 2 * PAGEINDEXBITS) {
         panic("Page table %p may contain uninitialized memory!\n"
               "(Page table contents: %p)\n", pt_, *pep_);
@@ -48,16 +50,20 @@ void vmiter::next() {
     find_impl((va_ | lbits_mask(lbits)) + 1, true);
 }
 
-int vmiter::try_map(uintptr_t pa, int perm) {
+int vmiter::try_map(uintptr_t pa, int perm, size_t pgsize) {
+    assert(pgsize == PAGESIZE || pgsize == HUGEPAGESIZE
+           || pgsize == GIGAPAGESIZE, "vmiter::try_map bad page size");
+    int target_lbits = msb(pgsize) - 1;
     if (pa == (uintptr_t) -1 && perm == 0) {
         pa = 0;
     }
-    // virtual address is page-aligned
-    assert((va_ % PAGESIZE) == 0, "vmiter::try_map va not aligned");
+    // virtual address is aligned to the page size
+    assert((va_ % pgsize) == 0, "vmiter::try_map va not aligned");
     if (perm & PTE_P) {
-        // if mapping present, physical address is page-aligned
+        // if mapping present, physical address is aligned to the page size
         assert(pa != (uintptr_t) -1, "vmiter::try_map mapping nonexistent pa");
-        assert((pa & PTE_PAMASK) == pa, "vmiter::try_map pa not aligned");
+        assert((pa & PTE_PAMASK) == pa && (pa % pgsize) == 0,
+               "vmiter::try_map pa not aligned");
     } else {
         assert((pa & PTE_P) == 0, "vmiter::try_map invalid pa");
     }
@@ -65,25 +71,67 @@ int vmiter::try_map(uintptr_t pa, int perm) {
     // imposed by higher-level page tables (`perm_`)
     assert(!(perm & ~perm_ & (PTE_P | PTE_W | PTE_U)));
 
-    while (lbits_ > PAGEOFFBITS && perm) {
+    // a large mapping cannot replace a page table page
+    if (lbits_ < target_lbits) {
+        return E_INVAL;
+    }
+
+    // split any larger mapping that contains this address
+    while (lbits_ > target_lbits && (*pep_ & PTE_P)) {
+        assert(*pep_ & PTE_PS);
+        if (try_split() < 0) {
+            return E_NOMEM;
+        }
+    }
+
+    while (lbits_ > target_lbits && perm) {
         assert(!(*pep_ & PTE_P));
-        x86_64_pagetable* pt = knew<x86_64_pagetable>();
+        auto pt = reinterpret_cast<x86_64_pagetable*>
+            (kalloc(PAGESIZE, KALLOC_ZERO));
         if (!pt) {
-            return -1;
+            return E_NOMEM;
         }
-        memset(pt, 0, PAGESIZE);
         std::atomic_thread_fence(std::memory_order_release);
         *pep_ = ka2pa(pt) | PTE_P | PTE_W | PTE_U;
         down();
     }
 
-    if (lbits_ == PAGEOFFBITS) {
+    if (lbits_ == target_lbits) {
+        if (lbits_ > PAGEOFFBITS && (perm & PTE_P)) {
+            perm |= PTE_PS;
+        }
         std::atomic_thread_fence(std::memory_order_release);
         *pep_ = pa | perm;
     }
     return 0;
 }
 
+int vmiter::try_split() {
+    if (lbits_ == PAGEOFFBITS
+        || (*pep_ & (PTE_P | PTE_PS)) != (PTE_P | PTE_PS)) {
+        return 0;
+    }
+    x86_64_pagetable* pt = knew<x86_64_pagetable>();
+    if (!pt) {
+        return E_NOMEM;
+    }
+    int sub_lbits = lbits_ - PAGEINDEXBITS;
+    uintptr_t pa = *pep_ & PTE_PS_PAMASK;
+    // keep permissions and OS bits; drop the PS-entry PAT bit, and drop
+    // `PTE_PS` itself when splitting into 4KiB pages
+    uint64_t flags = *pep_ & ~PTE_PS_PAMASK & ~PTE_PS_PAT;
+    if (sub_lbits == PAGEOFFBITS) {
+        flags &= ~PTE_PS;
+    }
+    for (uintptr_t i = 0; i != (1U << PAGEINDEXBITS); ++i) {
+        pt->entry[i] = (pa + (i << sub_lbits)) | flags;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    *pep_ = ka2pa(pt) | PTE_P | PTE_W | PTE_U;
+    down();
+    return 0;
+}
+
 
 uint64_t vmiter::range_perm(size_t sz) const {
     uint64_t p = sz > 0 ? perm() : uint64_t(-1);
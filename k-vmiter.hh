@@ -38,6 +38,15 @@ class vmiter {
     // or `nullptr` if `this->va()` is unmapped
     template <typename T = void*>
     inline T kptr() const;
+    // Return the size of the page mapped at `this->va()` (`PAGESIZE`,
+    // `HUGEPAGESIZE`, or `GIGAPAGESIZE`), or 0 if `this->va()` is unmapped
+    inline size_t page_size() const;
+    // Return true iff `this->va()` is mapped by a large (`PTE_PS`) page
+    inline bool huge() const;
+    // Return a pointer to the page table entry that covers `this->va()`,
+    // or `nullptr` if `this->va()` is noncanonical. This is for atomic
+    // updates of existing entries; prefer `map()` for everything else.
+    inline x86_64_pageentry_t* pte() const;
 
     // PERMISSIONS
     // Return permissions at `this->va()` (or 0 if `PTE_P` is not set)
@@ -87,17 +96,36 @@ class vmiter {
     // page table pages. On success, changes the mapping and returns 0.
     // If `kalloc` fails, returns a negative error code without modifying
     // any mappings.
-    [[gnu::warn_unused_result]] int try_map(uintptr_t pa, int perm);
+    //
+    // `pgsize` may be `HUGEPAGESIZE` or `GIGAPAGESIZE` to install a single
+    // large (`PTE_PS`) mapping; then `this->va()` and `pa` must be aligned
+    // to `pgsize`. A large mapping that contains `this->va()` is split as
+    // needed (see `try_split`). Returns `E_INVAL` if a large mapping would
+    // replace an existing page table page.
+    [[gnu::warn_unused_result]] int try_map(uintptr_t pa, int perm,
+                                            size_t pgsize = PAGESIZE);
     // Same, but map a kernel pointer
-    [[gnu::warn_unused_result]] inline int try_map(void* kptr, int perm);
-    [[gnu::warn_unused_result]] inline int try_map(volatile void* kptr, int perm);
+    [[gnu::warn_unused_result]] inline int try_map(void* kptr, int perm,
+                                                   size_t pgsize = PAGESIZE);
+    [[gnu::warn_unused_result]] inline int try_map(volatile void* kptr, int perm,
+                                                   size_t pgsize = PAGESIZE);
 
     // Same, but panics on failure.
-    inline void map(uintptr_t pa, int perm);
-    inline void map(void* kptr, int perm);
-    inline void map(volatile void* kptr, int perm);
+    inline void map(uintptr_t pa, int perm, size_t pgsize = PAGESIZE);
+    inline void map(void* kptr, int perm, size_t pgsize = PAGESIZE);
+    inline void map(volatile void* kptr, int perm, size_t pgsize = PAGESIZE);
 
-    // Free mapped page and clear mapping. Like `kfree(kptr()); map(0, 0)`
+    // If `this->va()` is mapped by a large page, replace that mapping with
+    // a newly-allocated page table of next-smaller mappings that cover the
+    // same physical memory with the same permissions, then descend into it.
+    // Returns 0 on success (or if there is no large mapping to split) and
+    // `E_NOMEM` if `kalloc` fails. The caller is responsible for flushing
+    // stale TLB entries. Do not split mappings shared between page tables,
+    // such as the kernel's direct map.
+    [[gnu::warn_unused_result]] int try_split();
+
+    // Free mapped page and clear mapping. Like `kfree(kptr()); map(0, 0)`.
+    // For a large page, `this->va()` must be aligned to `page_size()`.
     inline void kfree_page();
 
   private:
@@ -208,10 +236,12 @@ inline bool vmiter::low() const {
     return va_ <= VA_LOWMAX;
 }
 inline uint64_t vmiter::pa() const {
-    if (*pep_ & PTE_P) {
-        uintptr_t pa = *pep_ & PTE_PAMASK;
+    // read the entry once: swap-out may change it concurrently
+    uint64_t pte = *pep_;
+    if (pte & PTE_P) {
+        uintptr_t pa = pte & PTE_PAMASK;
         if (lbits_ > PAGEOFFBITS) {
-            pa &= ~0x1000UL;
+            pa &= ~PTE_PS_PAT;
         }
         return pa + (va_ & lbits_mask(lbits_));
     } else {
@@ -226,6 +256,23 @@ inline T vmiter::kptr() const {
         return nullptr;
     }
 }
+inline size_t vmiter::page_size() const {
+    if (*pep_ & PTE_P) {
+        return size_t(1) << lbits_;
+    } else {
+        return 0;
+    }
+}
+inline bool vmiter::huge() const {
+    return lbits_ > PAGEOFFBITS && (*pep_ & PTE_P);
+}
+inline x86_64_pageentry_t* vmiter::pte() const {
+    if (pep_ == &zero_pe) {
+        return nullptr;
+    } else {
+        return pep_;
+    }
+}
 inline uint64_t vmiter::perm() const {
     // Returns 0-0xFFF. (XXX Does not track PTE_XD.)
     // Returns 0 unless `(*pep_ & perm_ & PTE_P) != 0`.
@@ -280,24 +327,25 @@ inline vmiter vmiter::operator-(intptr_t delta) const {
 inline void vmiter::next_range() {
     find_impl(last_va(), true);
 }
-inline int vmiter::try_map(void* kp, int perm) {
-    return try_map(kptr2pa(kp), perm);
+inline int vmiter::try_map(void* kp, int perm, size_t pgsize) {
+    return try_map(kptr2pa(kp), perm, pgsize);
 }
-inline int vmiter::try_map(volatile void* kp, int perm) {
-    return try_map(kptr2pa(kp), perm);
+inline int vmiter::try_map(volatile void* kp, int perm, size_t pgsize) {
+    return try_map(kptr2pa(kp), perm, pgsize);
 }
-inline void vmiter::map(uintptr_t pa, int perm) {
-    int r = try_map(pa, perm);
+inline void vmiter::map(uintptr_t pa, int perm, size_t pgsize) {
+    int r = try_map(pa, perm, pgsize);
     assert(r == 0, "vmiter::map failed");
 }
-inline void vmiter::map(void* kp, int perm) {
-    map(kptr2pa(kp), perm);
+inline void vmiter::map(void* kp, int perm, size_t pgsize) {
+    map(kptr2pa(kp), perm, pgsize);
 }
-inline void vmiter::map(volatile void* kp, int perm) {
-    map(kptr2pa(kp), perm);
+inline void vmiter::map(volatile void* kp, int perm, size_t pgsize) {
+    map(kptr2pa(kp), perm, pgsize);
 }
 inline void vmiter::kfree_page() {
     assert((va_ & (PAGESIZE - 1)) == 0);
+    assert(!huge() || (va_ & lbits_mask(lbits_)) == 0);
     if (*pep_ & PTE_P) {
         kfree(kptr<void*>());
     }
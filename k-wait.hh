@@ -16,14 +16,25 @@ struct spinlock_guard;
 //    functions like `waiter::wait_until` (it cannot define these yet because
 //    they depend on methods in `struct proc`). When #included a second time
 //    (for instance, by `kernel.cc`), it defines those inline functions.
+//
+//    A waiter may carry a *key*, such as the address of the object it waits
+//    for; `wait_queue::notify_key` wakes only waiters with a matching key.
+//    A waiter may also be *exclusive*: `notify_n` and `notify_key` wake all
+//    matching non-exclusive waiters, but at most `n` exclusive ones. Use
+//    exclusive waits when any one waiter can consume the event (e.g., a
+//    free slot), to avoid waking a herd of tasks that will just block
+//    again. An exclusive waiter that wakes but doesn't consume the event
+//    should pass the wakeup on.
 
 
 struct waiter {
     proc* p_;
     wait_queue* wq_;
     list_links links_;
+    uintptr_t key_;
+    bool exclusive_;
 
-    explicit inline waiter();
+    explicit inline waiter(uintptr_t key = 0, bool exclusive = false);
     inline ~waiter();
     NO_COPY_OR_ASSIGN(waiter);
     inline void prepare(wait_queue& wq);
@@ -52,8 +63,13 @@ struct wait_queue {
     list<waiter, &waiter::links_> q_;
     mutable spinlock lock_;
 
-    // you might want to provide some convenience methods here
     inline void notify_all();
+    inline unsigned notify_one();
+    inline unsigned notify_n(unsigned n);
+    inline unsigned notify_key(uintptr_t key, unsigned n = -1U);
+
+  private:
+    inline unsigned notify_matching(bool any_key, uintptr_t key, unsigned n);
 };
 
 
@@ -64,34 +80,52 @@ struct wait_queue {
 // Beginning of inline functions (second inclusion)
 
 
-inline waiter::waiter()
-    : p_(current()) {
+inline waiter::waiter(uintptr_t key, bool exclusive)
+    : p_(current()), wq_(nullptr), key_(key), exclusive_(exclusive) {
 }
 
 inline waiter::~waiter() {
     assert(!links_.is_linked());
-    // Feel free to add more sanity checks if you’d like!
 }
 
+// waiter::prepare(wq)
+//    Mark this task as blocked and enqueue it on `wq`. A notification
+//    after this point makes the task runnable, so checking the wait
+//    condition after `prepare` cannot lose a wakeup.
 inline void waiter::prepare(wait_queue& wq) {
     assert(p_ == current());
     assert(!links_.is_linked());
     wq_ = &wq;
-    // your code here
+    spinlock_guard guard(wq.lock_);
+    p_->pstate_ = proc::ps_blocked;
+    wq.q_.push_back(this);
 }
 
+// waiter::maybe_block()
+//    Yield if this task is still blocked, then dequeue it.
 inline void waiter::maybe_block() {
     assert(p_ == current() && wq_ != nullptr);
     // Thanks to concurrent wakeups, `p_->pstate_` might or might not equal
     // `proc::ps_blocked`, and `links_` might or might not be linked.
-    // When the function returns, `p_->pstate_` MUST NOT equal
-    // `proc::ps_blocked`, and `links_` MUST NOT be linked.
-    // your code here
+    if (p_->pstate_ == proc::ps_blocked) {
+        p_->yield();
+    }
+    clear();
 }
 
+// waiter::clear()
+//    Dequeue this task if necessary and make sure it is runnable.
 inline void waiter::clear() {
     assert(p_ == current());
-    // your code here
+    if (wq_) {
+        spinlock_guard guard(wq_->lock_);
+        if (links_.is_linked()) {
+            wq_->q_.erase(this);
+        }
+        int s = proc::ps_blocked;
+        p_->pstate_.compare_exchange_strong(s, proc::ps_runnable);
+        wq_ = nullptr;
+    }
 }
 
 inline void waiter::notify() {
@@ -185,4 +219,44 @@ inline void wait_queue::notify_all() {
     }
 }
 
+// wait_queue::notify_one()
+//    Wake all non-exclusive waiters and the oldest exclusive waiter.
+//    Returns the number of waiters woken.
+inline unsigned wait_queue::notify_one() {
+    return notify_matching(true, 0, 1);
+}
+
+// wait_queue::notify_n(n)
+//    Wake all non-exclusive waiters and the `n` oldest exclusive waiters.
+//    Returns the number of waiters woken.
+inline unsigned wait_queue::notify_n(unsigned n) {
+    return notify_matching(true, 0, n);
+}
+
+// wait_queue::notify_key(key, n)
+//    Wake the waiters whose key is `key`: all non-exclusive ones and the
+//    `n` oldest exclusive ones. Returns the number of waiters woken.
+inline unsigned wait_queue::notify_key(uintptr_t key, unsigned n) {
+    return notify_matching(false, key, n);
+}
+
+inline unsigned wait_queue::notify_matching(bool any_key, uintptr_t key,
+                                            unsigned n) {
+    spinlock_guard guard(lock_);
+    unsigned nwoken = 0;
+    waiter* w = q_.front();
+    while (w) {
+        waiter* next = q_.next(w);
+        if ((any_key || w->key_ == key)
+            && (!w->exclusive_ || n != 0)) {
+            n -= w->exclusive_;
+            q_.erase(w);
+            w->notify();
+            ++nwoken;
+        }
+        w = next;
+    }
+    return nwoken;
+}
+
 #endif /* CHICKADEE_WAIT_FUNCTIONS */
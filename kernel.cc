@@ -4,6 +4,8 @@
 #include "k-chkfs.hh"
 #include "k-chkfsiter.hh"
 #include "k-devices.hh"
+#include "k-ring.hh"
+#include "k-swap.hh"
 #include "k-vmiter.hh"
 #include "obj/k-firstprocess.h"
 
@@ -24,14 +26,10 @@ static void start_initial_process(pid_t pid, const char* program_name);
 
 void kernel_start(const char* command) {
     init_hardware();
+    swapstate::get().init();
     consoletype = CONSOLE_NORMAL;
     console_clear();
 
-    // set up process descriptors
-    for (pid_t i = 0; i < NPROC; i++) {
-        ptable[i] = nullptr;
-    }
-
     // start first process
     start_initial_process(1, CHICKADEE_FIRST_PROCESS);
 
@@ -60,13 +58,18 @@ void start_initial_process(pid_t pid, const char* name) {
     // allocate process, initialize registers
     proc* p = knew<proc>();
     p->id_ = pid;
+    p->pid_ = pid;
+    p->program_ = memfile::initfs[mindex].name_;
     p->init_user(pt);
     p->regs_->reg_rip = ld.entry_rip_;
+    r = p->init_procdata();
+    assert(r >= 0);
 
     // initialize stack
     void* stkpg = kalloc(PAGESIZE);
     assert(stkpg);
     vmiter(p, MEMSIZE_VIRTUAL - PAGESIZE).map(stkpg, PTE_PWU);
+    swapstate::get().track(p, MEMSIZE_VIRTUAL - PAGESIZE, ka2pa(stkpg));
     p->regs_->reg_rsp = MEMSIZE_VIRTUAL;
 
     // map console
@@ -77,7 +80,8 @@ void start_initial_process(pid_t pid, const char* name) {
     {
         spinlock_guard guard(ptable_lock);
         assert(!ptable[pid]);
-        ptable[pid] = p;
+        r = ptable.insert_at(pid, p);
+        assert(r == 0);
     }
 
     // add to run queue
@@ -99,9 +103,10 @@ void proc::exception(regstate* regs) {
     // Events logged this way are stored in the host's `log.txt` file.
     //log_printf("proc %d: exception %d @%p\n", id_, regs->reg_intno, regs->reg_rip);
 
-    // Record most recent user-mode %rip.
+    // Record most recent user-mode %rip, and charge user time.
     if ((regs->reg_cs & 3) != 0) {
         recent_user_rip_ = regs->reg_rip;
+        usage_charge(&usage_counters::utime);
     }
 
     // Show the current cursor location.
@@ -113,6 +118,11 @@ void proc::exception(regstate* regs) {
 
     case INT_IRQ + IRQ_TIMER: {
         cpustate* cpu = this_cpu();
+        // while profiling, only some timer interrupts are ticks
+        if (!cpu->profile_interrupt(this, regs)) {
+            lapicstate::get().ack();
+            break;
+        }
         if (cpu->cpuindex_ == 0) {
             tick();
         }
@@ -123,6 +133,8 @@ void proc::exception(regstate* regs) {
     }
 
     case INT_PF: {              // pagefault exception
+        usage_add(&usage_counters::npagefaults);
+
         // Analyze faulting address and access type.
         uintptr_t addr = rdcr2();
         const char* operation = regs->reg_errcode & PFERR_WRITE
@@ -130,6 +142,23 @@ void proc::exception(regstate* regs) {
         const char* problem = regs->reg_errcode & PFERR_PRESENT
                 ? "protection problem" : "missing page";
 
+        // Swapped-out user pages are read back in. `swap_in` enables
+        // interrupts and may block, so a kernel-mode fault is handled
+        // this way only if the faulting code had interrupts enabled and
+        // holds no spinlocks; otherwise it falls through to the panic.
+        if (!(regs->reg_errcode & PFERR_PRESENT)
+            && addr <= VA_LOWMAX
+            && this_cpu()->spinlock_depth_ == 0
+            && ((regs->reg_cs & 3) != 0
+                || (regs->reg_rflags & EFLAGS_IF))) {
+            auto irqs = irqstate::get();
+            int r = swapstate::get().swap_in(this, addr);
+            irqs.restore();
+            if (r == 0) {
+                break;
+            }
+        }
+
         if ((regs->reg_cs & 3) == 0) {
             panic_at(*regs, "Kernel page fault for %p (%s %s)!\n",
                      addr, operation, problem);
@@ -143,6 +172,16 @@ void proc::exception(regstate* regs) {
         break;
     }
 
+    case INT_IRQ + IRQ_TLB_SHOOTDOWN:
+        this_cpu()->handle_tlb_requests();
+        lapicstate::get().ack();
+        break;
+
+    case INT_IRQ + IRQ_RESCHEDULE:
+        // handled below
+        lapicstate::get().ack();
+        break;
+
     case INT_IRQ + IRQ_KEYBOARD:
         keyboardstate::get().handle_interrupt();
         break;
@@ -157,7 +196,18 @@ void proc::exception(regstate* regs) {
 
     }
 
+    // if this CPU was idle and a task became runnable, run it now
+    cpustate* cpu = this_cpu();
+    if (this == cpu->idle_task_ && cpu->resched_pending_.exchange(false)) {
+        regs_ = regs;
+        yield_noreturn();
+    }
+
     // return to interrupted context
+    if ((regs->reg_cs & 3) != 0) {
+        cli();
+        usage_charge(&usage_counters::stime);
+    }
 }
 
 
@@ -169,6 +219,21 @@ void proc::exception(regstate* regs) {
 //    process in `%rax`.
 
 uintptr_t proc::syscall(regstate* regs) {
+    uintptr_t syscallno = regs->reg_rax;
+    usage_charge(&usage_counters::utime);
+    trace(tr_syscall_enter, syscallno);
+    uintptr_t r = syscall_dispatch(regs);
+    trace(tr_syscall_exit, syscallno, r);
+    cli();
+    usage_charge(&usage_counters::stime);
+    return r;
+}
+
+
+// proc::syscall_dispatch(regs)
+//    Run the system call requested by `regs`.
+
+uintptr_t proc::syscall_dispatch(regstate* regs) {
     //log_printf("proc %d: syscall %ld @%p\n", id_, regs->reg_rax, regs->reg_rip);
 
     // Record most recent user-mode %rip.
@@ -188,12 +253,28 @@ uintptr_t proc::syscall(regstate* regs) {
         break;                  // will not be reached
 
     case SYSCALL_KTEST:
-        if (regs->reg_rdi == 1) {
+        if (regs->reg_rdi == KTEST_WAIT_QUEUES) {
             return ktest_wait_queues();
+        } else if (regs->reg_rdi == KTEST_BENCH) {
+            return ktest_bench(regs->reg_rsi, regs->reg_rdx);
+        } else if (regs->reg_rdi == KTEST_HALT) {
+            // stands in for the last process exiting
+            process_halt();
+        } else if (regs->reg_rdi == KTEST_KEYBOARD) {
+            // type `reg_rdx` bytes from `reg_rsi`, so tests can read fd 0
+            char buf[128];
+            size_t sz = min(size_t(regs->reg_rdx), sizeof(buf));
+            if (copy_from_user(buf, regs->reg_rsi, sz) < 0) {
+                return E_FAULT;
+            }
+            return keyboardstate::get().inject(buf, sz);
         }
         return -1;
 
     case SYSCALL_GETPID:
+        return pid_;
+
+    case SYSCALL_GETTID:
         return id_;
 
     case SYSCALL_YIELD:
@@ -202,16 +283,38 @@ uintptr_t proc::syscall(regstate* regs) {
 
     case SYSCALL_PAGE_ALLOC: {
         uintptr_t addr = regs->reg_rdi;
-        if (addr >= VA_LOWEND || addr & 0xFFF) {
+        if (addr >= VA_PROCDATA || addr & 0xFFF) {
             return -1;
         }
-        void* pg = kalloc(PAGESIZE);
+        void* pg = kalloc_reclaim(PAGESIZE, KALLOC_ZERO);
         if (!pg || vmiter(this, addr).try_map(ka2pa(pg), PTE_PWU) < 0) {
             return -1;
         }
+        swapstate::get().track(this, addr, ka2pa(pg));
         return 0;
     }
 
+    case SYSCALL_HUGEPAGE_ALLOC: {
+        uintptr_t addr = regs->reg_rdi;
+        if (addr >= VA_LOWEND || addr & (HUGEPAGESIZE - 1)) {
+            return E_INVAL;
+        }
+        for (vmiter it(this, addr); it.va() < addr + HUGEPAGESIZE; it.next()) {
+            if (it.present()) {
+                return E_INVAL;
+            }
+        }
+        void* pg = kalloc(HUGEPAGESIZE, KALLOC_ZERO);
+        if (!pg) {
+            return E_NOMEM;
+        }
+        int r = vmiter(this, addr).try_map(ka2pa(pg), PTE_PWU, HUGEPAGESIZE);
+        if (r < 0) {
+            kfree(pg);
+        }
+        return r;
+    }
+
     case SYSCALL_PAUSE: {
         sti();
         for (uintptr_t delay = 0; delay < 1000000; ++delay) {
@@ -223,6 +326,28 @@ uintptr_t proc::syscall(regstate* regs) {
     case SYSCALL_FORK:
         return syscall_fork(regs);
 
+    case SYSCALL_CLONE:
+        return syscall_clone(regs);
+
+    case SYSCALL_TEXIT:
+        syscall_texit(regs);
+        break;                  // will not be reached
+
+    case SYSCALL_FUTEX:
+        return syscall_futex(regs);
+
+    case SYSCALL_PROFILE:
+        return syscall_profile(regs);
+
+    case SYSCALL_GETUSAGE:
+        return syscall_getusage(regs);
+
+    case SYSCALL_LOG:
+        return syscall_log(regs);
+
+    case SYSCALL_CLOCK_GETTIME:
+        return syscall_clock_gettime(regs);
+
     case SYSCALL_READ:
         return syscall_read(regs);
 
@@ -232,16 +357,14 @@ uintptr_t proc::syscall(regstate* regs) {
     case SYSCALL_READDISKFILE:
         return syscall_readdiskfile(regs);
 
-    case SYSCALL_SYNC: {
-        int drop = regs->reg_rdi;
-        // `drop > 1` asserts that no data blocks are referenced (except
-        // possibly superblock and FBB blocks). This can only be ensured on
-        // tests that run as the first process.
-        if (drop > 1 && strncmp(CHICKADEE_FIRST_PROCESS, "test", 4) != 0) {
-            drop = 1;
-        }
-        return bufcache::get().sync(drop);
-    }
+    case SYSCALL_SYNC:
+        return syscall_sync(regs);
+
+    case SYSCALL_RING_SETUP:
+        return syscall_ring_setup(regs);
+
+    case SYSCALL_RING_ENTER:
+        return syscall_ring_enter(regs);
 
     default:
         // no such system call
@@ -261,6 +384,71 @@ int proc::syscall_fork(regstate* regs) {
 }
 
 
+// proc::syscall_clone(regs)
+//    Handle clone system call: start a new thread of this process that
+//    returns 0 from the system call with `%rsp == regs->reg_rdi`. The
+//    thread gets its own kernel task and `ptable` slot, and is scheduled
+//    independently of the calling thread.
+
+uintptr_t proc::syscall_clone(regstate* regs) {
+    proc* t = knew<proc>();
+    if (!t) {
+        return E_NOMEM;
+    }
+    t->pid_ = pid_;
+    t->ppid_ = ppid_;
+    t->leader_ = leader_;
+    t->data_ = data_;
+    t->program_ = program_;
+    t->init_user(pagetable_);
+    *t->regs_ = *regs;
+    t->regs_->reg_rax = 0;
+    t->regs_->reg_rsp = regs->reg_rdi;
+
+    pid_t tid;
+    {
+        spinlock_guard guard(ptable_lock);
+        tid = ptable.insert(t);
+    }
+    if (tid < 0) {
+        kfree(t);
+        return tid;
+    }
+
+    ++leader_->nthreads_;
+    cpus[tid % ncpu].enqueue(t);
+    return tid;
+}
+
+
+// proc::syscall_texit(regs)
+//    Handle texit system call. The exiting thread's `proc` is freed by the
+//    scheduler once the CPU has switched away from it; a leader's `proc`
+//    is kept, since it describes the process. Process exit isn't
+//    implemented yet, so when the last thread exits, the process stops
+//    running but keeps its memory.
+
+void proc::syscall_texit(regstate* regs) {
+    if (ring_) {
+        ring_->stop();
+        ring_ = nullptr;
+    }
+    if (leader_->nthreads_.fetch_sub(1) == 1) {
+        log_printf("proc %d: last thread exited with status %d\n",
+                   pid_, int(regs->reg_rdi));
+    }
+    if (leader_ != this) {
+        usage_charge(&usage_counters::stime);
+        spinlock_guard guard(ptable_lock);
+        assert(ptable[id_] == this);
+        ptable.erase(id_);
+        leader_->exited_usage_ += usage_;
+    }
+    pstate_ = ps_exited;
+    yield_noreturn();
+}
+
+
 // proc::syscall_read(regs), proc::syscall_write(regs),
 // proc::syscall_readdiskfile(regs)
 //    Handle read and write system calls.
@@ -274,7 +462,9 @@ uintptr_t proc::syscall_read(regstate* regs) {
 
     // Your code here!
     // * Read from open file `fd` (reg_rdi), rather than `keyboardstate`.
-    // * Validate the read buffer.
+    if (!user_range_ok(addr, sz, PTE_PWU)) {
+        return E_FAULT;
+    }
     auto& kbd = keyboardstate::get();
     auto irqs = kbd.lock_.lock();
 
@@ -292,9 +482,11 @@ uintptr_t proc::syscall_read(regstate* regs) {
         irqs = kbd.lock_.lock();
     }
 
-    // read that line or lines
+    // read that line or lines into a kernel buffer (the user buffer
+    // can't be touched with a spinlock held, since that might fault)
+    char buf[128];
     size_t n = 0;
-    while (kbd.eol_ != 0 && n < sz) {
+    while (kbd.eol_ != 0 && n < min(sz, sizeof(buf))) {
         if (kbd.buf_[kbd.pos_] == 0x04) {
             // Ctrl-D means EOF
             if (n == 0) {
@@ -302,14 +494,17 @@ uintptr_t proc::syscall_read(regstate* regs) {
             }
             break;
         } else {
-            *reinterpret_cast<char*>(addr) = kbd.buf_[kbd.pos_];
-            ++addr;
+            buf[n] = kbd.buf_[kbd.pos_];
             ++n;
             kbd.consume(1);
         }
     }
 
     kbd.lock_.unlock(irqs);
+    if (copy_to_user(addr, buf, n) < 0) {
+        return E_FAULT;
+    }
+    usage_add(&usage_counters::nread, n);
     return n;
 }
 
@@ -322,16 +517,22 @@ uintptr_t proc::syscall_write(regstate* regs) {
 
     // Your code here!
     // * Write to open file `fd` (reg_rdi), rather than `consolestate`.
-    // * Validate the write buffer.
+    if (!user_range_ok(addr, sz, PTE_P | PTE_U)) {
+        return E_FAULT;
+    }
     auto& csl = consolestate::get();
-    spinlock_guard guard(csl.lock_);
+    char buf[128];
     size_t n = 0;
     while (n < sz) {
-        int ch = *reinterpret_cast<const char*>(addr);
-        ++addr;
-        ++n;
-        console_printf(CS_WHITE "%c", ch);
+        size_t ncopy = min(sz - n, sizeof(buf));
+        if (copy_from_user(buf, addr + n, ncopy) < 0) {
+            return n ? n : E_FAULT;
+        }
+        spinlock_guard guard(csl.lock_);
+        console_write(COLOR_WHITE, buf, ncopy);
+        n += ncopy;
     }
+    usage_add(&usage_counters::nwritten, n);
     return n;
 }
 
@@ -339,13 +540,20 @@ uintptr_t proc::syscall_readdiskfile(regstate* regs) {
     // This is a slow system call, so allow interrupts by default
     sti();
 
-    const char* filename = reinterpret_cast<const char*>(regs->reg_rdi);
-    unsigned char* buf = reinterpret_cast<unsigned char*>(regs->reg_rsi);
+    uintptr_t buf = regs->reg_rsi;
     size_t sz = regs->reg_rdx;
     off_t off = regs->reg_r10;
 
     if (!sata_disk) {
         return E_IO;
+    } else if (!user_range_ok(buf, sz, PTE_PWU)) {
+        return E_FAULT;
+    }
+
+    char filename[chkfs::maxnamelen + 1];
+    ssize_t r = strncpy_from_user(filename, regs->reg_rdi, sizeof(filename));
+    if (r < 0) {
+        return r;
     }
 
     // read root directory to find file inode number
@@ -368,7 +576,10 @@ uintptr_t proc::syscall_readdiskfile(regstate* regs) {
                 chkfs::blocksize - b,              // bytes left in block
                 sz - nread                         // bytes left in request
             );
-            memcpy(buf + nread, e->buf_ + b, ncopy);
+            if (copy_to_user(buf + nread, e->buf_ + b, ncopy) < 0) {
+                nread = nread ? nread : E_FAULT;
+                break;
+            }
 
             nread += ncopy;
             off += ncopy;
@@ -381,10 +592,53 @@ uintptr_t proc::syscall_readdiskfile(regstate* regs) {
     }
 
     ino->unlock_read();
+    if (ssize_t(nread) > 0) {
+        usage_add(&usage_counters::nread, nread);
+    }
     return nread;
 }
 
 
+// proc::syscall_log(regs)
+//    Handle log system call: append a user buffer to `log.txt`.
+
+uintptr_t proc::syscall_log(regstate* regs) {
+    sti();
+
+    uintptr_t addr = regs->reg_rdi;
+    size_t sz = regs->reg_rsi;
+    if (!user_range_ok(addr, sz, PTE_P | PTE_U)) {
+        return E_FAULT;
+    }
+    char buf[128];
+    size_t n = 0;
+    while (n < sz) {
+        size_t ncopy = min(sz - n, sizeof(buf));
+        if (copy_from_user(buf, addr + n, ncopy) < 0) {
+            return n ? n : E_FAULT;
+        }
+        log_printf("%.*s", int(ncopy), buf);
+        n += ncopy;
+    }
+    return n;
+}
+
+
+// proc::syscall_sync(regs)
+//    Handle sync system call.
+
+uintptr_t proc::syscall_sync(regstate* regs) {
+    int drop = regs->reg_rdi;
+    // `drop > 1` asserts that no data blocks are referenced (except
+    // possibly superblock and FBB blocks). This can only be ensured on
+    // tests that run as the first process.
+    if (drop > 1 && strncmp(CHICKADEE_FIRST_PROCESS, "test", 4) != 0) {
+        drop = 1;
+    }
+    return bufcache::get().sync(drop);
+}
+
+
 // memshow()
 //    Draw a picture of memory (physical and virtual) on the CGA console.
 //    Switches to a new process's virtual memory map every 0.25 sec.
@@ -401,25 +655,30 @@ static void memshow() {
     }
     last_redisplay = ticks;
 
+    spinlock_guard guard(ptable_lock);
+
     // switch to a new process every 0.5 sec
     if (ticks - last_switch >= HZ / 2) {
-        showing = (showing + 1) % NPROC;
+        showing = ptable.next(showing + 1);
         last_switch = ticks;
     }
 
-    spinlock_guard guard(ptable_lock);
-
-    int search = 0;
-    while ((!ptable[showing]
-            || !ptable[showing]->pagetable_
-            || ptable[showing]->pagetable_ == early_pagetable)
-           && search < NPROC) {
-        showing = (showing + 1) % NPROC;
-        ++search;
+    // find a process with a user page table, wrapping around once
+    proc* p = nullptr;
+    for (int pass = 0; pass != 2 && !p; ++pass) {
+        for (showing = ptable.next(pass ? 1 : showing);
+             showing != NPROC;
+             showing = ptable.next(showing + 1)) {
+            p = ptable[showing];
+            if (p->pagetable_ && p->pagetable_ != early_pagetable) {
+                break;
+            }
+            p = nullptr;
+        }
     }
 
-    console_memviewer(ptable[showing]);
-    if (!ptable[showing]) {
+    console_memviewer(p);
+    if (!p) {
         console_printf(CPOS(10, 26), CS_WHITE "   VIRTUAL ADDRESS SPACE\n"
             "                          [All processes have exited]\n"
             "\n\n\n\n\n\n\n\n\n\n\n");
@@ -435,6 +694,9 @@ void tick() {
     // Update current time
     ++ticks;
 
+    // Write out buffered log messages
+    log_notify();
+
     // Update display
     if (consoletype == CONSOLE_MEMVIEWER) {
         memshow();
@@ -6,6 +6,7 @@
 #include "k-lock.hh"
 #include "k-memrange.hh"
 #include "k-wait.hh"
+#include "trace.hh"
 #include <expected>
 #if CHICKADEE_PROCESS
 #error "kernel.hh should not be used by process code."
@@ -14,6 +15,8 @@ struct proc;
 struct yieldstate;
 struct proc_loader;
 struct elf_program;
+struct tlb_batch;
+struct ringstate;
 #define PROC_RUNNABLE 1
 
 
@@ -22,19 +25,50 @@ struct elf_program;
 //    Functions, constants, and definitions for the kernel.
 
 
+// Resource usage counters, kept for each task and each CPU; see
+// k-usage.cc. Times are in TSC cycles.
+struct usage_counters {
+    uint64_t utime;                            // user-mode time
+    uint64_t stime;                            // kernel-mode time
+    uint64_t idletime;                         // idle task time
+    uint64_t nvcsw;                            // voluntary switches
+    uint64_t nivcsw;                           // involuntary switches
+    uint64_t npagefaults;
+    uint64_t nread;                            // bytes read
+    uint64_t nwritten;                         // bytes written
+    uint64_t ndiskio;                          // disk commands issued
+    uint64_t nbufcache_hits;
+    uint64_t nbufcache_misses;
+
+    usage_counters& operator+=(const usage_counters& x);
+};
+
+
 // Process descriptor type
 struct __attribute__((aligned(4096))) proc {
     enum pstate_t {
-        ps_blank = 0, ps_runnable = PROC_RUNNABLE, ps_faulted, ps_blocked
+        ps_blank = 0, ps_runnable = PROC_RUNNABLE, ps_faulted, ps_blocked,
+        ps_exited
     };
 
     // These four members must come first:
-    pid_t id_ = 0;                             // Process ID
+    pid_t id_ = 0;                             // Thread ID (`ptable` index)
     regstate* regs_ = nullptr;                 // Process's current registers
     yieldstate* yields_ = nullptr;             // Process's current yield state
     std::atomic<int> pstate_ = ps_blank;       // Process state
 
     x86_64_pagetable* pagetable_ = nullptr;    // Process's page table
+    procdata* data_ = nullptr;                 // Process data page
+    pid_t pid_ = 0;                            // Process ID
+    pid_t ppid_ = 0;                           // Parent process ID
+    ringstate* ring_ = nullptr;                // Syscall ring, if any
+    const char* program_ = nullptr;            // initfs program name
+
+    // Threads of a process share `pagetable_` and `data_`. The first
+    // thread is the leader; its `id_` is the process ID, and it stays
+    // allocated until the process exits, even if it exits first.
+    proc* leader_ = this;                      // Thread group leader
+    std::atomic<unsigned> nthreads_ = 1;       // # live threads (leader only)
     uintptr_t recent_user_rip_ = 0;            // Most recent user-mode %rip
 #if HAVE_SANITIZERS
     int sanitizer_status_ = 0;
@@ -44,6 +78,12 @@ struct __attribute__((aligned(4096))) proc {
     list_links runq_links_;                    // Links for run queue
     int runq_cpu_ = -1;                        // CPU index of recent run queue
 
+    // Resource usage, written only by this task or while it is switched
+    // out (see `usage_add`); `exited_usage_` is protected by `ptable_lock`
+    usage_counters usage_ = {};
+    uint64_t usage_tsc_ = 0;                   // TSC at last time charge
+    usage_counters exited_usage_ = {};         // Exited threads (leader only)
+
 
     proc();
     NO_COPY_OR_ASSIGN(proc);
@@ -53,25 +93,40 @@ struct __attribute__((aligned(4096))) proc {
 
     void init_user(x86_64_pagetable* pt);
     void init_kernel(void (*f)());
+    int init_procdata();
+    inline void refresh_procdata(int cpuindex);
 
     static int load(proc_loader& ld);
 
     void exception(regstate* reg);
     uintptr_t syscall(regstate* reg);
+    uintptr_t syscall_dispatch(regstate* reg);
 
     void yield();
+    void yield_to(proc* next);
     [[noreturn]] void yield_noreturn();
     [[noreturn]] void resume();
     [[noreturn]] void panic_nonrunnable();
 
     inline bool resumable() const;
     inline void unblock();
+    inline void usage_charge(uint64_t usage_counters::* field);
 
     int syscall_fork(regstate* regs);
 
     uintptr_t syscall_read(regstate* reg);
     uintptr_t syscall_write(regstate* reg);
     uintptr_t syscall_readdiskfile(regstate* reg);
+    uintptr_t syscall_sync(regstate* reg);
+    uintptr_t syscall_clone(regstate* reg);
+    [[noreturn]] void syscall_texit(regstate* reg);
+    uintptr_t syscall_futex(regstate* reg);
+    uintptr_t syscall_profile(regstate* reg);
+    uintptr_t syscall_getusage(regstate* reg);
+    uintptr_t syscall_log(regstate* reg);
+    uintptr_t syscall_clock_gettime(regstate* reg);
+    uintptr_t syscall_ring_setup(regstate* reg);
+    uintptr_t syscall_ring_enter(regstate* reg);
 
     inline irqstate lock_pagetable_read();
     inline void unlock_pagetable_read(irqstate& irqs);
@@ -80,8 +135,55 @@ struct __attribute__((aligned(4096))) proc {
     static int load_segment(const elf_program& ph, proc_loader& ld);
 };
 
-#define NPROC 16
-extern proc* ptable[NPROC];
+
+
+// Process table
+//    Maps thread IDs to `proc`s with a two-level radix tree. Leaves are
+//    allocated on demand and never freed, so lookups need no lock. A
+//    two-level bitmap of used IDs finds the lowest free ID in a few word
+//    operations. Modifications require `ptable_lock`.
+//
+//    A pointer from a lock-free lookup stays valid only while the `proc`
+//    can't be freed (a thread's `proc` is freed after it exits); hold
+//    `ptable_lock` to be sure.
+
+#define NPROC 32768                // maximum number of IDs, including 0
+
+struct proctable {
+    proctable();
+    NO_COPY_OR_ASSIGN(proctable);
+
+    // return the `proc` with ID `id`, or nullptr
+    inline proc* operator[](pid_t id) const;
+
+    // set `p->id_` to the lowest free ID and install `p` there. Returns
+    // the ID, `E_AGAIN` if all IDs are in use, or `E_NOMEM`.
+    pid_t insert(proc* p);
+    // install `p` at ID `id`, which must be free, and set `p->id_`.
+    // Returns 0 or `E_NOMEM`.
+    int insert_at(pid_t id, proc* p);
+    // remove the `proc` with ID `id`
+    void erase(pid_t id);
+
+    // return the least used ID >= `id`, or `NPROC` if there is none
+    pid_t next(pid_t id) const;
+    // return the number of used IDs
+    inline size_t size() const;
+
+  private:
+    static constexpr unsigned leaf_bits = 9;
+    static constexpr unsigned leaf_size = 1U << leaf_bits;
+    static constexpr unsigned nleaves = NPROC / leaf_size;
+    struct leaf {
+        std::atomic<proc*> p_[leaf_size];
+    };
+    std::atomic<leaf*> leaves_[nleaves];
+    uint64_t used_[NPROC / 64];    // bit set iff ID is in use
+    uint64_t full_[NPROC / 4096];  // bit `i` set iff `used_[i]` is all ones
+    size_t size_ = 0;
+};
+
+extern proctable ptable;
 extern spinlock ptable_lock;
 #define PROCSTACK_SIZE 4096UL
 
@@ -124,6 +226,23 @@ struct __attribute__((aligned(4096))) cpustate {
 
     unsigned spinlock_depth_;
 
+    // PCID cache and TLB shootdown state (see k-tlb.hh)
+    static constexpr unsigned npcid = 8;
+    std::atomic<x86_64_pagetable*> pcid_pagetable_[npcid]; // PCID `i + 1`
+    unsigned npcid_;                           // # usable (1 if no PCIDs)
+    int pcid_active_;                          // slot in %cr3, or -1
+    unsigned pcid_next_;                       // next slot to replace
+    tlb_batch* tlb_request_;                   // our in-progress shootdown
+    std::atomic<unsigned> tlb_requesters_;     // CPUs with requests for us
+
+    std::atomic<bool> resched_pending_;        // IRQ_RESCHEDULE in flight
+
+    unsigned timer_mult_;                      // timer interrupts per tick
+    unsigned timer_subtick_;                   // interrupts since last tick
+
+    usage_counters usage_;                     // see `usage_add`
+    int64_t tsc_offset_;                       // add to TSC for CPU 0's
+
     uint64_t gdt_segments_[7];
     x86_64_taskstate taskstate_;
 
@@ -142,6 +261,7 @@ struct __attribute__((aligned(4096))) cpustate {
     void exception(regstate* reg);
 
     [[noreturn]] void schedule();
+    [[noreturn]] void switch_to(proc* prev, proc* next);
 
     void enable_irq(int irqno);
     void disable_irq(int irqno);
@@ -149,9 +269,20 @@ struct __attribute__((aligned(4096))) cpustate {
     void enqueue(proc* p);
     void reenqueue(proc* p);
 
+    bool profile_interrupt(proc* p, const regstate* regs);
+    void account_switch(proc* prev, proc* next);
+
+    void load_pagetable(x86_64_pagetable* pt, uintptr_t pa);
+    inline bool caches_pagetable(x86_64_pagetable* pt) const;
+    inline bool pagetable_active(x86_64_pagetable* pt) const;
+    void invalidate_tlb(x86_64_pagetable* pt, unsigned n, const uintptr_t* va);
+    void handle_tlb_requests();
+
  private:
     void init_cpu_hardware();
+    void init_tlb();
     void init_idle_task();
+    void kick();
 };
 
 #define MAXCPU 16
@@ -192,6 +323,14 @@ struct yieldstate {
 
 extern std::atomic<unsigned long> ticks;        // number of ticks since boot
 
+// High-resolution clock (see k-clock.cc)
+extern uint64_t tsc_hz;                 // TSC frequency, calibrated at boot
+extern bool tsc_invariant;              // TSC rate is constant
+void init_clock();
+void clock_sync_others();
+void clock_sync_ap();
+uint64_t clock_ns();                    // monotonic ns since boot
+
 
 // Segment selectors
 #define SEGSEL_BOOT_CODE        0x8             // boot code segment
@@ -202,10 +341,13 @@ extern std::atomic<unsigned long> ticks;        // number of ticks since boot
 #define SEGSEL_TASKSTATE        0x28            // task state segment
 
 
-// Physical memory size
-#define MEMSIZE_PHYSICAL        0x200000UL
+// Physical memory size: one past the last usable physical address,
+// discovered at boot by `init_hardware`
+extern uintptr_t memsize_physical;
+// Maximum physical memory size (the kernel's direct map covers 512GiB)
+#define MEMSIZE_PHYSICAL_MAX    0x8000000000UL
 // Virtual memory size
-#define MEMSIZE_VIRTUAL         0x300000UL
+#define MEMSIZE_VIRTUAL         0x100000000UL
 
 enum memtype_t : uint8_t {
     mem_nonexistent = 0,
@@ -214,7 +356,7 @@ enum memtype_t : uint8_t {
     mem_reserved = 3,
     mem_console = 4
 };
-extern memrangeset<16> physical_ranges;
+extern memrangeset<64> physical_ranges;
 
 
 // Hardware interrupt numbers
@@ -223,6 +365,8 @@ extern memrangeset<16> physical_ranges;
 #define IRQ_KEYBOARD            1
 #define IRQ_IDE                 14
 #define IRQ_ERROR               19
+#define IRQ_TLB_SHOOTDOWN       29      // IPI: see k-tlb.hh
+#define IRQ_RESCHEDULE          30      // IPI: see `cpustate::kick`
 #define IRQ_SPURIOUS            31
 
 #define KTEXT_BASE              0xFFFFFFFF80000000UL
@@ -313,13 +457,31 @@ inline T read_unaligned(const uint8_t* ptr, T (U::* member)) {
 }
 
 
-// kalloc(sz)
+// kalloc(sz, flags)
 //    Allocate and return a pointer to at least `sz` contiguous bytes
 //    of memory. Returns `nullptr` if `sz == 0` or on failure.
+//    If `flags & KALLOC_ZERO`, the memory is zero-filled.
 //
 //    If `sz` is a multiple of `PAGESIZE`, the returned pointer is guaranteed
-//    to be page-aligned.
-void* kalloc(size_t sz) __attribute__((malloc));
+//    to be page-aligned. Allocations of up to `HUGEPAGESIZE` are supported.
+#define KALLOC_ZERO     0x1
+void* kalloc(size_t sz, int flags = 0) __attribute__((malloc));
+
+// kalloc_reclaim(sz, flags)
+//    Like `kalloc`, but if memory is exhausted, reclaims memory (possibly
+//    evicting pages to swap and blocking on disk I/O) and retries. Must be
+//    called from a kernel task with no spinlocks held; enables interrupts.
+void* kalloc_reclaim(size_t sz, int flags = 0) __attribute__((malloc));
+
+// kalloc_refill_zero_pool()
+//    Zero one free page for later `KALLOC_ZERO` requests. Returns false if
+//    there was nothing to do. Called by idle CPUs.
+bool kalloc_refill_zero_pool();
+
+// kalloc_page_counts(nfree, nallocated)
+//    Store the numbers of free and allocated physical pages. Their sum is
+//    the amount of usable physical memory, which never changes.
+void kalloc_page_counts(size_t* nfree, size_t* nallocated);
 
 // kfree(ptr)
 //    Free a pointer previously returned by `kalloc`. Does nothing if
@@ -386,12 +548,43 @@ x86_64_pagetable* knew_pagetable();
 // Change current page table
 void set_pagetable(x86_64_pagetable* pagetable);
 
+// copy_from_user(dst, uva, sz), copy_to_user(uva, src, sz)
+//    Copy `sz` bytes between kernel memory and user address `uva` in the
+//    current process. Permissions are checked once per page, and
+//    swapped-out pages are read back in first, so these may block; call
+//    them without spinlocks held. Return 0 on success or `E_FAULT` if
+//    some page is not user-accessible (in which case a prefix of the
+//    data may have been copied).
+int copy_from_user(void* dst, uintptr_t uva, size_t sz);
+int copy_to_user(uintptr_t uva, const void* src, size_t sz);
+
+// user_range_ok(uva, sz, perm)
+//    Return true iff every page in [`uva`, `uva + sz`) in the current
+//    process has permissions `perm`, reading swapped-out pages back in.
+//    Lets system calls reject a bad buffer before doing any work.
+bool user_range_ok(uintptr_t uva, size_t sz, uint64_t perm);
+
+// strncpy_from_user(dst, uva, maxlen)
+//    Copy a C string from user address `uva` into `dst`, which has room
+//    for `maxlen` bytes. Returns the string's length, `E_NAMETOOLONG` if
+//    it doesn't fit, or `E_FAULT` if it isn't user-accessible.
+ssize_t strncpy_from_user(char* dst, uintptr_t uva, size_t maxlen);
+
+// futex_has_waiters(pa)
+//    Return true iff a task is waiting on a futex in physical page `pa`.
+//    Swap uses this to keep such pages resident, since futexes are keyed
+//    by physical address.
+bool futex_has_waiters(uintptr_t pa);
+
 // Print memory viewer
 void console_memviewer(proc* p);
 
 // Run wait queue ktests
 int ktest_wait_queues();
 
+// Run kernel microbenchmark number `index` on `nbcpu` CPUs
+int ktest_bench(unsigned index, unsigned nbcpu);
+
 
 // Start the kernel
 [[noreturn]] void kernel_start(const char* command);
@@ -409,9 +602,78 @@ int ktest_wait_queues();
 // log_printf, log_vprintf
 //    Print debugging messages to the host's `log.txt` file. We run QEMU
 //    so that messages written to the QEMU "parallel port" end up in `log.txt`.
+//    Messages are buffered per CPU and written to the port by a kernel
+//    task, so these functions don't wait for the port (see k-log.cc).
 __noinline void log_printf(const char* format, ...);
 __noinline void log_vprintf(const char* format, va_list val);
 
+// log_write(s, n)
+//    Write `n` characters from `s` to `log.txt`.
+__noinline void log_write(const char* s, size_t n);
+
+// log_printer
+//    A `printer` that writes one log message. Interrupts are disabled
+//    while it exists. The message is published when it is destroyed, or
+//    dropped and counted if it doesn't fit in this CPU's log buffer.
+//    After a panic, output goes straight to the port.
+struct logbuf;
+struct log_printer : public printer {
+    log_printer();
+    ~log_printer();
+    void putc(unsigned char c) override;
+    void write(const char* s, size_t n);
+
+  private:
+    irqstate irqs_;
+    logbuf* lb_ = nullptr;      // nullptr: write directly
+    unsigned start_;            // position of message header
+    unsigned pos_;              // next position to write
+    bool overflow_ = false;
+    bool drop_ = false;
+    ansi_escape_buffer ebuf_;
+};
+
+// log_format(format, args...)
+//    Like `log_printf`, but `format` is parsed at compile time (see
+//    format.hh). Each call writes one log message.
+template <typename... Args>
+inline void log_format(format_string<std::decay_t<Args>...> format,
+                       const Args&... args) {
+    log_printer pr;
+    char buf[256];
+    format_stream(buf, sizeof(buf), [] (void* arg, const char* s, size_t n) {
+        static_cast<log_printer*>(arg)->write(s, n);
+    }, &pr, format, args...);
+}
+
+// init_log(), log_notify(), log_flush()
+//    Start the log task; wake it if messages are waiting (called every
+//    tick); and write all waiting messages synchronously (called before
+//    the machine halts).
+void init_log();
+void log_notify();
+void log_flush();
+
+// log_reserve(n)
+//    Flush the log now unless this CPU's log buffer has room for `n` more
+//    bytes (including per-message overhead of 8 bytes).
+void log_reserve(size_t n);
+
+
+// trace(type, arg0, arg1), trace_drain()
+//    Record a trace event in this CPU's trace buffer, and drain all CPUs'
+//    buffers to `log.txt`. These do nothing unless the kernel is built
+//    with `make TRACE=1`. See k-trace.cc and trace.hh.
+#if CHICKADEE_TRACE
+void trace(trace_type type, uint64_t arg0 = 0, uint64_t arg1 = 0);
+void trace_drain();
+#else
+inline void trace(trace_type, uint64_t = 0, uint64_t = 0) {
+}
+inline void trace_drain() {
+}
+#endif
+
 
 // log_print_backtrace
 //    Print a backtrace to the host's `log.txt` file, either for the current
@@ -419,6 +681,14 @@ __noinline void log_vprintf(const char* format, va_list val);
 void log_print_backtrace();
 void log_print_backtrace(const proc* p);
 
+// backtrace_pcs(regs, pt, pcs, max)
+//    Store `regs.reg_rip`, then the return addresses of the frames in
+//    `regs`'s stack, in `pcs`, stopping after `max` addresses or at the
+//    first frame on the other side of the user/kernel boundary. Returns
+//    the number of addresses stored.
+unsigned backtrace_pcs(const regstate& regs, x86_64_pagetable* pt,
+                       uintptr_t* pcs, unsigned max);
+
 
 // lookup_symbol(addr, name, start)
 //    Use the debugging symbol table to look up `addr`. Return the
@@ -472,6 +742,22 @@ inline void adjust_this_cpu_spinlock_depth(int delta) {
                   : "cc", "memory");
 }
 
+// usage_add(field, n)
+//    Add `n` to usage counter `field` of the current task and this CPU.
+//    Only the current task updates its own counters, and each add is a
+//    single instruction, so this needs neither locks nor disabled
+//    interrupts.
+inline void usage_add(uint64_t usage_counters::* field, uint64_t n = 1) {
+    if (proc* p = current()) {
+        asm volatile ("addq %1, %0" : "+m" (p->usage_.*field) : "er" (n)
+                      : "cc");
+    }
+    uintptr_t off = reinterpret_cast<uintptr_t>(&(cpus[0].usage_.*field))
+        - reinterpret_cast<uintptr_t>(&cpus[0]);
+    asm volatile ("addq %1, %%gs:(%0)" : : "r" (off), "er" (n)
+                  : "cc", "memory");
+}
+
 // cpustate::contains(ptr)
 //    Return true iff `ptr` lies within this cpustate's allocation.
 inline bool cpustate::contains(void* ptr) const {
@@ -482,6 +768,28 @@ inline bool cpustate::contains(uintptr_t addr) const {
     return delta <= CPUSTACK_SIZE;
 }
 
+// cpustate::caches_pagetable(pt)
+//    Return true iff this CPU might hold TLB entries for `pt`. Safe to
+//    call from other CPUs.
+inline bool cpustate::caches_pagetable(x86_64_pagetable* pt) const {
+    for (unsigned i = 0; i != npcid; ++i) {
+        if (pcid_pagetable_[i].load() == pt) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// cpustate::pagetable_active(pt)
+//    Return true iff `pt` is loaded in this CPU's `%cr3`. Call on this CPU
+//    with interrupts disabled. Lets the scheduler skip `set_pagetable`,
+//    whose sanity checks walk the page table, when switching between
+//    tasks that share an address space.
+inline bool cpustate::pagetable_active(x86_64_pagetable* pt) const {
+    return pcid_active_ >= 0
+        && pcid_pagetable_[pcid_active_].load(std::memory_order_relaxed) == pt;
+}
+
 // proc::contains(ptr)
 //    Return true iff `ptr` lies within this cpustate's allocation.
 inline bool proc::contains(void* ptr) const {
@@ -510,10 +818,58 @@ inline bool proc::resumable() const {
 inline void proc::unblock() {
     int s = ps_blocked;
     if (pstate_.compare_exchange_strong(s, ps_runnable)) {
+        trace(tr_unblock, id_);
         cpus[runq_cpu_].reenqueue(this);
     }
 }
 
+// proc::usage_charge(field)
+//    Charge the time since this task's last time charge to usage counter
+//    `field`: `utime` on entry from user mode, `stime` on the way back.
+//    Call on the current task with interrupts disabled.
+inline void proc::usage_charge(uint64_t usage_counters::* field) {
+    uint64_t now = rdtsc();
+    usage_add(field, now - usage_tsc_);
+    usage_tsc_ = now;
+}
+
+// proc::refresh_procdata(cpuindex)
+//    Update the scheduling fields of this process's data page, if it has
+//    one. Called just before the process runs on CPU `cpuindex`. Threads
+//    share the page, so the seqlock generation is claimed with a
+//    compare-and-swap; if another CPU is mid-update, skip this one.
+inline void proc::refresh_procdata(int cpuindex) {
+    if (data_) {
+        unsigned long gen = data_->gen;
+        if (gen % 2 == 0
+            && __atomic_compare_exchange_n(&data_->gen, &gen, gen + 1, false,
+                                           __ATOMIC_ACQUIRE,
+                                           __ATOMIC_RELAXED)) {
+            data_->cpu = cpuindex;
+            data_->ticks = ticks.load(std::memory_order_relaxed);
+            data_->tsc = rdtsc();
+            __atomic_store_n(&data_->gen, gen + 2, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+// proctable::operator[](id)
+//    Lock-free lookup; see `proctable`.
+inline proc* proctable::operator[](pid_t id) const {
+    if (id < 0 || id >= NPROC) {
+        return nullptr;
+    }
+    leaf* l = leaves_[id >> leaf_bits].load(std::memory_order_acquire);
+    if (!l) {
+        return nullptr;
+    }
+    return l->p_[id & (leaf_size - 1)].load(std::memory_order_acquire);
+}
+
+inline size_t proctable::size() const {
+    return size_;
+}
+
 // proc::lock_pagetable_read()
 //    Acquire a “read lock” on this process’s page table. While the “read
 //    lock” is held, it is illegal to remove or change existing valid
@@ -17,9 +17,77 @@ extern "C" {
 // strtoul, strtol
 //    We must provide our own implementations.
 
+// Block routines use `rep movs`/`rep stos` for large sizes and 8-byte
+// words otherwise. (We can't use SSE: CCOMMONFLAGS disables it.) On CPUs
+// with Enhanced REP MOVSB/STOSB (ERMS), byte-granularity `rep movsb` and
+// `rep stosb` are as fast as the quadword forms. The scanning routines
+// read aligned words, which never cross a page boundary, so they can
+// safely read a few bytes past the end of their input.
+
+using unaligned_u64 = uint64_t __attribute__((may_alias, aligned(1)));
+using aligned_u64 = uint64_t __attribute__((may_alias));
+
+static constexpr uint64_t word_ones = 0x0101010101010101UL;
+static constexpr uint64_t word_highs = 0x8080808080808080UL;
+// sizes at or above this use `rep` string instructions
+static constexpr size_t rep_threshold = 256;
+
+// word_has_zero(x)
+//    Return nonzero iff some byte of `x` is zero. The lowest set bit of
+//    the result is in the first zero byte.
+static inline uint64_t word_has_zero(uint64_t x) {
+    return (x - word_ones) & ~x & word_highs;
+}
+
+// have_erms()
+//    Return true iff the CPU supports ERMS. Detected on first use.
+static inline bool have_erms() {
+    static std::atomic<int> erms = -1;
+    int e = erms.load(std::memory_order_relaxed);
+    if (e < 0) {
+        e = cpuid(0).eax >= 7 && (cpuid(7, 0).ebx & (1U << 9));
+        erms.store(e, std::memory_order_relaxed);
+    }
+    return e;
+}
+
+static inline void rep_movsb(char* d, const char* s, size_t n) {
+    asm volatile("rep movsb"
+                 : "+D" (d), "+S" (s), "+c" (n) : : "memory");
+}
+
+static inline void rep_movs(char* d, const char* s, size_t n) {
+    if (!have_erms()) {
+        size_t nw = n / 8;
+        asm volatile("rep movsq"
+                     : "+D" (d), "+S" (s), "+c" (nw) : : "memory");
+        n %= 8;
+    }
+    rep_movsb(d, s, n);
+}
+
+static inline void rep_stos(char* d, uint64_t pattern, size_t n) {
+    if (!have_erms()) {
+        size_t nw = n / 8;
+        asm volatile("rep stosq"
+                     : "+D" (d), "+c" (nw) : "a" (pattern) : "memory");
+        n %= 8;
+    }
+    asm volatile("rep stosb"
+                 : "+D" (d), "+c" (n) : "a" (pattern) : "memory");
+}
+
 void* memcpy(void* dst, const void* src, size_t n) {
+    char* d = (char*) dst;
     const char* s = (const char*) src;
-    for (char* d = (char*) dst; n > 0; --n, ++s, ++d) {
+    if (n >= rep_threshold) {
+        rep_movs(d, s, n);
+        return dst;
+    }
+    for (; n >= 8; n -= 8, s += 8, d += 8) {
+        *(unaligned_u64*) d = *(const unaligned_u64*) s;
+    }
+    for (; n > 0; --n, ++s, ++d) {
         *d = *s;
     }
     return dst;
@@ -29,11 +97,23 @@ void* memmove(void* dst, const void* src, size_t n) {
     const char* s = (const char*) src;
     char* d = (char*) dst;
     if (s < d && s + n > d) {
+        // copy backwards, a word at a time: each word is read before
+        // any overlapping word is written
         s += n, d += n;
+        for (; n >= 8; n -= 8) {
+            s -= 8, d -= 8;
+            *(unaligned_u64*) d = *(const unaligned_u64*) s;
+        }
         while (n-- > 0) {
             *--d = *--s;
         }
+    } else if (n >= rep_threshold) {
+        // forward `rep movs` is correct for overlapping `d < s`
+        rep_movs(d, s, n);
     } else {
+        for (; n >= 8; n -= 8, s += 8, d += 8) {
+            *(unaligned_u64*) d = *(const unaligned_u64*) s;
+        }
         while (n-- > 0) {
             *d++ = *s++;
         }
@@ -42,7 +122,16 @@ void* memmove(void* dst, const void* src, size_t n) {
 }
 
 void* memset(void* v, int c, size_t n) {
-    for (char* p = (char*) v; n > 0; ++p, --n) {
+    char* p = (char*) v;
+    uint64_t pattern = (unsigned char) c * word_ones;
+    if (n >= rep_threshold) {
+        rep_stos(p, pattern, n);
+        return v;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        *(unaligned_u64*) p = pattern;
+    }
+    for (; n > 0; ++p, --n) {
         *p = c;
     }
     return v;
@@ -51,6 +140,14 @@ void* memset(void* v, int c, size_t n) {
 int memcmp(const void* a, const void* b, size_t n) {
     const uint8_t* sa = reinterpret_cast<const uint8_t*>(a);
     const uint8_t* sb = reinterpret_cast<const uint8_t*>(b);
+    for (; n >= 8; sa += 8, sb += 8, n -= 8) {
+        uint64_t x = *(const unaligned_u64*) sa ^ *(const unaligned_u64*) sb;
+        if (x != 0) {
+            // little endian: lowest differing bit is in first differing byte
+            size_t i = __builtin_ctzll(x) / 8;
+            return (sa[i] > sb[i]) - (sa[i] < sb[i]);
+        }
+    }
     for (; n > 0; ++sa, ++sb, --n) {
         if (*sa != *sb) {
             return (*sa > *sb) - (*sa < *sb);
@@ -59,9 +156,23 @@ int memcmp(const void* a, const void* b, size_t n) {
     return 0;
 }
 
+[[gnu::no_sanitize_address]]
 void* memchr(const void* s, int c, size_t n) {
-    const unsigned char* ss;
-    for (ss = (const unsigned char*) s; n != 0; ++ss, --n) {
+    const unsigned char* ss = (const unsigned char*) s;
+    // scan bytes up to a word boundary
+    for (; n != 0 && ((uintptr_t) ss & 7) != 0; ++ss, --n) {
+        if (*ss == (unsigned char) c) {
+            return (void*) ss;
+        }
+    }
+    // scan aligned words
+    uint64_t pattern = (unsigned char) c * word_ones;
+    for (; n >= 8; ss += 8, n -= 8) {
+        if (uint64_t z = word_has_zero(*(const aligned_u64*) ss ^ pattern)) {
+            return (void*) (ss + __builtin_ctzll(z) / 8);
+        }
+    }
+    for (; n != 0; ++ss, --n) {
         if (*ss == (unsigned char) c) {
             return (void*) ss;
         }
@@ -69,20 +180,24 @@ void* memchr(const void* s, int c, size_t n) {
     return nullptr;
 }
 
+[[gnu::no_sanitize_address]]
 size_t strlen(const char* s) {
-    size_t n;
-    for (n = 0; *s != '\0'; ++s) {
-        ++n;
+    const char* p = s;
+    for (; ((uintptr_t) p & 7) != 0; ++p) {
+        if (*p == '\0') {
+            return p - s;
+        }
     }
-    return n;
+    uint64_t z;
+    while (!(z = word_has_zero(*(const aligned_u64*) p))) {
+        p += 8;
+    }
+    return p + __builtin_ctzll(z) / 8 - s;
 }
 
 size_t strnlen(const char* s, size_t maxlen) {
-    size_t n;
-    for (n = 0; n != maxlen && *s != '\0'; ++s) {
-        ++n;
-    }
-    return n;
+    const char* z = (const char*) memchr(s, '\0', maxlen);
+    return z ? z - s : maxlen;
 }
 
 char* strcpy(char* dst, const char* src) {
@@ -584,7 +699,10 @@ void printer::vprintf(const char* format, va_list val) {
             break;
         }
 
-        if (flags & FLAG_NUMERIC) {
+        if ((flags & FLAG_NUMERIC) && num == 0 && precision == 0
+            && !(flags & FLAG_ALT2)) {
+            data = "";      // `%.0d` prints no digits for zero
+        } else if (flags & FLAG_NUMERIC) {
             data = print_number(numbuf, NUMBUFSIZ, num, base, flags);
         }
 
@@ -643,6 +761,131 @@ void printer::vprintf(const char* format, va_list val) {
 }
 
 
+// format_buffer
+//    Out-of-line parts of the compile-time formatter (see format.hh).
+
+const char format_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+void format_buffer::put_slow(const char* p, size_t n) {
+    n_ += n;
+    while (n != 0) {
+        if (s_ == end_) {
+            if (!flush_ || s_ == start_) {
+                return;
+            }
+            flush_(flush_arg_, start_, s_ - start_);
+            s_ = start_;
+        }
+        size_t ncopy = min(n, size_t(end_ - s_));
+        memcpy(s_, p, ncopy);
+        s_ += ncopy;
+        p += ncopy;
+        n -= ncopy;
+    }
+}
+
+void format_buffer::put_literal_pct(const char* p, size_t n) {
+    // the parser only leaves `%%` pairs in literal text
+    while (n != 0) {
+        auto pct = reinterpret_cast<const char*>(memchr(p, '%', n));
+        size_t ncopy = pct ? pct + 1 - p : n;
+        put(p, ncopy);
+        p += ncopy + (pct != nullptr);
+        n -= ncopy + (pct != nullptr);
+    }
+}
+
+static void format_pad(format_buffer& b, char ch, size_t n) {
+    char buf[16];
+    memset(buf, ch, sizeof(buf));
+    for (; n > sizeof(buf); n -= sizeof(buf)) {
+        b.put(buf, sizeof(buf));
+    }
+    b.put(buf, n);
+}
+
+void format_buffer::put_number(const format_conv& c, unsigned long v,
+                               bool negative) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p;
+    const char* prefix = "";
+    if (c.conv_ == 'x' || c.conv_ == 'X' || c.conv_ == 'p') {
+        const char* digits = c.conv_ == 'X'
+            ? "0123456789ABCDEF" : "0123456789abcdef";
+        p = end;
+        unsigned long x = v;
+        do {
+            *--p = digits[x & 15];
+            x >>= 4;
+        } while (x != 0);
+        if (c.conv_ != 'x' && c.conv_ != 'X') {
+            prefix = "0x";
+        } else if ((c.flags_ & format_conv::f_alt) && v != 0) {
+            prefix = c.conv_ == 'X' ? "0X" : "0x";
+        }
+    } else {
+        p = format_decimal(end, v);
+        if (negative) {
+            prefix = "-";
+        } else if (c.conv_ != 'u' && (c.flags_ & format_conv::f_plus)) {
+            prefix = "+";
+        } else if (c.conv_ != 'u' && (c.flags_ & format_conv::f_space)) {
+            prefix = " ";
+        }
+    }
+    if (v == 0 && c.precision_ == 0 && c.conv_ != 'p') {
+        p = end;            // `%.0d` prints no digits for zero
+    }
+
+    size_t len = end - p, plen = strlen(prefix), zeros = 0;
+    if (c.precision_ >= 0) {
+        zeros = size_t(c.precision_) > len ? c.precision_ - len : 0;
+    } else if ((c.flags_ & (format_conv::f_zero | format_conv::f_left))
+               == format_conv::f_zero
+               && len + plen < c.width_) {
+        zeros = c.width_ - len - plen;
+    }
+    size_t total = plen + zeros + len;
+    size_t pad = c.width_ > total ? c.width_ - total : 0;
+    if (!(c.flags_ & format_conv::f_left)) {
+        format_pad(*this, ' ', pad);
+    }
+    put(prefix, plen);
+    format_pad(*this, '0', zeros);
+    put(p, len);
+    if (c.flags_ & format_conv::f_left) {
+        format_pad(*this, ' ', pad);
+    }
+}
+
+void format_buffer::put_string(const format_conv& c, const char* s) {
+    if (!s) {
+        s = "(null)";
+    }
+    size_t len = c.precision_ >= 0 ? strnlen(s, c.precision_) : strlen(s);
+    size_t pad = c.width_ > len ? c.width_ - len : 0;
+    if (!(c.flags_ & format_conv::f_left)) {
+        format_pad(*this, ' ', pad);
+    }
+    put(s, len);
+    if (c.flags_ & format_conv::f_left) {
+        format_pad(*this, ' ', pad);
+    }
+}
+
+void format_buffer::flush() {
+    if (flush_ && s_ != start_) {
+        flush_(flush_arg_, start_, s_ - start_);
+        s_ = start_;
+    }
+}
+
+
 // vsnprintf, snprintf
 //    Format a string into a sized buffer.
 
@@ -828,6 +1071,75 @@ int console_puts(int cpos, int color, const char* s, size_t len) {
 }
 
 
+// console_write(color, s, len)
+//    Two passes over `s`: the first finds where the text ends, counting
+//    cells from the top of the current screen, which tells how many lines
+//    to scroll; the second copies each run of characters between newlines
+//    straight into `console`, skipping text that would scroll off.
+
+[[gnu::noinline]]
+int console_write(int color, const char* s, size_t len) {
+    const char* end = s + len;
+    size_t start = min(size_t(max(int(cursorpos), 0)), size_t(END_CPOS));
+
+    // a newline fills the rest of its line, or a whole line at column 0
+    size_t pos = start;
+    for (const char* p = s; p != end; ) {
+        auto nl = reinterpret_cast<const char*>(memchr(p, '\n', end - p));
+        if (!nl) {
+            pos += end - p;
+            break;
+        }
+        pos += nl - p;
+        pos += CONSOLE_COLUMNS - pos % CONSOLE_COLUMNS;
+        p = nl + 1;
+    }
+
+    // scroll once
+    size_t nscroll = 0;
+    if (pos > END_CPOS) {
+        nscroll = round_up(pos - END_CPOS, CONSOLE_COLUMNS);
+        size_t nkeep = nscroll < END_CPOS ? END_CPOS - nscroll : 0;
+        for (size_t i = 0; i != nkeep; ++i) {
+            console[i] = console[i + nscroll];
+        }
+        for (size_t i = nkeep; i != END_CPOS; ++i) {
+            console[i] = 0;
+        }
+    }
+
+    // copy runs; `pos` counts cells as before scrolling
+    pos = start;
+    for (const char* p = s; p != end; ) {
+        auto nl = reinterpret_cast<const char*>(memchr(p, '\n', end - p));
+        const char* stop = nl ? nl : end;
+        if (pos + (stop - p) > nscroll) {
+            size_t skip = pos < nscroll ? nscroll - pos : 0;
+            volatile uint16_t* cell = console + (pos + skip - nscroll);
+            for (const char* q = p + skip; q != stop; ++q) {
+                *cell++ = (unsigned char) *q | color;
+            }
+        }
+        pos += stop - p;
+        if (!nl) {
+            break;
+        }
+        size_t eol = pos + CONSOLE_COLUMNS - pos % CONSOLE_COLUMNS;
+        for (size_t i = max(pos, nscroll); i < eol; ++i) {
+            console[i - nscroll] = ' ' | color;
+        }
+        pos = eol;
+        p = nl + 1;
+    }
+
+    cursorpos = pos - nscroll;
+#if CHICKADEE_KERNEL
+    consolestate::get().cursor();
+#endif
+    return pos - nscroll;
+}
+
+
 // console_vprintf, console_printf
 //    Print a message onto the console, starting at the given cursor position.
 
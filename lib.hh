@@ -319,6 +319,126 @@ struct bitset_view {
 
 // Add new system calls here.
 // Your numbers should be >=128 to avoid conflicts.
+#define SYSCALL_HUGEPAGE_ALLOC  128
+#define SYSCALL_RING_SETUP      129
+#define SYSCALL_RING_ENTER      130
+#define SYSCALL_FUTEX           131
+#define SYSCALL_PROFILE         132
+#define SYSCALL_GETUSAGE        133
+#define SYSCALL_LOG             134
+#define SYSCALL_CLOCK_GETTIME   135
+
+// `SYSCALL_KTEST` operations
+#define KTEST_WAIT_QUEUES   1   // run wait queue tests
+#define KTEST_BENCH         2   // run kernel microbenchmark (see k-bench.cc)
+#define KTEST_HALT          3   // finish; power off if built with `HALT=N`
+#define KTEST_KEYBOARD      4   // queue keyboard input (see p-teststdio.cc)
+
+// `sys_futex` operations
+#define FUTEX_WAIT      0
+#define FUTEX_WAKE      1
+#define FUTEX_SWAP      2
+
+// `sys_profile` operations
+#define PROFILE_START   0       // start sampling at `arg` Hz per CPU
+#define PROFILE_STOP    1
+#define PROFILE_DUMP    2       // write folded stacks to `log.txt`
+
+// `sys_getusage` targets (or the ID of the caller or a child process)
+#define USAGE_SELF      0       // calling process, all threads
+#define USAGE_SYSTEM    -1      // all CPUs
+#define USAGE_THREAD    -2      // calling thread
+#define USAGE_CPU(i)    (-16 - (i))     // CPU `i`
+
+// `sys_clock_gettime` clocks
+#define CLOCK_MONOTONIC 1       // nanoseconds since boot, from the TSC
+
+
+// Process data page
+//    The kernel maps a read-only `procdata` page at `VA_PROCDATA` in every
+//    process and keeps it current, so processes can read these values
+//    without a system call. `cpu`, `ticks`, and `tsc` are refreshed each
+//    time the process is scheduled; since every timer interrupt
+//    reschedules, `ticks` lags the kernel's count by at most one tick.
+//
+//    Those fields are guarded by a seqlock: `gen` is odd while the kernel
+//    is updating them, and increases by 2 per update. To read a
+//    consistent set, read `gen`, then the fields, then `gen` again, and
+//    retry if the two differ or are odd (see `sys_getticks_tsc`).
+
+#define VA_PROCDATA     0x00007FFFFFFFF000UL   // last page of low memory
+
+struct procdata {
+    volatile pid_t pid;            // process ID
+    volatile pid_t ppid;           // parent process ID
+    volatile int cpu;              // CPU of the last-scheduled thread
+    volatile int ncpu;             // number of CPUs
+    volatile unsigned hz;          // timer ticks per second
+    volatile unsigned long ticks;  // timer ticks since boot
+    volatile uint64_t tsc;         // `rdtsc()` when `ticks` was recorded
+    volatile uint64_t tsc_hz;      // calibrated TSC cycles per second
+    volatile unsigned long gen;    // seqlock generation for `cpu`-`tsc`
+};
+
+
+// Submission/completion rings
+//    `sys_ring_setup` maps a `ring_header`, followed by `nentries`
+//    submission entries and `nentries` completion entries, into the
+//    process. The process fills submission entries and advances
+//    `sq_tail`; the kernel consumes them, advancing `sq_head`, and posts a
+//    completion entry for each, advancing `cq_tail`; the process consumes
+//    completions and advances `cq_head`. Indexes are free-running
+//    counters; entry `i` lives at index `i & (nentries - 1)`.
+//
+//    A submission's `op` is a system call number and `args` are that
+//    system call's first four arguments. Supported operations are
+//    `SYSCALL_READ`, `SYSCALL_WRITE`, `SYSCALL_READDISKFILE`, and
+//    `SYSCALL_SYNC`; others complete with `E_NOSYS`.
+//
+//    Completions may be posted out of order: `SYSCALL_READDISKFILE`
+//    submissions wait for their disk reads without holding up later
+//    submissions.
+//
+//    A polled ring's kernel task sleeps when it has nothing to do,
+//    setting `RING_NEED_WAKEUP` in `flags`; the process must then call
+//    `sys_ring_enter` to have new submissions consumed.
+
+#define RING_MAXENTRIES 256
+#define RING_SETUP_POLL 1          // a kernel task consumes submissions
+#define RING_NEED_WAKEUP 0x100     // set by kernel: poller is asleep
+
+struct ring_sqe {
+    uint32_t op;                   // system call number
+    uint32_t reserved;
+    uint64_t user_data;            // copied to the completion
+    uintptr_t args[4];             // system call arguments
+};
+
+struct ring_cqe {
+    uint64_t user_data;            // from the submission
+    int64_t result;                // system call return value
+};
+
+struct ring_header {
+    uint32_t sq_head;              // written by kernel
+    uint32_t sq_tail;              // written by process
+    uint32_t cq_head;              // written by process
+    uint32_t cq_tail;              // written by kernel
+    uint32_t nentries;             // power of 2, <= RING_MAXENTRIES
+    uint32_t flags;                // `RING_SETUP_` flags
+    uint32_t reserved[10];
+
+    inline ring_sqe* sqes() {
+        return reinterpret_cast<ring_sqe*>(this + 1);
+    }
+    inline ring_cqe* cqes() {
+        return reinterpret_cast<ring_cqe*>(sqes() + nentries);
+    }
+    static constexpr size_t size(unsigned nentries) {
+        return sizeof(ring_header)
+            + nentries * (sizeof(ring_sqe) + sizeof(ring_cqe));
+    }
+};
 
 
 // System call error return values
@@ -378,9 +498,27 @@ inline bool is_error(uintptr_t r) {
 // System call structures
 
 struct usage {
-    unsigned long time;
-    size_t free_pages;
-    size_t allocated_pages;
+    unsigned long time;               // ticks since boot
+    size_t free_pages;                // free physical pages (system-wide)
+    size_t allocated_pages;           // allocated physical pages
+
+    // CPU time is measured in TSC cycles
+    uint64_t utime_cycles;            // user-mode CPU time
+    uint64_t stime_cycles;            // kernel-mode CPU time
+    uint64_t idle_cycles;             // idle time (CPUs only)
+    unsigned long nvcsw;              // voluntary context switches
+    unsigned long nivcsw;             // involuntary context switches
+    unsigned long npagefaults;        // page faults
+    unsigned long nread;              // bytes read
+    unsigned long nwritten;           // bytes written
+    unsigned long ndiskio;            // disk commands issued
+    unsigned long nbufcache_hits;     // buffer cache hits
+    unsigned long nbufcache_misses;   // buffer cache misses
+};
+
+struct timespec {
+    long tv_sec;                      // seconds
+    long tv_nsec;                     // nanoseconds, 0-999999999
 };
 
 
@@ -442,6 +580,17 @@ void console_clear();
 int console_puts(int cpos, int color, const char* s, size_t len);
 
 
+// console_write(color, s, len)
+//    Write `len` characters to the console at the cursor position in color
+//    `color`, scrolling as needed, and move the cursor. Unlike
+//    `console_puts`, escape sequences are not interpreted; only `\n` is
+//    special. The console scrolls at most once per call, so writing a
+//    large buffer at once is much cheaper than writing it piecemeal.
+//
+//    Returns the final position of the cursor.
+int console_write(int color, const char* s, size_t len);
+
+
 // console_printf(cpos, format, ...)
 //    Print a formatted message to the CGA console.
 //
@@ -541,6 +690,8 @@ template <typename T> struct printfmt<T*>   { static constexpr char spec[] = "p"
 
 template <typename T> constexpr char printfmt<T*>::spec[];
 
+#include "format.hh"
+
 
 // Assertions
 
@@ -0,0 +1,58 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Disk read benchmark using `sys_readdiskfile` on `benchdata`, a 1 MiB
+// file that `make bench` adds to the disk image: sequential reads with a
+// cold buffer cache, sequential reads again, and random block-sized
+// reads. Run by `make bench`.
+
+static constexpr size_t readsz = 4096;
+static constexpr unsigned nrandom = 1024;
+static char buf[readsz];
+
+static size_t read_sequential() {
+    size_t off = 0;
+    ssize_t n;
+    while ((n = sys_readdiskfile("benchdata", buf, readsz, off)) > 0) {
+        off += n;
+    }
+    if (n < 0) {
+        panic("bench-diskread: benchdata: error %zd\n", n);
+    }
+    return off;
+}
+
+static void run_sequential(const char* metric) {
+    unsigned long tick0 = sys_getticks();
+    uint64_t tsc0 = rdtsc();
+    size_t nbytes = read_sequential();
+    bench_report_rate("diskread", metric, nbytes,
+                      rdtsc() - tsc0, sys_getticks() - tick0);
+}
+
+void process_main() {
+    sys_sync(1);
+    run_sequential("seq_cold");
+    run_sequential("seq_warm");
+
+    size_t nblocks = read_sequential() / readsz;
+    assert_gt(nblocks, 0UL);
+    rand_engine rng;
+    sys_sync(1);
+    unsigned long tick0 = sys_getticks();
+    uint64_t tsc0 = rdtsc();
+    for (unsigned i = 0; i != nrandom; ++i) {
+        size_t b = rng() % nblocks;
+        ssize_t n = sys_readdiskfile("benchdata", buf, readsz, b * readsz);
+        assert_eq(n, ssize_t(readsz));
+    }
+    bench_report_rate("diskread", "random4k", nrandom * readsz,
+                      rdtsc() - tsc0, sys_getticks() - tick0);
+
+    // This test runs before `sys_exit` is implemented, so it can’t halt
+    // the machine by exiting; with `HALT=N` (as under `make bench`),
+    // this powers off.
+    make_syscall(SYSCALL_KTEST, KTEST_HALT);
+    while (true) {
+    }
+}
@@ -0,0 +1,75 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Microbenchmark for the lib.cc block and string routines. Prints the
+// average number of cycles per call for sizes from 8 B to 64 KiB.
+
+static constexpr size_t maxsize = 65536;
+static char src[maxsize + 64];
+static char dst[maxsize + 64];
+static volatile size_t sink;
+
+enum bench_op { op_memcpy, op_memmove, op_memset, op_memcmp, op_memchr,
+                op_strlen, nops };
+static const char* const op_names[] = {
+    "memcpy", "memmove", "memset", "memcmp", "memchr", "strlen"
+};
+
+static uint64_t run(bench_op op, size_t sz, size_t iters) {
+    uint64_t start = rdtsc();
+    for (size_t i = 0; i != iters; ++i) {
+        switch (op) {
+        case op_memcpy:
+            memcpy(dst, src, sz);
+            break;
+        case op_memmove:
+            memmove(dst + 1, dst, sz);
+            break;
+        case op_memset:
+            memset(dst, i, sz);
+            break;
+        case op_memcmp:
+            sink = memcmp(dst, src, sz);
+            break;
+        case op_memchr:
+            sink = reinterpret_cast<uintptr_t>(memchr(src, 0, sz));
+            break;
+        case op_strlen:
+            sink = strlen(src);
+            break;
+        default:
+            break;
+        }
+    }
+    return (rdtsc() - start) / iters;
+}
+
+void process_main() {
+    console_printf("%7s", "size");
+    for (int op = 0; op != nops; ++op) {
+        console_printf(" %9s", op_names[op]);
+    }
+    console_printf("\n");
+
+    for (size_t sz = 8; sz <= maxsize; sz *= 2) {
+        // `src` is a string of length `sz`; `dst` differs in the last byte
+        memset(src, 'a', sz);
+        src[sz] = 0;
+        memcpy(dst, src, sz);
+        dst[sz - 1] = 'b';
+
+        size_t iters = max(size_t(16), (size_t(16) << 20) / sz);
+        console_printf("%7zu", sz);
+        for (int op = 0; op != nops; ++op) {
+            run(bench_op(op), sz, 4);     // warm up
+            console_printf(" %9lu", run(bench_op(op), sz, iters));
+        }
+        console_printf("\n");
+    }
+    console_printf("(cycles per call)\n");
+    console_printf(CS_SUCCESS "bench-string done\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -0,0 +1,137 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Context-switch benchmark. Two threads pass a token back and forth
+// through a futex word; each pass is one context switch. Compares
+// `FUTEX_SWAP`, which switches directly to the woken thread, with a
+// separate `FUTEX_WAKE` and `FUTEX_WAIT`, for threads on the same CPU
+// and (if there is more than one CPU) on different CPUs.
+
+extern uint8_t end[];
+
+static constexpr unsigned npasses = 20000;
+
+enum bench_mode { m_swap, m_wakewait };
+static const char* const mode_names[] = { "swap", "wake+wait" };
+
+static bench_mode mode;
+static uint32_t turn;            // 1 when the partner should run
+static uint32_t trial;           // bumped to release a trial's threads
+static uint32_t done;            // last trial whose partner has finished
+static volatile pid_t partner_tid;
+static volatile bool stop;
+static unsigned nstacks;
+
+
+// pass(to)
+//    Give the token to the other thread (`to` is the new `turn`), then
+//    wait until it comes back.
+static void pass(uint32_t to) {
+    __atomic_store_n(&turn, to, __ATOMIC_RELEASE);
+    if (mode == m_swap) {
+        while (__atomic_load_n(&turn, __ATOMIC_ACQUIRE) == to) {
+            sys_futex_swap(&turn, to, &turn);
+        }
+    } else {
+        sys_futex(&turn, FUTEX_WAKE, 1);
+        while (__atomic_load_n(&turn, __ATOMIC_ACQUIRE) == to) {
+            sys_futex(&turn, FUTEX_WAIT, to);
+        }
+    }
+}
+
+static int partner(void* arg) {
+    uint32_t mytrial = reinterpret_cast<uintptr_t>(arg);
+    uint32_t t;
+    while ((t = __atomic_load_n(&trial, __ATOMIC_ACQUIRE)) < mytrial) {
+        sys_futex(&trial, FUTEX_WAIT, t);
+    }
+    if (sys_gettid() != partner_tid) {
+        // wrong CPU; exit and free the thread ID
+        return 0;
+    }
+    while (__atomic_load_n(&turn, __ATOMIC_ACQUIRE) == 0) {
+        sys_futex(&turn, FUTEX_WAIT, 0);
+    }
+    while (!stop) {
+        pass(0);
+    }
+    __atomic_store_n(&done, mytrial, __ATOMIC_RELEASE);
+    sys_futex(&done, FUTEX_WAKE, 1);
+    return 0;
+}
+
+// start_partner(same_cpu)
+//    Start a partner thread on this thread's CPU, or on another CPU.
+//    Threads run on CPU `tid % ncpu`, so clone until a thread ID lands
+//    on the right CPU; the extra threads exit once the trial starts.
+static void start_partner(bool same_cpu) {
+    int ncpu = sys_procdata()->ncpu;
+    int mycpu = sys_gettid() % ncpu;
+    uint32_t mytrial = trial + 1;
+    pid_t t;
+    do {
+        char* stack = reinterpret_cast<char*>(
+            round_up(reinterpret_cast<uintptr_t>(end), PAGESIZE)
+            + (16 + nstacks) * PAGESIZE
+        );
+        ++nstacks;
+        assert_eq(sys_page_alloc(stack), 0);
+        t = sys_clone(partner, reinterpret_cast<void*>(uintptr_t(mytrial)),
+                      stack + PAGESIZE);
+        assert_gt(t, 0);
+    } while ((t % ncpu == mycpu) != same_cpu);
+
+    partner_tid = t;
+    stop = false;
+    __atomic_store_n(&turn, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&trial, mytrial, __ATOMIC_RELEASE);
+    sys_futex(&trial, FUTEX_WAKE, -1U);
+}
+
+static void run(bench_mode m, bool same_cpu) {
+    mode = m;
+    start_partner(same_cpu);
+    pass(1);                     // warm up
+
+    unsigned long tick0 = sys_getticks();
+    uint64_t tsc0 = rdtsc();
+    for (unsigned i = 0; i != npasses; ++i) {
+        pass(1);
+    }
+    uint64_t cycles = rdtsc() - tsc0;
+    unsigned long nticks = sys_getticks() - tick0;
+
+    // release the partner
+    stop = true;
+    __atomic_store_n(&turn, 1, __ATOMIC_RELEASE);
+    sys_futex(&turn, FUTEX_WAKE, 1);
+    uint32_t d;
+    while ((d = __atomic_load_n(&done, __ATOMIC_ACQUIRE)) != trial) {
+        sys_futex(&done, FUTEX_WAIT, d);
+    }
+
+    unsigned long nswitches = 2UL * npasses;
+    console_printf("%-10s %-6s %10lu %14lu\n", mode_names[m],
+                   same_cpu ? "same" : "cross",
+                   nticks * (1000000000UL / sys_procdata()->hz) / nswitches,
+                   cycles / nswitches);
+}
+
+void process_main() {
+    console_printf("%-10s %-6s %10s %14s\n",
+                   "mode", "cpu", "ns/switch", "cycles/switch");
+    run(m_swap, true);
+    run(m_wakewait, true);
+    if (sys_procdata()->ncpu > 1) {
+        run(m_swap, false);
+        run(m_wakewait, false);
+    }
+    console_printf("(ns from timer ticks, resolution %u ms per run)\n",
+                   1000 / sys_procdata()->hz);
+    console_printf(CS_SUCCESS "bench-switch done\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -0,0 +1,31 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// System call latency benchmark: cycles per null system call
+// (`sys_gettid`) and per `sys_yield` round trip. Run by `make bench`.
+
+static constexpr unsigned niters = 100000;
+
+void process_main() {
+    for (unsigned i = 0; i != 1000; ++i) {      // warm up
+        sys_gettid();
+    }
+    uint64_t tsc0 = rdtsc();
+    for (unsigned i = 0; i != niters; ++i) {
+        sys_gettid();
+    }
+    bench_report("syscall", "null", (rdtsc() - tsc0) / niters, "cycles");
+
+    tsc0 = rdtsc();
+    for (unsigned i = 0; i != niters; ++i) {
+        sys_yield();
+    }
+    bench_report("syscall", "yield", (rdtsc() - tsc0) / niters, "cycles");
+
+    // This test runs before `sys_exit` is implemented, so it can’t halt
+    // the machine by exiting; with `HALT=N` (as under `make bench`),
+    // this powers off.
+    make_syscall(SYSCALL_KTEST, KTEST_HALT);
+    while (true) {
+    }
+}
@@ -0,0 +1,32 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Run every kernel microbenchmark (see k-bench.cc) on 1 CPU, then on
+// every CPU count up to the number of CPUs. The kernel prints one line
+// per run, and also logs it to `log.txt` with a `!B` prefix.
+
+void process_main() {
+    int ncpu = sys_procdata()->ncpu;
+    console_printf("%-16s %4s %8s %8s %8s %8s %8s\n", "benchmark", "cpus",
+                   "min", "p50", "p90", "p99", "max");
+    for (int nbcpu = 1; nbcpu <= ncpu; ++nbcpu) {
+        for (unsigned i = 0; true; ++i) {
+            int r = make_syscall(SYSCALL_KTEST, KTEST_BENCH, i, nbcpu);
+            if (r == E_NOENT) {
+                break;
+            } else if (r < 0) {
+                console_printf(CS_ERROR "benchmark %u on %d cpus: error %d\n",
+                               i, nbcpu, r);
+            }
+        }
+    }
+    console_printf("(cycles per operation)\n");
+    console_printf(CS_SUCCESS "kbench done\n");
+
+    // This test runs before `sys_exit` is implemented, so it can’t halt
+    // the machine by exiting. With `HALT=N`, this powers off; otherwise
+    // it never returns.
+    make_syscall(SYSCALL_KTEST, KTEST_HALT);
+    while (true) {
+    }
+}
@@ -4,7 +4,7 @@
 void process_main() {
     int r;
     while (true) {
-        r = make_syscall(SYSCALL_KTEST, 1);
+        r = make_syscall(SYSCALL_KTEST, KTEST_WAIT_QUEUES);
         if (r < 0) {
             console_printf(CS_ERROR "ktestwait appears to have failed!\n");
             console_printf(CS_ERROR "(However, this could be due to a slow computer.)\n");
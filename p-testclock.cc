@@ -0,0 +1,54 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+static uint64_t now_ns() {
+    timespec ts;
+    int r = sys_clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert_eq(r, 0);
+    assert_ge(ts.tv_nsec, 0L);
+    assert_lt(ts.tv_nsec, 1000000000L);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void process_main() {
+    // the clock never goes backwards on this thread
+    uint64_t t0 = now_ns();
+    uint64_t prev = t0, mindelta = -1;
+    for (unsigned i = 0; i != 10000; ++i) {
+        uint64_t t = now_ns();
+        assert_ge(t, prev);
+        if (t != prev) {
+            mindelta = min(mindelta, t - prev);
+        }
+        prev = t;
+    }
+    // sub-microsecond resolution: consecutive readings differ by < 1us
+    assert_lt(mindelta, 1000UL);
+
+    // the clock agrees with `ticks` to within a few ticks
+    unsigned hz = sys_procdata()->hz;
+    unsigned long tick0 = sys_getticks();
+    t0 = now_ns();
+    while (sys_getticks() < tick0 + hz / 2) {
+        sys_yield();
+    }
+    uint64_t elapsed = now_ns() - t0;
+    uint64_t expected = (sys_getticks() - tick0) * (1000000000UL / hz);
+    assert_ge(elapsed + 3 * (1000000000UL / hz), expected);
+    assert_le(elapsed, expected + 3 * (1000000000UL / hz));
+
+    // errors
+    timespec ts;
+    assert_eq(sys_clock_gettime(0, &ts), E_INVAL);
+    assert_eq(sys_clock_gettime(CLOCK_MONOTONIC, nullptr), E_FAULT);
+    assert_eq(sys_clock_gettime(CLOCK_MONOTONIC,
+                                reinterpret_cast<timespec*>(0x1000)),
+              E_FAULT);
+
+    console_printf("clock resolution %lu ns\n", mindelta);
+    console_printf(CS_SUCCESS "testclock succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -0,0 +1,55 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// check_format(format, args...)
+//    `snformat` must produce the same output and length as `snprintf`.
+#define check_format(format, ...) do {                                  \
+        char __a[128], __b[128];                                        \
+        size_t __na = snformat(__a, sizeof(__a), format, __VA_ARGS__);  \
+        ssize_t __nb = snprintf(__b, sizeof(__b), format, __VA_ARGS__); \
+        assert_eq(__na, size_t(__nb));                                  \
+        assert_memeq(__a, __b, __na + 1);                               \
+    } while (0)
+
+void process_main() {
+    // the fast path: plain decimal
+    check_format("%d", 0);
+    check_format("%d %i", 1234567, -1234567);
+    check_format("%ld", -9223372036854775807L - 1);
+    check_format("%lu", 18446744073709551615UL);
+    check_format("%u", -1);
+    check_format("%u", 4000000000U);
+    check_format("%lu", size_t(7));
+
+    // flags, width, and precision
+    check_format("[%5d|%-5d|%05d]", 42, 42, -42);
+    check_format("[%+d|% d|%+d]", 42, 42, -42);
+    check_format("[%.3d|%8.3d|%-8.3d]", 7, -7, 7);
+    check_format("[%.0d|%.0u|%.0x|%3.0d]", 0, 0U, 0U, 0);
+    check_format("[%.0d|%.0x]", 5, 5U);
+    check_format("[%x|%X|%#x|%#X|%#x]", 0xbeefU, 0xbeefU, 0xbeefU, 0xbeefU, 0U);
+    check_format("[%08lx|%-8x|%lx]", 0xabcUL, 0xabcU, -1L);
+    check_format("[%u|%5u|%-5u]", -2, -2, 3);
+
+    // strings, characters, pointers, and literal text
+    check_format("[%s|%8s|%-8s|%.2s]", "abc", "abc", "abc", "abc");
+    check_format("[%c%c] 100%%", 'o', 'k');
+    check_format("%p", reinterpret_cast<void*>(0x1234));
+
+    // `%u` of a negative signed value; zero precision of zero
+    char buf[32];
+    assert_eq(snformat(buf, sizeof(buf), "%u", -1), 10UL);
+    assert_memeq(buf, "4294967295", 11);
+    assert_eq(snformat(buf, sizeof(buf), "%.0d", 0), 0UL);
+    assert_eq(buf[0], '\0');
+
+    // truncation reports the full length
+    assert_eq(snformat(buf, 4, "%d", 123456), 6UL);
+    assert_memeq(buf, "123", 4);
+
+    console_printf(CS_SUCCESS "testformat succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -0,0 +1,64 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Threads contend for a `mutex` and hand off through a
+// `condition_variable`, both of which block in `sys_futex`.
+
+extern uint8_t end[];
+
+static constexpr int nthreads = 4;
+static constexpr int niters = 10000;
+
+static mutex m;
+static condition_variable cv;
+static unsigned long counter;
+static int ndone;
+static uint32_t word;
+
+static int worker(void*) {
+    for (int i = 0; i != niters; ++i) {
+        m.lock();
+        ++counter;
+        m.unlock();
+    }
+    m.lock();
+    ++ndone;
+    cv.notify_all();
+    m.unlock();
+    return 0;
+}
+
+void process_main() {
+    // futex argument checks
+    assert_eq(sys_futex(reinterpret_cast<uint32_t*>(
+                  reinterpret_cast<uintptr_t>(&word) + 1), FUTEX_WAKE, 1),
+              E_INVAL);
+    assert_eq(sys_futex(nullptr, FUTEX_WAKE, 1), E_FAULT);
+    assert_eq(sys_futex(&word, FUTEX_WAIT, 1), E_AGAIN);
+    assert_eq(sys_futex(&word, FUTEX_WAKE, 1), 0);
+    assert_ne(sys_gettid(), 0);
+
+    char* stacks = reinterpret_cast<char*>(
+        round_up(reinterpret_cast<uintptr_t>(end), PAGESIZE) + 16 * PAGESIZE
+    );
+    for (int i = 0; i != nthreads; ++i) {
+        char* stack = stacks + i * PAGESIZE;
+        assert_eq(sys_page_alloc(stack), 0);
+        pid_t t = sys_clone(worker, nullptr, stack + PAGESIZE);
+        assert_gt(t, 0);
+        assert_ne(t, sys_gettid());
+    }
+
+    m.lock();
+    while (ndone != nthreads) {
+        cv.wait(m);
+    }
+    assert_eq(counter, (unsigned long) nthreads * niters);
+    m.unlock();
+
+    console_printf(CS_SUCCESS "testfutex succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
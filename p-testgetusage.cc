@@ -2,6 +2,7 @@
 #include "u-lib.hh"
 
 extern uint8_t end[];
+static volatile unsigned sink;
 
 void process_main() {
     usage u;
@@ -55,6 +56,39 @@ void process_main() {
     assert_eq(total_pages, uptr->free_pages + uptr->allocated_pages);
     assert_le(uptr->free_pages, u.free_pages - 3);
 
+    // check CPU time and I/O accounting
+    for (unsigned i = 0; i != 10000000; ++i) {
+        sink = i;
+    }
+    r = sys_write(1, "", 0);
+    assert_eq(r, 0);
+    r = sys_write(1, "getusage\n", 9);
+    assert_eq(r, 9);
+    usage u2;
+    r = sys_getusage(&u2);
+    assert_eq(r, 0);
+    assert_gt(u2.utime_cycles, u1.utime_cycles);
+    assert_gt(u2.stime_cycles, 0UL);
+    assert_ge(u2.nwritten, u1.nwritten + 9);
+    assert_eq(u2.idle_cycles, 0UL);
+
+    usage ut, us;
+    r = sys_getusage(&ut, USAGE_THREAD);
+    assert_eq(r, 0);
+    assert_ge(ut.utime_cycles, u1.utime_cycles);
+    r = sys_getusage(&us, USAGE_SYSTEM);
+    assert_eq(r, 0);
+    assert_ge(us.utime_cycles, u2.utime_cycles);
+    assert_ge(us.nwritten, u2.nwritten);
+    r = sys_getusage(&us, USAGE_CPU(0));
+    assert_eq(r, 0);
+    r = sys_getusage(&us, sys_getpid());
+    assert_eq(r, 0);
+    r = sys_getusage(&us, USAGE_CPU(sys_procdata()->ncpu));
+    assert_eq(r, E_INVAL);
+    r = sys_getusage(&us, 30000);
+    assert_eq(r, E_SRCH);
+
     console_printf(CS_SUCCESS "testgetusage succeeded!\n");
 
     // This test runs before `sys_exit` is implemented, so we can’t use it.
@@ -0,0 +1,43 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+void process_main() {
+    // the first 2MiB-aligned region above the stack is unused
+    uintptr_t base = round_up(rdrsp(), HUGEPAGESIZE);
+    uint8_t* ptr = reinterpret_cast<uint8_t*>(base);
+
+    // check illegal addresses
+    int r = sys_hugepage_alloc(ptr + PAGESIZE);
+    assert_eq(r, E_INVAL);
+    r = sys_hugepage_alloc(reinterpret_cast<void*>(VA_LOWEND));
+    assert_eq(r, E_INVAL);
+    // the region containing the program text is already in use
+    r = sys_hugepage_alloc(nullptr);
+    assert_eq(r, E_INVAL);
+
+    r = sys_hugepage_alloc(ptr);
+    if (r == E_NOMEM) {
+        console_printf("testhugepage: no contiguous 2MiB page, "
+                       "skipping\n");
+    } else {
+        assert_eq(r, 0);
+        // memory is zeroed and writable throughout
+        for (size_t off = 0; off != HUGEPAGESIZE; off += PAGESIZE) {
+            assert_eq(ptr[off], 0);
+            assert_eq(ptr[off + PAGESIZE - 1], 0);
+            ptr[off] = off / PAGESIZE;
+        }
+        for (size_t off = 0; off != HUGEPAGESIZE; off += PAGESIZE) {
+            assert_eq(ptr[off], uint8_t(off / PAGESIZE));
+        }
+        // cannot allocate over an existing mapping
+        r = sys_hugepage_alloc(ptr);
+        assert_eq(r, E_INVAL);
+    }
+
+    console_printf(CS_SUCCESS "testhugepage succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -0,0 +1,57 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Checks the process data page and compares the cost of reading the
+// process ID from it with the cost of a `getpid` system call.
+
+static volatile pid_t sink;
+
+void process_main() {
+    const procdata* pd = sys_procdata();
+    assert_eq(sys_getpid(), pid_t(make_syscall(SYSCALL_GETPID)));
+    assert_eq(sys_getppid(), 0);
+    assert(pd->hz > 0);
+    assert(sys_getcpu() >= 0);
+
+    // the page is read-only, so allocating over it fails
+    assert_lt(sys_page_alloc(reinterpret_cast<void*>(VA_PROCDATA)), 0);
+
+    // the tick count advances as the process is rescheduled
+    unsigned long t0 = sys_getticks();
+    while (sys_getticks() - t0 < 2) {
+        sys_yield();
+    }
+    assert(pd->tsc > 0);
+
+    // the seqlock generation is even between updates, and the paired
+    // tick count and TSC come from one refresh
+    assert(pd->tsc_hz > 0);
+    uint64_t tsc;
+    unsigned long t1 = sys_getticks_tsc(&tsc);
+    assert_ge(t1, t0 + 2);
+    assert_gt(tsc, 0UL);
+    unsigned long gen = pd->gen;
+    sys_yield();
+    assert_gt(pd->gen, gen);
+    assert_eq(pd->gen % 2, 0UL);
+
+    const unsigned iters = 100000;
+    uint64_t start = rdtsc();
+    for (unsigned i = 0; i != iters; ++i) {
+        sink = sys_getpid();
+    }
+    uint64_t page_cycles = (rdtsc() - start) / iters;
+    start = rdtsc();
+    for (unsigned i = 0; i != iters; ++i) {
+        sink = make_syscall(SYSCALL_GETPID);
+    }
+    uint64_t syscall_cycles = (rdtsc() - start) / iters;
+    console_printf("getpid: %lu cycles from page, %lu cycles by syscall\n",
+                   page_cycles, syscall_cycles);
+
+    console_printf(CS_SUCCESS "testprocdata succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -0,0 +1,39 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Profiles a CPU-bound loop for a quarter second, then dumps the samples
+// as folded stacks. `make check-profile` runs this and checks the log.
+
+[[gnu::noinline]] static unsigned long testprofile_spin(unsigned long n) {
+    volatile unsigned long x = 0;
+    for (unsigned long i = 0; i != n; ++i) {
+        x = x + i;
+    }
+    return x;
+}
+
+void process_main() {
+    assert_eq(sys_profile(-1), E_INVAL);
+    assert_eq(sys_profile(PROFILE_START, 1000), 0);
+
+    unsigned long start = sys_getticks();
+    unsigned hz = sys_procdata()->hz;
+    while (sys_getticks() - start < (hz + 3) / 4) {
+        testprofile_spin(100000);
+        // refresh `sys_getticks()`
+        sys_yield();
+    }
+
+    assert_eq(sys_profile(PROFILE_STOP), 0);
+    int n = sys_profile(PROFILE_DUMP);
+    assert_gt(n, 0);
+    console_printf("testprofile: %d distinct stacks\n", n);
+    console_printf(CS_SUCCESS "testprofile succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so it can’t halt
+    // the machine by exiting. With `HALT=N`, this powers off; otherwise
+    // it never returns.
+    make_syscall(SYSCALL_KTEST, KTEST_HALT);
+    while (true) {
+    }
+}
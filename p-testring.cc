@@ -0,0 +1,111 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Reads emerson.txt a byte at a time, once with `sys_readdiskfile` and
+// once through a submission ring, and checks that the results match.
+// Then reads it a block at a time through the ring from an empty buffer
+// cache, so the disk reads are in flight together.
+
+static char expected[8192];
+static char actual[8192];
+static const char filename[] = "emerson.txt";
+
+void process_main() {
+    // read the file the slow way
+    uint64_t start = rdtsc();
+    size_t sz = 0;
+    while (sz < sizeof(expected)) {
+        ssize_t n = sys_readdiskfile(filename, &expected[sz], 1, sz);
+        assert_ge(n, 0);
+        if (n == 0) {
+            break;
+        }
+        sz += n;
+    }
+    uint64_t syscall_cycles = rdtsc() - start;
+    assert_gt(sz, 0U);
+
+    // set up the ring above the stack
+    auto r = reinterpret_cast<ring_header*>(round_up(rdrsp(), PAGESIZE));
+    assert_eq(sys_ring_setup(r, 3), E_INVAL);
+    assert_eq(sys_ring_setup(r + 1, 64), E_INVAL);
+    assert_eq(sys_ring_setup(r, 64), 0);
+    assert_eq(sys_ring_setup(r, 64), E_INVAL);
+    assert_eq(r->nentries, 64U);
+
+    // read the file again in batches
+    start = rdtsc();
+    size_t submitted = 0, completed = 0;
+    while (completed < sz) {
+        unsigned nsub = 0;
+        while (submitted < sz) {
+            ring_sqe* sqe = ring_get_sqe(r);
+            if (!sqe) {
+                break;
+            }
+            sqe->op = SYSCALL_READDISKFILE;
+            sqe->user_data = submitted;
+            sqe->args[0] = reinterpret_cast<uintptr_t>(filename);
+            sqe->args[1] = reinterpret_cast<uintptr_t>(&actual[submitted]);
+            sqe->args[2] = 1;
+            sqe->args[3] = submitted;
+            ring_advance_sq(r);
+            ++submitted;
+            ++nsub;
+        }
+        assert_eq(sys_ring_enter(nsub, nsub), ssize_t(nsub));
+        // completions may arrive in any order
+        while (const ring_cqe* cqe = ring_peek_cqe(r)) {
+            assert_lt(cqe->user_data, submitted);
+            assert_eq(cqe->result, 1);
+            ring_advance_cq(r);
+            ++completed;
+        }
+    }
+    uint64_t ring_cycles = rdtsc() - start;
+    assert_memeq(actual, expected, sz);
+
+    // read whole blocks from an empty cache
+    memset(actual, 0, sizeof(actual));
+    assert_eq(sys_sync(1), 0);
+    size_t nblocks = (sz + 4095) / 4096;
+    for (size_t b = 0; b != nblocks; ++b) {
+        ring_sqe* sqe = ring_get_sqe(r);
+        sqe->op = SYSCALL_READDISKFILE;
+        sqe->user_data = b;
+        sqe->args[0] = reinterpret_cast<uintptr_t>(filename);
+        sqe->args[1] = reinterpret_cast<uintptr_t>(&actual[b * 4096]);
+        sqe->args[2] = 4096;
+        sqe->args[3] = b * 4096;
+        ring_advance_sq(r);
+    }
+    assert_eq(sys_ring_enter(nblocks, nblocks), ssize_t(nblocks));
+    unsigned seen = 0;
+    while (const ring_cqe* cqe = ring_peek_cqe(r)) {
+        assert_lt(cqe->user_data, nblocks);
+        assert_eq(cqe->result, ssize_t(min(sz - cqe->user_data * 4096,
+                                           size_t(4096))));
+        seen |= 1U << cqe->user_data;
+        ring_advance_cq(r);
+    }
+    assert_eq(seen, (1U << nblocks) - 1);
+    assert_memeq(actual, expected, sz);
+
+    // unsupported operations complete with an error
+    ring_sqe* sqe = ring_get_sqe(r);
+    sqe->op = SYSCALL_FORK;
+    sqe->user_data = 1000;
+    ring_advance_sq(r);
+    assert_eq(sys_ring_enter(1), 1);
+    const ring_cqe* cqe = ring_peek_cqe(r);
+    assert(cqe && cqe->user_data == 1000 && cqe->result == E_NOSYS);
+    ring_advance_cq(r);
+
+    console_printf("%zu reads: %lu cycles by syscall, %lu cycles by ring\n",
+                   sz, syscall_cycles, ring_cycles);
+    console_printf(CS_SUCCESS "testring succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -0,0 +1,105 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Exercises buffered I/O on fds 0 and 1. Output buffering is checked
+// with the `nwritten` usage counter; input is typed into the keyboard
+// buffer with `KTEST_KEYBOARD`, so the test needs no real keyboard.
+
+static unsigned long nwritten() {
+    usage u;
+    assert_eq(sys_getusage(&u, USAGE_SELF), 0);
+    return u.nwritten;
+}
+
+static void type(const char* s) {
+    size_t n = strlen(s);
+    assert_eq(make_syscall(SYSCALL_KTEST, KTEST_KEYBOARD,
+                           reinterpret_cast<uintptr_t>(s), n), n);
+}
+
+static char inbuf[8];
+static char outbuf[16];
+static char linebuf[BUFSIZ];
+
+void process_main() {
+    // a small `stdin` buffer makes reads refill often; `setvbuf` must
+    // come before any input
+    assert_eq(setvbuf(stdin, inbuf, _IOLBF, sizeof(inbuf)), 0);
+
+    // `stdout` is line buffered: nothing is written until a newline
+    unsigned long w = nwritten();
+    assert_eq(printf("teststdio: line"), 15);
+    assert_eq(nwritten(), w);
+    assert_eq(fputs(" buffering\n", stdout), 11);
+    assert_eq(nwritten(), w + 26);
+
+    // `fflush` writes a partial line; `fflush(nullptr)`, which `sys_exit`
+    // calls, flushes every `FILE`
+    w = nwritten();
+    fputs("teststdio: flush", stdout);
+    assert_eq(nwritten(), w);
+    assert_eq(fflush(stdout), 0);
+    assert_eq(nwritten(), w + 16);
+    fputs("...", stdout);
+    assert_eq(fflush(nullptr), 0);
+    assert_eq(nwritten(), w + 19);
+    fputc('\n', stdout);
+    assert_eq(nwritten(), w + 20);
+
+    // full buffering with a small buffer writes whole buffers
+    assert_eq(setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf)), 0);
+    w = nwritten();
+    fputs("teststdio:\n", stdout);
+    assert_eq(nwritten(), w);
+    fputs(" full buf\n", stdout);
+    assert_eq(nwritten(), w + 11);
+    assert_eq(fflush(stdout), 0);
+    assert_eq(nwritten(), w + 21);
+    assert_eq(setvbuf(stdout, linebuf, _IOLBF, sizeof(linebuf)), 0);
+
+    // reading a line-buffered `stdin` first flushes `stdout` prompts
+    type("x\n");
+    w = nwritten();
+    fputs("teststdio: prompt> ", stdout);
+    assert_eq(nwritten(), w);
+    assert_eq(fgetc(stdin), 'x');
+    assert_eq(nwritten(), w + 19);
+    assert_eq(fgetc(stdin), '\n');
+    fputc('\n', stdout);
+
+    // `fgets` stops after each newline and splits long lines
+    char buf[32];
+    type("first line\nsecond\n");
+    assert_eq(fgets(buf, sizeof(buf), stdin), buf);
+    assert_memeq(buf, "first line\n", 12);
+    assert_eq(fgets(buf, sizeof(buf), stdin), buf);
+    assert_memeq(buf, "second\n", 8);
+    type("abcdefgh\n");
+    assert_eq(fgets(buf, 4, stdin), buf);
+    assert_memeq(buf, "abc", 4);
+    assert_eq(fgets(buf, 4, stdin), buf);
+    assert_memeq(buf, "def", 4);
+    assert_eq(fgets(buf, 4, stdin), buf);
+    assert_memeq(buf, "gh\n", 4);
+
+    // `fread` refills the 8-byte buffer until it has everything
+    type("0123456789abcdefghi\n");
+    assert_eq(fread(buf, 1, 20, stdin), 20UL);
+    assert_memeq(buf, "0123456789abcdefghi\n", 20);
+
+    // Ctrl-D is end of file
+    type("\x04");
+    assert(!fgets(buf, sizeof(buf), stdin));
+    assert(feof(stdin));
+    clearerr(stdin);
+    assert(!feof(stdin));
+
+    console_printf(CS_SUCCESS "teststdio succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so it can’t halt
+    // the machine by exiting. With `HALT=N`, this powers off; otherwise
+    // it never returns.
+    make_syscall(SYSCALL_KTEST, KTEST_HALT);
+    while (true) {
+    }
+}
@@ -0,0 +1,40 @@
+#define CHICKADEE_OPTIONAL_PROCESS 1
+#include "u-lib.hh"
+
+// Allocates more memory than the machine has, so that the kernel must
+// swap pages out, then checks that every page reads back correctly.
+// Run with a small machine: `make MEM=4M run-testswap`.
+
+static constexpr size_t npages = 1024;
+
+void process_main() {
+    uint8_t* base = reinterpret_cast<uint8_t*>(
+        round_up(rdrsp(), HUGEPAGESIZE)
+    );
+
+    size_t n = 0;
+    for (; n != npages; ++n) {
+        uint8_t* pg = base + n * PAGESIZE;
+        if (sys_page_alloc(pg) < 0) {
+            break;
+        }
+        memset(pg, n & 0xFF, PAGESIZE);
+        reinterpret_cast<size_t*>(pg)[0] = n;
+    }
+    console_printf("testswap: allocated %zu pages\n", n);
+    assert_gt(n, 0UL);
+
+    for (size_t pass = 0; pass != 2; ++pass) {
+        for (size_t i = 0; i != n; ++i) {
+            uint8_t* pg = base + i * PAGESIZE;
+            assert_eq(reinterpret_cast<size_t*>(pg)[0], i);
+            assert_eq(pg[PAGESIZE - 1], uint8_t(i & 0xFF));
+        }
+    }
+
+    console_printf(CS_SUCCESS "testswap succeeded!\n");
+
+    // This test runs before `sys_exit` is implemented, so we can’t use it.
+    while (true) {
+    }
+}
@@ -11,6 +11,8 @@ size_t prepare_bigbuf() {
 }
 
 void process_main() {
+    // progress dots should appear as they are printed
+    setvbuf(stdout, nullptr, _IONBF, 0);
     printf("Starting testwritefs2 (assuming clean file system)...\n");
 
     // read file
@@ -1,21 +1,21 @@
 #include "u-lib.hh"
 
-static int unparse_counts(char* buf, size_t bufsz, int mode,
-                          const size_t* counts, const char* fname) {
+static void print_counts(int mode, const size_t* counts, const char* fname) {
     const char* sep = strlen(fname) ? " " : "";
     if (mode < 0) {
-        return snprintf(buf, bufsz, "%8zu %7zu %7zu%s%s\n",
-                        counts[0], counts[1], counts[2], sep, fname);
+        fformat(stdout, "%8zu %7zu %7zu%s%s\n",
+                counts[0], counts[1], counts[2], sep, fname);
     } else if (*sep) {
-        return snprintf(buf, bufsz, "%8zu%s%s\n",
-                        counts[mode], sep, fname);
+        fformat(stdout, "%8zu%s%s\n", counts[mode], sep, fname);
     } else {
-        return snprintf(buf, bufsz, "%zu\n", counts[mode]);
+        fformat(stdout, "%zu\n", counts[mode]);
     }
 }
 
 void process_main(int argc, char** argv) {
     static char buf[4096];
+    // output is written once, at exit
+    setvbuf(stdout, nullptr, _IOFBF, 0);
 
     int mode = -1;
     int argno = 1;
@@ -73,10 +73,7 @@ void process_main(int argc, char** argv) {
             sys_close(fd);
         }
 
-        int n = unparse_counts(buf, sizeof(buf), mode, counts,
-                               argno < argc ? argv[argno] : "");
-        ssize_t w = sys_write(1, buf, n);
-        assert(w == n);
+        print_counts(mode, counts, argno < argc ? argv[argno] : "");
 
         for (int i = 0; i < 3; ++i) {
             totals[i] += counts[i];
@@ -86,9 +83,7 @@ void process_main(int argc, char** argv) {
     }
 
     if (nfiles > 1) {
-        int n = unparse_counts(buf, sizeof(buf), mode, totals, "total");
-        ssize_t w = sys_write(1, buf, n);
-        assert(w == n);
+        print_counts(mode, totals, "total");
     }
 
     sys_exit(0);
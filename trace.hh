@@ -0,0 +1,39 @@
+#ifndef CHICKADEE_TRACE_HH
+#define CHICKADEE_TRACE_HH
+
+// trace.hh
+//    Kernel trace event types and log formats, shared by the kernel
+//    (k-trace.cc) and the host decoder (build/tracedecode.cc).
+//
+//    The kernel drains its trace buffers to `log.txt` as lines that start
+//    with `!`, so the decoder can pick them out from other log messages:
+//
+//    `!C HZ TICKS TSC`                 clock sample: `ticks` and `rdtsc()`
+//                                      read together
+//    `!T CPU TSC TYPE TID ARG0 ARG1`   one event (numbers in hex)
+//    `!D CPU N`                        `N` events were dropped on `CPU`
+//                                      because its buffer was full
+
+enum trace_type {
+    tr_none = 0,
+    tr_syscall_enter,     // arg0: syscall number
+    tr_syscall_exit,      // arg0: syscall number, arg1: return value
+    tr_schedule,          // arg0: previous task's ID (0 if none)
+    tr_unblock,           // arg0: ID of the task made runnable
+    tr_disk_submit,       // arg0: disk offset, arg1: byte count
+    tr_disk_complete,     // arg0: completed slot mask
+    tr_bufcache_hit,      // arg0: block number
+    tr_bufcache_miss,     // arg0: block number
+    tr_ntypes
+};
+
+static const char* const trace_type_names[] = {
+    "none", "syscall", "sysret", "schedule", "unblock",
+    "disk_submit", "disk_complete", "bufcache_hit", "bufcache_miss"
+};
+
+#define TRACE_CLOCK_FORMAT      "!C %u %lu %lx\n"
+#define TRACE_EVENT_FORMAT      "!T %x %lx %x %x %lx %lx\n"
+#define TRACE_DROP_FORMAT       "!D %x %lu\n"
+
+#endif
@@ -19,21 +19,60 @@ int dprintf(int fd, const char* format, ...) {
 
 
 // printf
-//    Like `dprintf(1, ...)`.
+//    Like `fprintf(stdout, ...)`.
 
 int printf(const char* format, ...) {
+    va_list val;
+    va_start(val, format);
+    int n = vfprintf(stdout, format, val);
+    va_end(val);
+    return n;
+}
+
+
+// log_printf
+//    Like `printf`, but writes to `log.txt`.
+
+int log_printf(const char* format, ...) {
     char buf[513];
     va_list val;
     va_start(val, format);
     size_t n = vsnprintf(buf, sizeof(buf), format, val);
     if (n < sizeof(buf)) {
-        return sys_write(1, buf, n);
+        return sys_log(buf, n);
     } else {
         return E_2BIG;
     }
 }
 
 
+// bench_report(bench, metric, value, unit),
+// bench_report_rate(bench, metric, nbytes, cycles, nticks)
+//    Report benchmark results on the console and in `log.txt`.
+
+void bench_report(const char* bench, const char* metric,
+                  unsigned long value, const char* unit) {
+    char buf[128];
+    size_t n = snformat(buf, sizeof(buf), "BENCH %s %s %lu %s\n",
+                        bench, metric, value, unit);
+    n = min(n, sizeof(buf) - 1);
+    sys_write(1, buf, n);
+    sys_log(buf, n);
+}
+
+void bench_report_rate(const char* bench, const char* metric, size_t nbytes,
+                       uint64_t cycles, unsigned long nticks) {
+    char name[64];
+    snformat(name, sizeof(name), "%s_kibps", metric);
+    bench_report(bench, name,
+                 nbytes / 1024 * sys_procdata()->hz / max(nticks, 1UL),
+                 "KiB/s");
+    snformat(name, sizeof(name), "%s_cycles_per_kib", metric);
+    bench_report(bench, name, cycles / max(nbytes / 1024, size_t(1)),
+                 "cycles");
+}
+
+
 // panic, assert_fail
 //     Call the SYSCALL_PANIC system call so the kernel loops until Control-C.
 
@@ -69,10 +108,30 @@ void assert_fail(const char* file, int line, const char* msg,
 }
 
 
-// sys_clone
-//    Create a new thread.
+// sys_clone(function, arg, stack_top)
+//    The new thread starts with the caller's registers, except that
+//    `%rax == 0` and `%rsp == stack_top`. `function` and `arg` travel in
+//    callee-saved registers.
 
 pid_t sys_clone(int (*function)(void*), void* arg, char* stack_top) {
-    // Your code here
-    return E_NOSYS;
+    register uintptr_t rax asm("rax") = SYSCALL_CLONE;
+    register uintptr_t rdi asm("rdi") = reinterpret_cast<uintptr_t>(stack_top);
+    register uintptr_t r12 asm("r12") = reinterpret_cast<uintptr_t>(function);
+    register uintptr_t r13 asm("r13") = reinterpret_cast<uintptr_t>(arg);
+    asm volatile ("syscall\n\t"
+                  "testq %%rax, %%rax\n\t"
+                  "jnz 1f\n\t"
+                  // new thread: `sys_texit(function(arg))`
+                  "movq %%r13, %%rdi\n\t"
+                  "callq *%%r12\n\t"
+                  "movq %%rax, %%rdi\n\t"
+                  "movl %[texit], %%eax\n\t"
+                  "syscall\n\t"
+                  "ud2\n"
+                  "1:"
+                  : "+a" (rax), "+D" (rdi)
+                  : "r" (r12), "r" (r13), [texit] "i" (SYSCALL_TEXIT)
+                  : "cc", "rcx", "rdx", "rsi", "r8", "r9", "r10", "r11",
+                    "memory");
+    return rax;
 }
@@ -73,10 +73,17 @@ __always_inline void access_memory(const void* ptr) {
 }
 
 
+// sys_procdata()
+//    Return the process data page, which the kernel keeps up to date.
+//    Reading it does not enter the kernel.
+inline const procdata* sys_procdata() {
+    return reinterpret_cast<const procdata*>(VA_PROCDATA);
+}
+
 // sys_getpid
 //    Return current process ID.
 inline pid_t sys_getpid() {
-    return make_syscall(SYSCALL_GETPID);
+    return sys_procdata()->pid;
 }
 
 // sys_yield
@@ -108,13 +115,24 @@ inline int sys_consoletype(int type) {
 }
 
 // sys_page_alloc(addr)
-//    Allocate a page of memory at address `addr`. `Addr` must be page-aligned
-//    (i.e., a multiple of PAGESIZE == 4096). Return 0 on success, E_NOMEM on
-//    out of memory, and E_INVAL on invalid `addr`.
+//    Allocate a zero-filled page of memory at address `addr`. `Addr` must be
+//    page-aligned (i.e., a multiple of PAGESIZE == 4096). Return 0 on
+//    success, E_NOMEM on out of memory, and E_INVAL on invalid `addr`.
 inline int sys_page_alloc(void* addr) {
     return make_syscall(SYSCALL_PAGE_ALLOC, reinterpret_cast<uintptr_t>(addr));
 }
 
+// sys_hugepage_alloc(addr)
+//    Allocate a 2MiB page of zeroed memory at address `addr`, mapped with a
+//    single large page table entry. `Addr` must be a multiple of
+//    HUGEPAGESIZE, and no page may already be mapped in
+//    [addr, addr + HUGEPAGESIZE). Return 0 on success, E_NOMEM on out of
+//    (physically contiguous) memory, and E_INVAL on invalid `addr`.
+inline int sys_hugepage_alloc(void* addr) {
+    return make_syscall(SYSCALL_HUGEPAGE_ALLOC,
+                        reinterpret_cast<uintptr_t>(addr));
+}
+
 // sys_fork()
 //    Fork the current process. On success, return the child's process ID to
 //    the parent, and return 0 to the child. On failure, return E_NOMEM on out
@@ -124,8 +142,12 @@ inline pid_t sys_fork() {
 }
 
 // sys_exit(status)
-//    Exit this process. Does not return.
+//    Flush buffered output (see `FILE`), then exit this process. Does not
+//    return.
+struct FILE;
+int fflush(FILE* f);
 [[noreturn]] inline void sys_exit(int status) {
+    fflush(nullptr);
     make_syscall(SYSCALL_EXIT, status);
     assert(false);
 }
@@ -139,7 +161,42 @@ inline int sys_msleep(unsigned msec) {
 // sys_getppid()
 //    Return parent process ID.
 inline pid_t sys_getppid() {
-    return E_NOSYS;
+    return sys_procdata()->ppid;
+}
+
+// sys_getcpu()
+//    Return the index of the CPU running this process. The process may
+//    migrate at any time, so the result is only a hint.
+inline int sys_getcpu() {
+    return sys_procdata()->cpu;
+}
+
+// sys_getticks()
+//    Return the number of timer ticks since boot, as of the most recent
+//    time this process was scheduled. There are `sys_procdata()->hz`
+//    ticks per second.
+inline unsigned long sys_getticks() {
+    return sys_procdata()->ticks;
+}
+
+// sys_getticks_tsc(tsc)
+//    Like `sys_getticks()`, but also store the `rdtsc()` value taken at
+//    the same refresh in `*tsc`, so `rdtsc() - *tsc` is the time since
+//    that tick count was recorded (`sys_procdata()->tsc_hz` cycles per
+//    second). Retries until it reads both under one seqlock generation.
+inline unsigned long sys_getticks_tsc(uint64_t* tsc) {
+    const procdata* pd = sys_procdata();
+    while (true) {
+        unsigned long gen = __atomic_load_n(&pd->gen, __ATOMIC_ACQUIRE);
+        unsigned long ticks = pd->ticks;
+        uint64_t t = pd->tsc;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (gen % 2 == 0 && pd->gen == gen) {
+            *tsc = t;
+            return ticks;
+        }
+        pause();
+    }
 }
 
 // sys_waitpid(pid, status, options)
@@ -298,6 +355,9 @@ inline pid_t sys_gettid() {
 //
 //    Unlike most other system calls, we recommend you implement `sys_clone`
 //    in `u-lib.cc`.
+//
+//    Threads do not migrate. Thread `t` runs on CPU `t % ncpu`, where
+//    `ncpu` is `sys_procdata()->ncpu`.
 pid_t sys_clone(int (*function)(void*), void* arg, char* stack_top);
 
 // sys_texit(status)
@@ -309,6 +369,302 @@ pid_t sys_clone(int (*function)(void*), void* arg, char* stack_top);
     assert(false);
 }
 
+// sys_futex(uaddr, op, val)
+//    Wait or wake on the 32-bit word at `uaddr`. `FUTEX_WAIT` blocks until
+//    a `FUTEX_WAKE` on the same word, unless `*uaddr != val`, in which case
+//    it returns E_AGAIN immediately; it returns 0 after a wakeup.
+//    `FUTEX_WAKE` wakes up to `val` waiters and returns the number woken.
+//    Words are identified by physical address, so threads of a process
+//    (or processes sharing memory) see the same futex.
+inline int sys_futex(uint32_t* uaddr, int op, uint32_t val) {
+    access_memory(uaddr);
+    return make_syscall(SYSCALL_FUTEX, reinterpret_cast<uintptr_t>(uaddr),
+                        op, val);
+}
+
+// sys_futex_swap(uaddr, val, wake_uaddr)
+//    Wake one waiter on `wake_uaddr`, then wait on `uaddr` as
+//    `sys_futex(uaddr, FUTEX_WAIT, val)` would. If the woken thread runs on
+//    this CPU, the kernel switches to it directly, so two threads can hand
+//    control back and forth without a trip through the scheduler.
+inline int sys_futex_swap(uint32_t* uaddr, uint32_t val,
+                          uint32_t* wake_uaddr) {
+    access_memory(uaddr);
+    access_memory(wake_uaddr);
+    return make_syscall(SYSCALL_FUTEX, reinterpret_cast<uintptr_t>(uaddr),
+                        FUTEX_SWAP, val,
+                        reinterpret_cast<uintptr_t>(wake_uaddr));
+}
+
+// sys_profile(op, arg)
+//    Control the kernel's sampling profiler. `PROFILE_START` discards old
+//    samples and starts sampling every CPU at about `arg` samples per
+//    second (0 means `HZ`). `PROFILE_STOP` stops sampling. `PROFILE_DUMP`
+//    stops sampling and writes the samples to `log.txt` as folded stacks,
+//    one `!P`-prefixed line per distinct stack; `make profile` extracts
+//    them for flamegraph tools. Returns 0 (`PROFILE_DUMP`: the number of
+//    distinct stacks) or a negative error code.
+inline int sys_profile(int op, unsigned long arg = 0) {
+    return make_syscall(SYSCALL_PROFILE, op, arg);
+}
+
+// sys_getusage(u, who)
+//    Store resource usage in `*u`. `who` is `USAGE_SELF` (this process),
+//    `USAGE_THREAD` (this thread), `USAGE_SYSTEM` (all CPUs),
+//    `USAGE_CPU(i)`, or the ID of this process or a child process.
+//    Returns 0, `E_FAULT`, `E_INVAL` for a bad `who`, `E_SRCH` if there is
+//    no process `who`, or `E_CHILD` if it is not a child.
+inline int sys_getusage(usage* u, pid_t who = USAGE_SELF) {
+    return make_syscall(SYSCALL_GETUSAGE, reinterpret_cast<uintptr_t>(u),
+                        who);
+}
+
+// sys_log(buf, sz)
+//    Append `sz` bytes from `buf` to the kernel log (`log.txt`). Returns
+//    the number of bytes written or `E_FAULT`.
+inline ssize_t sys_log(const char* buf, size_t sz) {
+    access_memory(buf);
+    return make_syscall(SYSCALL_LOG, reinterpret_cast<uintptr_t>(buf), sz);
+}
+
+// sys_clock_gettime(clockid, ts)
+//    Store the current time of clock `clockid` in `*ts`. `CLOCK_MONOTONIC`
+//    counts nanoseconds since boot with sub-microsecond resolution.
+//    Returns 0, `E_INVAL` for an unknown clock, or `E_FAULT`.
+inline int sys_clock_gettime(int clockid, timespec* ts) {
+    return make_syscall(SYSCALL_CLOCK_GETTIME, clockid,
+                        reinterpret_cast<uintptr_t>(ts));
+}
+
+
+// mutex
+//    A lock for threads. Uncontended operations don't enter the kernel;
+//    contended `lock` calls block in `sys_futex`.
+struct mutex {
+    uint32_t v_ = 0;          // 0 unlocked, 1 locked, 2 locked with waiters
+
+    inline void lock() {
+        uint32_t c = 0;
+        if (__atomic_compare_exchange_n(&v_, &c, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        if (c != 2) {
+            c = __atomic_exchange_n(&v_, 2, __ATOMIC_ACQUIRE);
+        }
+        while (c != 0) {
+            sys_futex(&v_, FUTEX_WAIT, 2);
+            c = __atomic_exchange_n(&v_, 2, __ATOMIC_ACQUIRE);
+        }
+    }
+    inline void unlock() {
+        if (__atomic_exchange_n(&v_, 0, __ATOMIC_RELEASE) == 2) {
+            sys_futex(&v_, FUTEX_WAKE, 1);
+        }
+    }
+};
+
+// condition_variable
+//    A condition variable for use with `mutex`. As usual, callers should
+//    recheck their condition after `wait` returns.
+struct condition_variable {
+    uint32_t seq_ = 0;
+
+    inline void wait(mutex& m) {
+        uint32_t seq = __atomic_load_n(&seq_, __ATOMIC_RELAXED);
+        m.unlock();
+        sys_futex(&seq_, FUTEX_WAIT, seq);
+        m.lock();
+    }
+    inline void notify_one() {
+        __atomic_fetch_add(&seq_, 1, __ATOMIC_RELEASE);
+        sys_futex(&seq_, FUTEX_WAKE, 1);
+    }
+    inline void notify_all() {
+        __atomic_fetch_add(&seq_, 1, __ATOMIC_RELEASE);
+        sys_futex(&seq_, FUTEX_WAKE, -1U);
+    }
+};
+
+
+// sys_ring_setup(addr, nentries, flags)
+//    Map a submission/completion ring with `nentries` entries at
+//    page-aligned address `addr` (see `ring_header` in lib.hh). `nentries`
+//    must be a power of 2 no larger than RING_MAXENTRIES, and the ring's
+//    pages must be unmapped. If `flags & RING_SETUP_POLL`, a kernel task
+//    consumes submissions as they appear. Each thread has at most one ring.
+//    Returns 0 on success, E_INVAL on bad arguments or if a ring exists,
+//    and E_NOMEM on out of memory.
+inline int sys_ring_setup(ring_header* addr, unsigned nentries,
+                          int flags = 0) {
+    return make_syscall(SYSCALL_RING_SETUP, reinterpret_cast<uintptr_t>(addr),
+                        nentries, flags);
+}
+
+// sys_ring_enter(to_submit, min_complete)
+//    Consume up to `to_submit` queued submissions (for a polled ring, the
+//    kernel task consumes them instead), then wait until at least
+//    `min_complete` completions are available or nothing is left in
+//    flight. Disk reads complete asynchronously, so a completion may
+//    appear only at a later call. Returns the number of submissions
+//    consumed (0 for a polled ring).
+inline ssize_t sys_ring_enter(unsigned to_submit, unsigned min_complete = 0) {
+    // submitted operations may read or write any memory
+    asm volatile ("" : : : "memory");
+    ssize_t r = make_syscall(SYSCALL_RING_ENTER, to_submit, min_complete);
+    asm volatile ("" : : : "memory");
+    return r;
+}
+
+// ring_get_sqe(r)
+//    Return the next free submission entry in `r`, or nullptr if the
+//    submission ring is full. Fill it in, then call `ring_advance_sq`.
+inline ring_sqe* ring_get_sqe(ring_header* r) {
+    uint32_t head = __atomic_load_n(&r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_tail - head == r->nentries) {
+        return nullptr;
+    }
+    return &r->sqes()[r->sq_tail & (r->nentries - 1)];
+}
+
+// ring_advance_sq(r)
+//    Make the entry returned by `ring_get_sqe(r)` visible to the kernel.
+inline void ring_advance_sq(ring_header* r) {
+    __atomic_store_n(&r->sq_tail, r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+// ring_wake_poller(r)
+//    Call after advancing the submission ring of a polled ring: if the
+//    ring's kernel task is asleep, wake it.
+inline void ring_wake_poller(ring_header* r) {
+    // order the `sq_tail` store before the `flags` load
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->flags, __ATOMIC_RELAXED) & RING_NEED_WAKEUP) {
+        sys_ring_enter(0);
+    }
+}
+
+// ring_peek_cqe(r)
+//    Return the oldest unconsumed completion in `r`, or nullptr if
+//    there is none. Call `ring_advance_cq` when done with it.
+inline const ring_cqe* ring_peek_cqe(ring_header* r) {
+    uint32_t tail = __atomic_load_n(&r->cq_tail, __ATOMIC_ACQUIRE);
+    if (r->cq_head == tail) {
+        return nullptr;
+    }
+    return &r->cqes()[r->cq_head & (r->nentries - 1)];
+}
+
+// ring_advance_cq(r)
+//    Release the completion returned by `ring_peek_cqe(r)`.
+inline void ring_advance_cq(ring_header* r) {
+    __atomic_store_n(&r->cq_head, r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+// Buffered I/O (see u-stdio.cc)
+//    A `FILE` buffers reads or writes on a file descriptor, so a program
+//    that writes many small pieces makes one `sys_write` per buffer.
+//    `stdout` is line buffered, `stderr` is unbuffered, and `sys_exit`
+//    flushes every `FILE`. `printf` writes to `stdout`, so output without
+//    a trailing newline appears only at the next newline, `fflush`, or
+//    `sys_exit`; a process that spins or crashes instead of exiting
+//    should `fflush(stdout)` first. `dprintf` is unbuffered, so mixing
+//    `dprintf(1, ...)` with `printf` can reorder output.
+
+#define BUFSIZ      1024
+#define EOF         (-1)
+#define FOPEN_MAX   8           // open `FILE`s, including the standard three
+
+#define _IOFBF      0           // full buffering
+#define _IOLBF      1           // line buffering
+#define _IONBF      2           // no buffering
+
+struct FILE {
+    int fd_;
+    int bufmode_;               // `_IOFBF`, `_IOLBF`, or `_IONBF`
+    int flags_;                 // `f_` constants below
+    char* buf_;
+    size_t bufsz_;
+    size_t pos_;                // reading: next byte; writing: bytes pending
+    size_t len_;                // reading: bytes in buffer
+    mutex lock_;
+
+    enum {
+        f_open = 1, f_read = 2, f_write = 4, f_eof = 8, f_error = 16,
+        f_reading = 32, f_writing = 64
+    };
+};
+
+extern FILE* const stdin;
+extern FILE* const stdout;
+extern FILE* const stderr;
+
+// fdopen(fd, mode)
+//    Return a `FILE` for open file descriptor `fd`. `mode` is `"r"`, `"w"`,
+//    `"a"`, or one of those followed by `"+"`. Returns `nullptr` if all
+//    `FILE`s are in use.
+FILE* fdopen(int fd, const char* mode);
+
+// fopen(pathname, mode)
+//    Open `pathname` with `sys_open` and return a `FILE` for it, or
+//    `nullptr` on error. `"w"` creates and truncates the file. Needs
+//    `sys_open` (and `sys_lseek` for `"a"`), which the kernel does not
+//    implement yet; until then this always returns `nullptr`.
+FILE* fopen(const char* pathname, const char* mode);
+
+// fclose(f)
+//    Flush `f`, close its file descriptor, and release it. Returns 0 or
+//    `EOF`.
+int fclose(FILE* f);
+
+// fflush(f)
+//    Write out `f`'s buffered output. `fflush(nullptr)` flushes every
+//    `FILE`. Returns 0, or `EOF` on a write error.
+int fflush(FILE* f);
+
+// setvbuf(f, buf, mode, size)
+//    Set `f`'s buffering mode and, if `buf != nullptr`, its buffer. Call
+//    before any I/O on `f`. Returns 0 or -1.
+int setvbuf(FILE* f, char* buf, int mode, size_t size);
+
+// fwrite(ptr, size, nmemb, f), fputs(s, f), fputc(c, f)
+//    Buffered output. `fwrite` returns the number of complete items
+//    written; `fputs` returns a nonnegative number or `EOF`; `fputc`
+//    returns `c` or `EOF`.
+size_t fwrite(const void* ptr, size_t size, size_t nmemb, FILE* f);
+int fputs(const char* s, FILE* f);
+int fputc(int c, FILE* f);
+
+// fprintf(f, format, ...), vfprintf(f, format, val)
+//    Formatted buffered output. Returns the number of characters written,
+//    or a negative number on error.
+int fprintf(FILE* f, const char* format, ...);
+int vfprintf(FILE* f, const char* format, va_list val);
+
+// fread(ptr, size, nmemb, f), fgets(s, size, f), fgetc(f)
+//    Buffered input. `fread` returns the number of complete items read;
+//    `fgets` reads at most `size - 1` characters, stopping after a
+//    newline, and returns `s` or `nullptr` at end of file or on error;
+//    `fgetc` returns the next character as an `unsigned char` or `EOF`.
+size_t fread(void* ptr, size_t size, size_t nmemb, FILE* f);
+char* fgets(char* s, int size, FILE* f);
+int fgetc(FILE* f);
+
+// feof(f), ferror(f), clearerr(f), fileno(f)
+inline int feof(FILE* f) {
+    return f->flags_ & FILE::f_eof;
+}
+inline int ferror(FILE* f) {
+    return f->flags_ & FILE::f_error;
+}
+inline void clearerr(FILE* f) {
+    f->flags_ &= ~(FILE::f_eof | FILE::f_error);
+}
+inline int fileno(FILE* f) {
+    return f->fd_;
+}
+
 
 // dprintf(fd, format, ...)
 //    Construct a string from `format` and pass it to `sys_write(fd)`.
@@ -317,7 +673,53 @@ pid_t sys_clone(int (*function)(void*), void* arg, char* stack_top);
 int dprintf(int fd, const char* format, ...);
 
 // printf(format, ...)
-//    Like `dprintf(1, format, ...)`.
+//    Like `fprintf(stdout, format, ...)`.
 int printf(const char* format, ...);
 
+// dformat(fd, format, args...)
+//    Like `dprintf`, but `format` is parsed at compile time (see format.hh).
+template <typename... Args>
+inline int dformat(int fd, format_string<std::decay_t<Args>...> format,
+                   const Args&... args) {
+    char buf[513];
+    size_t n = snformat(buf, sizeof(buf), format, args...);
+    return n < sizeof(buf) ? sys_write(fd, buf, n) : E_2BIG;
+}
+
+// fformat(f, format, args...)
+//    Like `fprintf`, but `format` is parsed at compile time.
+template <typename... Args>
+inline int fformat(FILE* f, format_string<std::decay_t<Args>...> format,
+                   const Args&... args) {
+    char buf[128];
+    struct state {
+        FILE* f;
+        bool ok;
+    } st = { f, true };
+    size_t n = format_stream(buf, sizeof(buf),
+                             [] (void* arg, const char* s, size_t len) {
+        auto sp = static_cast<state*>(arg);
+        sp->ok = fwrite(s, 1, len, sp->f) == len && sp->ok;
+    }, &st, format, args...);
+    return st.ok ? int(n) : EOF;
+}
+
+// log_printf(format, ...)
+//    Like `printf`, but writes to `log.txt` with `sys_log`.
+int log_printf(const char* format, ...);
+
+// bench_report(bench, metric, value, unit)
+//    Print a benchmark result as a line `BENCH <bench> <metric> <value>
+//    <unit>` to the console and to `log.txt`. `make bench` collects these
+//    lines into `bench.txt`.
+void bench_report(const char* bench, const char* metric,
+                  unsigned long value, const char* unit);
+
+// bench_report_rate(bench, metric, nbytes, cycles, nticks)
+//    Report the throughput of moving `nbytes` bytes in `cycles` TSC cycles
+//    and `nticks` timer ticks, as `<metric>_kibps` (KiB per second, from
+//    ticks) and `<metric>_cycles_per_kib` results.
+void bench_report_rate(const char* bench, const char* metric, size_t nbytes,
+                       uint64_t cycles, unsigned long nticks);
+
 #endif
@@ -0,0 +1,356 @@
+#include "u-lib.hh"
+
+// u-stdio.cc
+//
+//    Buffered I/O on file descriptors. A `FILE` is either reading (its
+//    buffer holds bytes read but not yet consumed, `[pos_, len_)`) or
+//    writing (its buffer holds `pos_` bytes not yet written); switching
+//    directions drops the unread bytes, seeking back over them when the
+//    file supports it. Each `FILE` has a mutex, so threads can share one.
+
+static char stdio_bufs[FOPEN_MAX][BUFSIZ];
+static FILE files[FOPEN_MAX] = {
+    { 0, _IOLBF, FILE::f_open | FILE::f_read, stdio_bufs[0], BUFSIZ, 0, 0,
+      {} },
+    { 1, _IOLBF, FILE::f_open | FILE::f_write, stdio_bufs[1], BUFSIZ, 0, 0,
+      {} },
+    { 2, _IONBF, FILE::f_open | FILE::f_write, stdio_bufs[2], BUFSIZ, 0, 0,
+      {} }
+};
+
+FILE* const stdin = &files[0];
+FILE* const stdout = &files[1];
+FILE* const stderr = &files[2];
+
+
+// write_all(f, data, n)
+//    Write `n` bytes to `f`'s file descriptor, retrying short writes. On
+//    error, sets `f_error` and returns false.
+static bool write_all(FILE* f, const char* data, size_t n) {
+    while (n != 0) {
+        ssize_t w = sys_write(f->fd_, data, n);
+        if (w == E_AGAIN) {
+            sys_yield();
+        } else if (w <= 0) {
+            f->flags_ |= FILE::f_error;
+            return false;
+        } else {
+            data += w;
+            n -= w;
+        }
+    }
+    return true;
+}
+
+// flush_locked(f)
+//    Write out pending output and drop any unread input. `f->lock_` must
+//    be held.
+static int flush_locked(FILE* f) {
+    if (f->flags_ & FILE::f_writing) {
+        size_t n = f->pos_;
+        f->pos_ = 0;
+        f->flags_ &= ~FILE::f_writing;
+        if (n != 0 && !write_all(f, f->buf_, n)) {
+            return EOF;
+        }
+    } else if (f->flags_ & FILE::f_reading) {
+        if (f->pos_ != f->len_) {
+            // seek back over unread input; fails harmlessly on pipes
+            // and the console
+            sys_lseek(f->fd_, -off_t(f->len_ - f->pos_), LSEEK_CUR);
+        }
+        f->pos_ = f->len_ = 0;
+        f->flags_ &= ~FILE::f_reading;
+    }
+    return 0;
+}
+
+// put_locked(f, data, n)
+//    Buffer `n` bytes of output. Returns false on error.
+static bool put_locked(FILE* f, const char* data, size_t n) {
+    if (!(f->flags_ & FILE::f_write)) {
+        f->flags_ |= FILE::f_error;
+        return false;
+    }
+    if (!(f->flags_ & FILE::f_writing)) {
+        flush_locked(f);
+        f->flags_ |= FILE::f_writing;
+    }
+
+    // large writes and unbuffered files skip the buffer
+    if (f->bufmode_ == _IONBF || n >= f->bufsz_) {
+        return flush_locked(f) == 0 && write_all(f, data, n);
+    }
+
+    if (n > f->bufsz_ - f->pos_ && flush_locked(f) != 0) {
+        return false;
+    }
+    f->flags_ |= FILE::f_writing;
+    memcpy(f->buf_ + f->pos_, data, n);
+    f->pos_ += n;
+    if (f->pos_ == f->bufsz_
+        || (f->bufmode_ == _IOLBF && memchr(data, '\n', n))) {
+        return flush_locked(f) == 0;
+    }
+    return true;
+}
+
+// fill_locked(f)
+//    Make sure `f` has unread input. Returns false at end of file or on
+//    error.
+static bool fill_locked(FILE* f) {
+    if (f->flags_ & FILE::f_reading && f->pos_ != f->len_) {
+        return true;
+    }
+    if (!(f->flags_ & FILE::f_read)) {
+        f->flags_ |= FILE::f_error;
+        return false;
+    }
+    flush_locked(f);
+    // reading from a line-buffered file flushes `stdout`, so prompts
+    // appear before input is requested
+    if (f->bufmode_ == _IOLBF && f != stdout) {
+        stdout->lock_.lock();
+        flush_locked(stdout);
+        stdout->lock_.unlock();
+    }
+
+    ssize_t n;
+    while ((n = sys_read(f->fd_, f->buf_, f->bufsz_)) == E_AGAIN) {
+        sys_yield();
+    }
+    if (n <= 0) {
+        f->flags_ |= n == 0 ? FILE::f_eof : FILE::f_error;
+        return false;
+    }
+    f->flags_ |= FILE::f_reading;
+    f->pos_ = 0;
+    f->len_ = n;
+    return true;
+}
+
+
+FILE* fdopen(int fd, const char* mode) {
+    int flags = FILE::f_open;
+    if (mode[0] == 'r') {
+        flags |= FILE::f_read;
+    } else if (mode[0] == 'w' || mode[0] == 'a') {
+        flags |= FILE::f_write;
+    } else {
+        return nullptr;
+    }
+    if (strchr(mode, '+')) {
+        flags |= FILE::f_read | FILE::f_write;
+    }
+
+    for (int i = 0; i != FOPEN_MAX; ++i) {
+        FILE* f = &files[i];
+        f->lock_.lock();
+        if (!(f->flags_ & FILE::f_open)) {
+            f->fd_ = fd;
+            f->bufmode_ = _IOFBF;
+            f->flags_ = flags;
+            f->buf_ = stdio_bufs[i];
+            f->bufsz_ = BUFSIZ;
+            f->pos_ = f->len_ = 0;
+            f->lock_.unlock();
+            return f;
+        }
+        f->lock_.unlock();
+    }
+    return nullptr;
+}
+
+FILE* fopen(const char* pathname, const char* mode) {
+    int of;
+    if (mode[0] == 'r') {
+        of = OF_READ;
+    } else if (mode[0] == 'w') {
+        of = OF_WRITE | OF_CREATE | OF_TRUNC;
+    } else if (mode[0] == 'a') {
+        of = OF_WRITE | OF_CREATE;
+    } else {
+        return nullptr;
+    }
+    if (strchr(mode, '+')) {
+        of |= OF_READ | OF_WRITE;
+    }
+
+    int fd = sys_open(pathname, of);
+    if (fd < 0) {
+        return nullptr;
+    }
+    if (mode[0] == 'a') {
+        sys_lseek(fd, 0, LSEEK_END);
+    }
+    FILE* f = fdopen(fd, mode);
+    if (!f) {
+        sys_close(fd);
+    }
+    return f;
+}
+
+int fclose(FILE* f) {
+    f->lock_.lock();
+    int r = flush_locked(f);
+    if (sys_close(f->fd_) < 0) {
+        r = EOF;
+    }
+    f->flags_ = 0;
+    f->lock_.unlock();
+    return r;
+}
+
+int fflush(FILE* f) {
+    if (!f) {
+        int r = 0;
+        for (int i = 0; i != FOPEN_MAX; ++i) {
+            if ((files[i].flags_ & FILE::f_writing)
+                && fflush(&files[i]) != 0) {
+                r = EOF;
+            }
+        }
+        return r;
+    }
+    f->lock_.lock();
+    int r = f->flags_ & FILE::f_writing ? flush_locked(f) : 0;
+    f->lock_.unlock();
+    return r;
+}
+
+int setvbuf(FILE* f, char* buf, int mode, size_t size) {
+    if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) {
+        return -1;
+    }
+    f->lock_.lock();
+    int r = -1;
+    if (f->pos_ == 0 && f->len_ == 0) {
+        f->bufmode_ = mode;
+        if (buf && size) {
+            f->buf_ = buf;
+            f->bufsz_ = size;
+        }
+        r = 0;
+    }
+    f->lock_.unlock();
+    return r;
+}
+
+
+size_t fwrite(const void* ptr, size_t size, size_t nmemb, FILE* f) {
+    if (size == 0 || nmemb == 0) {
+        return 0;
+    }
+    f->lock_.lock();
+    bool ok = put_locked(f, reinterpret_cast<const char*>(ptr),
+                         size * nmemb);
+    f->lock_.unlock();
+    return ok ? nmemb : 0;
+}
+
+int fputs(const char* s, FILE* f) {
+    size_t n = strlen(s);
+    f->lock_.lock();
+    bool ok = put_locked(f, s, n);
+    f->lock_.unlock();
+    return ok ? int(n) : EOF;
+}
+
+int fputc(int c, FILE* f) {
+    char ch = c;
+    f->lock_.lock();
+    bool ok = put_locked(f, &ch, 1);
+    f->lock_.unlock();
+    return ok ? (unsigned char) ch : EOF;
+}
+
+
+// file_printer
+//    Formats directly into a `FILE`'s buffer; the caller holds its lock.
+
+struct file_printer : public printer {
+    FILE* f_;
+    int n_ = 0;
+    bool ok_ = true;
+    file_printer(FILE* f)
+        : f_(f) {
+    }
+    void putc(unsigned char c) override {
+        char ch = c;
+        ok_ = put_locked(f_, &ch, 1) && ok_;
+        ++n_;
+    }
+};
+
+int vfprintf(FILE* f, const char* format, va_list val) {
+    f->lock_.lock();
+    // format unbuffered output in one piece, so it takes one write
+    int bufmode = f->bufmode_;
+    if (bufmode == _IONBF) {
+        f->bufmode_ = _IOFBF;
+    }
+    file_printer fp(f);
+    fp.vprintf(format, val);
+    if (bufmode == _IONBF) {
+        f->bufmode_ = _IONBF;
+        fp.ok_ = flush_locked(f) == 0 && fp.ok_;
+    }
+    f->lock_.unlock();
+    return fp.ok_ ? fp.n_ : EOF;
+}
+
+int fprintf(FILE* f, const char* format, ...) {
+    va_list val;
+    va_start(val, format);
+    int n = vfprintf(f, format, val);
+    va_end(val);
+    return n;
+}
+
+
+size_t fread(void* ptr, size_t size, size_t nmemb, FILE* f) {
+    if (size == 0 || nmemb == 0) {
+        return 0;
+    }
+    char* dst = reinterpret_cast<char*>(ptr);
+    size_t want = size * nmemb, n = 0;
+    f->lock_.lock();
+    while (n < want && fill_locked(f)) {
+        size_t ncopy = min(want - n, f->len_ - f->pos_);
+        memcpy(dst + n, f->buf_ + f->pos_, ncopy);
+        f->pos_ += ncopy;
+        n += ncopy;
+    }
+    f->lock_.unlock();
+    return n / size;
+}
+
+char* fgets(char* s, int size, FILE* f) {
+    if (size <= 0) {
+        return nullptr;
+    }
+    int n = 0;
+    f->lock_.lock();
+    while (n < size - 1 && fill_locked(f)) {
+        const char* start = f->buf_ + f->pos_;
+        size_t avail = min(size_t(size - 1 - n), f->len_ - f->pos_);
+        auto nl = reinterpret_cast<const char*>(memchr(start, '\n', avail));
+        size_t ncopy = nl ? nl + 1 - start : avail;
+        memcpy(s + n, start, ncopy);
+        f->pos_ += ncopy;
+        n += ncopy;
+        if (nl) {
+            break;
+        }
+    }
+    f->lock_.unlock();
+    s[n] = '\0';
+    return n ? s : nullptr;
+}
+
+int fgetc(FILE* f) {
+    f->lock_.lock();
+    int c = fill_locked(f) ? (unsigned char) f->buf_[f->pos_++] : EOF;
+    f->lock_.unlock();
+    return c;
+}
@@ -16,6 +16,8 @@
 #define PAGEINDEXBITS   9                      // # bits in a page index level
 #define PAGESIZE        (1UL << PAGEOFFBITS)   // Size of page in bytes
 #define PAGEOFFMASK     (PAGESIZE - 1)
+#define HUGEPAGESIZE    (PAGESIZE << PAGEINDEXBITS)     // 2MiB (PS level-1)
+#define GIGAPAGESIZE    (HUGEPAGESIZE << PAGEINDEXBITS) // 1GiB (PS level-2)
 
 // Permission flags: define whether page is accessible
 #define PTE_P           0x1UL    // entry is Present
@@ -29,6 +31,7 @@
 #define PTE_PS          0x80UL   // entry has a large Page Size
 #define PTE_PWT         0x8UL
 #define PTE_PCD         0x10UL
+#define PTE_PS_PAT      0x1000UL // Page Attribute Table bit in PS entry
 #define PTE_XD          0x8000000000000000UL // entry is eXecute Disabled
 // These flags are available for OS use (the processor ignores them):
 #define PTE_OS1         0x200UL
@@ -179,6 +182,11 @@ typedef struct x86_64_msr_t {
 #define CR4_PCE                 0x00000100      // Perfmonitor Counter Enable
 #define CR4_OSFXSR              0x00000200      // OS FXSAVE/FXRSTOR support
 #define CR4_VMXE                0x00004000      // VMX Enable
+#define CR4_PCIDE               0x00020000      // PCID Enable
+
+// %cr3 flag bits
+#define CR3_PCIDMASK            0x0000000000000FFFUL // PCID (if CR4_PCIDE)
+#define CR3_NOFLUSH             0x8000000000000000UL // keep PCID's TLB entries
 
 // eflags bits (useful for rdeflags() and wreflags())
 #define EFLAGS_CF               0x00000001      // Carry Flag